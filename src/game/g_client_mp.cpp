@@ -511,6 +511,7 @@ const char *ClientConnect( int clientNum, unsigned short scriptPersId )
 	client = &level.clients[clientNum];
 
 	memset( client, 0, sizeof( *client ) );
+	HudElem_ResetClient( clientNum );
 
 	ci = &level_bgs.clientinfo[clientNum];
 	pXAnimTree = level_bgs.clientinfo[clientNum].pXAnimTree;
@@ -763,6 +764,7 @@ void ClientSpawn( gentity_t *ent, const vec3_t spawn_origin, const vec3_t spawn_
 	savedSpawnCount = client->ps.stats[STAT_SPAWN_COUNT];
 
 	memset( client, 0, sizeof( *client ) );
+	HudElem_ResetClient( client - level.clients );
 	client->sess    = savedSess;
 
 	client->spectatorClient = -1;
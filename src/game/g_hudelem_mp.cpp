@@ -76,22 +76,191 @@ scr_method_t g_he_methods[] =
 	{"destroy", HECmd_Destroy, 0 }
 };
 
+/*
+=============================================================================
+
+Live hudelem index
+
+Bitsets of allocated elements split by who can see them, so a client only
+walks the elements that may be sent to it. Once a frame the live elements
+are compared against what was last synced, and only clients that can see
+a changed element (or whose team changed, or whose playerstate was
+overwritten elsewhere) get their hudelems rebuilt.
+
+=============================================================================
+*/
+
+#define HUDELEM_WORDS ( MAX_GENTITIES >> 5 )
+
+static unsigned int hudElemLive[HUDELEM_WORDS];
+static unsigned int hudElemSyncedLive[HUDELEM_WORDS];
+static unsigned int hudElemShared[HUDELEM_WORDS];
+static unsigned int hudElemTeam[TEAM_NUM_TEAMS][HUDELEM_WORDS];
+static unsigned int hudElemClient[MAX_CLIENTS][HUDELEM_WORDS];
+static game_hudelem_t hudElemSynced[MAX_GENTITIES];
+
+static qboolean hudElemChangedShared;
+static qboolean hudElemChangedTeam[TEAM_NUM_TEAMS];
+static qboolean hudElemChangedClient[MAX_CLIENTS];
+
+static qboolean hudElemClientSynced[MAX_CLIENTS];
+static int hudElemClientTeam[MAX_CLIENTS];
+
 /*
 ============
-HudElem_UpdateClient
+HudElem_IndexSet
 ============
 */
-void HudElem_UpdateClient( gclient_t *client, int clientNum, int which )
+static unsigned int *HudElem_IndexSet( const game_hudelem_t *hud )
+{
+	if ( hud->clientNum != ENTITYNUM_NONE )
+	{
+		if ( (unsigned)hud->clientNum < MAX_CLIENTS )
+		{
+			return hudElemClient[hud->clientNum];
+		}
+
+		return NULL; // never sent to anyone
+	}
+
+	if ( hud->team != TEAM_FREE )
+	{
+		if ( (unsigned)hud->team < TEAM_NUM_TEAMS )
+		{
+			return hudElemTeam[hud->team];
+		}
+
+		return NULL;
+	}
+
+	return hudElemShared;
+}
+
+/*
+============
+HudElem_MarkChanged
+============
+*/
+static void HudElem_MarkChanged( const game_hudelem_t *hud )
+{
+	if ( hud->elem.type == HE_TYPE_FREE )
+	{
+		return;
+	}
+
+	if ( hud->clientNum != ENTITYNUM_NONE )
+	{
+		if ( (unsigned)hud->clientNum < MAX_CLIENTS )
+		{
+			hudElemChangedClient[hud->clientNum] = qtrue;
+		}
+	}
+	else if ( hud->team != TEAM_FREE )
+	{
+		if ( (unsigned)hud->team < TEAM_NUM_TEAMS )
+		{
+			hudElemChangedTeam[hud->team] = qtrue;
+		}
+	}
+	else
+	{
+		hudElemChangedShared = qtrue;
+	}
+}
+
+/*
+============
+HudElem_SyncChanges
+
+Finds the elements that were allocated, freed or modified since the last
+call and moves retargeted ones to their new index set.
+============
+*/
+void HudElem_SyncChanges( void )
+{
+	game_hudelem_t *synced;
+	game_hudelem_t *hud;
+	unsigned int *set;
+	unsigned int bits;
+	int i, word;
+
+	hudElemChangedShared = qfalse;
+	memset(hudElemChangedTeam, 0, sizeof(hudElemChangedTeam));
+	memset(hudElemChangedClient, 0, sizeof(hudElemChangedClient));
+
+	for ( word = 0; word < HUDELEM_WORDS; word++ )
+	{
+		// elements freed since the last sync are only left in hudElemSyncedLive
+		bits = hudElemLive[word] | hudElemSyncedLive[word];
+
+		while ( bits )
+		{
+			i = ( word << 5 ) + __builtin_ctz(bits);
+			bits &= bits - 1;
+
+			hud = &g_hudelems[i];
+			synced = &hudElemSynced[i];
+
+			if ( !memcmp(hud, synced, sizeof(*hud)) )
+			{
+				continue;
+			}
+
+			HudElem_MarkChanged(synced);
+			HudElem_MarkChanged(hud);
+
+			if ( synced->elem.type != HE_TYPE_FREE && ( set = HudElem_IndexSet(synced) ) != NULL )
+			{
+				set[word] &= ~( 1u << ( i & 31 ) );
+			}
+
+			if ( hud->elem.type != HE_TYPE_FREE && ( set = HudElem_IndexSet(hud) ) != NULL )
+			{
+				set[word] |= 1u << ( i & 31 );
+			}
+
+			if ( hud->elem.type != HE_TYPE_FREE )
+			{
+				hudElemSyncedLive[word] |= 1u << ( i & 31 );
+			}
+			else
+			{
+				hudElemSyncedLive[word] &= ~( 1u << ( i & 31 ) );
+			}
+
+			*synced = *hud;
+		}
+	}
+}
+
+/*
+============
+HudElem_ResetClient
+
+The client's playerstate was cleared or replaced, so its hudelems have
+to be rebuilt on the next sync even if no element changed.
+============
+*/
+void HudElem_ResetClient( int clientNum )
 {
+	assert((unsigned)clientNum < MAX_CLIENTS);
+	hudElemClientSynced[clientNum] = qfalse;
+}
+
+/*
+============
+HudElem_BuildClient
+============
+*/
+static void HudElem_BuildClient( gclient_t *client, int clientNum, int which )
+{
+	unsigned int visible;
 	game_hudelem_t *hud;
 	hudelem_t *elem;
 	int currentCount;
 	int archivalCount;
-	int i;
-
-	assert(clientNum >= 0 && clientNum < level.maxclients);
-	assert(level.gentities[clientNum].r.inuse);
-	assert(client);
+	int team;
+	int i, word;
 
 	if ( which & HUDELEM_UPDATE_ARCHIVAL )
 	{
@@ -105,53 +274,118 @@ void HudElem_UpdateClient( gclient_t *client, int clientNum, int which )
 
 	archivalCount = 0;
 	currentCount = 0;
+	team = client->sess.state.team;
 
-	for ( i = 0, hud = g_hudelems; i < MAX_GENTITIES; i++, hud++ )
+	for ( word = 0; word < HUDELEM_WORDS; word++ )
 	{
-		if ( hud->elem.type == HE_TYPE_FREE )
-		{
-			continue;
-		}
+		visible = hudElemLive[word] & hudElemShared[word];
+		visible |= hudElemLive[word] & hudElemClient[clientNum][word];
 
-		if ( hud->team != TEAM_FREE && hud->team != client->sess.state.team )
+		if ( team != TEAM_FREE && (unsigned)team < TEAM_NUM_TEAMS )
 		{
-			continue;
+			visible |= hudElemLive[word] & hudElemTeam[team][word];
 		}
 
-		if ( hud->clientNum != ENTITYNUM_NONE && hud->clientNum != clientNum )
+		while ( visible )
 		{
-			continue;
-		}
+			i = ( word << 5 ) + __builtin_ctz(visible);
+			visible &= visible - 1;
 
-		if ( hud->archived )
-		{
-			if ( which & HUDELEM_UPDATE_ARCHIVAL )
+			hud = &g_hudelems[i];
+
+			if ( hud->elem.type == HE_TYPE_FREE )
 			{
-				elem = &client->ps.hud.archival[archivalCount];
-				archivalCount++;
+				continue;
+			}
 
-				if ( archivalCount <= MAX_HUDELEMS_ARCHIVAL )
+			if ( hud->team != TEAM_FREE && hud->team != team )
+			{
+				continue;
+			}
+
+			if ( hud->clientNum != ENTITYNUM_NONE && hud->clientNum != clientNum )
+			{
+				continue;
+			}
+
+			if ( hud->archived )
+			{
+				if ( which & HUDELEM_UPDATE_ARCHIVAL )
 				{
-					*elem = hud->elem;
+					elem = &client->ps.hud.archival[archivalCount];
+					archivalCount++;
+
+					if ( archivalCount <= MAX_HUDELEMS_ARCHIVAL )
+					{
+						*elem = hud->elem;
+					}
 				}
 			}
-		}
-		else
-		{
-			if ( which & HUDELEM_UPDATE_CURRENT )
+			else
 			{
-				elem = &client->ps.hud.current[currentCount];
-				currentCount++;
-
-				if ( currentCount <= MAX_HUDELEMS_CURRENT )
+				if ( which & HUDELEM_UPDATE_CURRENT )
 				{
-					*elem = hud->elem;
+					elem = &client->ps.hud.current[currentCount];
+					currentCount++;
+
+					if ( currentCount <= MAX_HUDELEMS_CURRENT )
+					{
+						*elem = hud->elem;
+					}
 				}
 			}
 		}
 	}
 }
 
+/*
+============
+HudElem_SyncClient
+
+Per-frame update, leaves the playerstate alone when nothing the client
+can see changed since its last rebuild. Call HudElem_SyncChanges first.
+============
+*/
+void HudElem_SyncClient( gclient_t *client, int clientNum )
+{
+	int team;
+
+	assert(clientNum >= 0 && clientNum < level.maxclients);
+	assert(level.gentities[clientNum].r.inuse);
+	assert(client);
+
+	team = client->sess.state.team;
+
+	if ( hudElemClientSynced[clientNum] && hudElemClientTeam[clientNum] == team
+	        && !hudElemChangedShared && !hudElemChangedClient[clientNum]
+	        && ( (unsigned)team >= TEAM_NUM_TEAMS || !hudElemChangedTeam[team] ) )
+	{
+		return;
+	}
+
+	HudElem_BuildClient(client, clientNum, HUDELEM_UPDATE_ARCHIVAL_AND_CURRENT);
+
+	hudElemClientSynced[clientNum] = qtrue;
+	hudElemClientTeam[clientNum] = team;
+}
+
+/*
+============
+HudElem_UpdateClient
+============
+*/
+void HudElem_UpdateClient( gclient_t *client, int clientNum, int which )
+{
+	assert(clientNum >= 0 && clientNum < level.maxclients);
+	assert(level.gentities[clientNum].r.inuse);
+	assert(client);
+
+	HudElem_BuildClient(client, clientNum, which);
+
+	// callers rebuild after replacing the playerstate, the rest of it is stale
+	hudElemClientSynced[clientNum] = qfalse;
+}
+
 /*
 ============
 HudElem_GetMethod
@@ -187,6 +421,8 @@ game_hudelem_t *HudElem_Alloc( int clientNum, int teamNum )
 			g_hudelems[i].clientNum = clientNum;
 			g_hudelems[i].team = teamNum;
 
+			hudElemLive[i >> 5] |= 1u << ( i & 31 );
+
 			return &g_hudelems[i];
 		}
 	}
@@ -264,6 +500,8 @@ void HudElem_Free( game_hudelem_t *hud )
 	assert(hud->elem.type > HE_TYPE_FREE && hud->elem.type < HE_TYPE_COUNT);
 	Scr_FreeHudElem(hud);
 	hud->elem.type = HE_TYPE_FREE;
+
+	hudElemLive[( hud - g_hudelems ) >> 5] &= ~( 1u << ( ( hud - g_hudelems ) & 31 ) );
 }
 
 /*
@@ -282,6 +520,14 @@ void HudElem_DestroyAll()
 	}
 
 	memset(g_hudelems, 0, sizeof(g_hudelems));
+
+	memset(hudElemLive, 0, sizeof(hudElemLive));
+	memset(hudElemSyncedLive, 0, sizeof(hudElemSyncedLive));
+	memset(hudElemShared, 0, sizeof(hudElemShared));
+	memset(hudElemTeam, 0, sizeof(hudElemTeam));
+	memset(hudElemClient, 0, sizeof(hudElemClient));
+	memset(hudElemSynced, 0, sizeof(hudElemSynced));
+	memset(hudElemClientSynced, 0, sizeof(hudElemClientSynced));
 }
 
 /*
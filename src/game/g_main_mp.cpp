@@ -218,6 +218,8 @@ void G_UpdateHudElemsToClients( void )
 	gentity_t *ent;
 	int clientNum;
 
+	HudElem_SyncChanges();
+
 	for ( clientNum = 0; clientNum < level.maxclients; clientNum++ )
 	{
 		ent = &level.gentities[clientNum];
@@ -228,7 +230,7 @@ void G_UpdateHudElemsToClients( void )
 		}
 
 		assert(ent->client);
-		HudElem_UpdateClient(ent->client, ent->s.number, HUDELEM_UPDATE_ARCHIVAL_AND_CURRENT);
+		HudElem_SyncClient(ent->client, ent->s.number);
 	}
 }
 
@@ -1304,6 +1304,9 @@ void HudElem_GetAlpha(game_hudelem_t *hud, int offset);
 void HudElem_ClearTypeSettings(game_hudelem_t *hud);
 void HudElem_SetDefaults(game_hudelem_t *hud);
 void HudElem_UpdateClient(gclient_s *client, int clientNum, int which);
+void HudElem_SyncChanges();
+void HudElem_SyncClient(gclient_s *client, int clientNum);
+void HudElem_ResetClient(int clientNum);
 void HudElem_DestroyAll();
 void HudElem_ClientDisconnect(gentity_t *ent);
 void HudElem_Free(game_hudelem_t *hud);
@@ -56,6 +56,13 @@ void G_AntiLagRewindClientPos(int gameTime, AntilagClientStore *antilagStore)
 				        && level.clients[clientNum].sess.sessionState == SESS_STATE_PLAYING
 				        && SV_GetClientPositionsAtTime(clientNum, gameTime, origin) )
 				{
+					// a player that hasn't moved since gameTime is already where
+					// the shot expects it, relinking it would only churn the sectors
+					if ( g_entities[clientNum].r.linked && VectorCompare(g_entities[clientNum].r.currentOrigin, origin) )
+					{
+						continue;
+					}
+
 					//snapshotTime = gameTime;
 					memcpy(antilagStore->realClientPositions[clientNum], g_entities[clientNum].r.currentOrigin, sizeof(antilagStore->realClientPositions[clientNum]));
 					SV_UnlinkEntity(&g_entities[clientNum]);
@@ -137,9 +137,15 @@ extern dvar_t *jump_bounceEnable;
 extern dvar_t *g_mantleBlockEnable;
 extern dvar_t *g_fixedWeaponSpreads;
 extern dvar_t *g_dropGrenadeOnDeath;
+extern dvar_t *sv_rateLimitSubnet;
+#if LIBCOD_COMPILE_SQLITE == 1
+extern dvar_t *sqlite_asyncWorkers;
+extern dvar_t *sqlite_walMode;
+#endif
 
 void RegisterLibcodDvars();
 int hook_findMap(const char *qpath, void **buffer);
+bool manymaps_getLibraryIwd(const char *mapname, char *path, int size);
 bool SV_IsBannedIp(netadr_t adr);
 void hook_ClientCommand(int clientNum);
 void InitLibcodCallbacks();
@@ -5,9 +5,6 @@
 #include "../qcommon/sys_thread.h"
 #include "sqlite/sqlite3.h"
 
-#define MAX_SQLITE_FIELDS 128
-#define MAX_SQLITE_ROWS 128
-#define MAX_SQLITE_ROW_LENGTH 256
 #define MAX_SQLITE_TASKS 512
 #define MAX_SQLITE_DB_STORES 64
 
@@ -22,22 +19,48 @@ enum
 	OBJECT_VALUE
 };
 
+enum
+{
+	CELL_NULL,
+	CELL_INT,
+	CELL_FLOAT,
+	CELL_TEXT
+};
+
+struct async_sqlite_cell
+{
+	int type;
+	union
+	{
+		int intValue;
+		float floatValue;
+		int textOffset;
+	};
+};
+
+// rows * columns cells; text values live in one growing buffer
+struct async_sqlite_result
+{
+	async_sqlite_cell *cells;
+	int numCells;
+	int maxCells;
+	char *text;
+	int textSize;
+	int maxText;
+	int rows;
+	int columns;
+};
+
 struct async_sqlite_task
 {
-	async_sqlite_task *prev;
 	async_sqlite_task *next;
 	sqlite3 *db;
-	sqlite3_stmt *statement;
 	char query[COD2_MAX_STRINGLENGTH];
-	char row[MAX_SQLITE_FIELDS][MAX_SQLITE_ROWS][MAX_SQLITE_ROW_LENGTH];
+	async_sqlite_result results;
 	int result;
-	int fields_size;
-	int rows_size;
 	int callback;
-	bool done;
 	bool save;
 	bool error;
-	bool remove;
 	char errorMessage[COD2_MAX_STRINGLENGTH];
 	bool hasargument;
 	int valueType;
@@ -48,6 +71,9 @@ struct async_sqlite_task
 	unsigned int objectValue;
 	bool hasentity;
 	gentity_t *gentity;
+	int queueTime;
+	int startTime;
+	int finishTime;
 };
 
 struct sqlite_db_store
@@ -55,12 +81,350 @@ struct sqlite_db_store
 	sqlite_db_store *prev;
 	sqlite_db_store *next;
 	sqlite3 *db;
+	char filename[COD2_MAX_STRINGLENGTH];
+};
+
+struct async_sqlite_connection
+{
+	sqlite3 *db;
+	sqlite3 *conn;
+};
+
+struct async_sqlite_worker
+{
+	async_sqlite_connection connections[MAX_SQLITE_DB_STORES];
+	int numConnections;
+	int epoch;
+};
+
+struct async_sqlite_stats
+{
+	int queries;
+	int errors;
+	int totalWait;
+	int maxWait;
+	int totalExec;
+	int maxExec;
+	int totalLatency;
+	int maxLatency;
 };
 
+// pending jobs, guarded by CRITSECT_SQLITE and counted by async_sqlite_jobs
 async_sqlite_task *first_async_sqlite_task = NULL;
+async_sqlite_task *last_async_sqlite_task = NULL;
+// finished jobs, pushed lock-free by the workers and drained by the game thread
+async_sqlite_task * volatile completed_async_sqlite_tasks = NULL;
+// finished jobs whose callbacks have not run yet, game thread only
+async_sqlite_task *delivered_async_sqlite_tasks = NULL;
 sqlite_db_store *first_sqlite_db_store = NULL;
 int async_sqlite_initialized = 0;
 
+static semaphore_t async_sqlite_jobs;
+static async_sqlite_worker async_sqlite_workers[MAX_SQLITE_WORKERS];
+static int async_sqlite_worker_count;
+static volatile int async_sqlite_running;
+static volatile int async_sqlite_epoch;
+static int async_sqlite_task_count;
+static async_sqlite_stats async_sqlite_query_stats;
+
+/*
+==================
+async_sqlite_close_connections
+
+Drops a worker's private connections once a database has been closed,
+they are reopened on demand
+==================
+*/
+static void async_sqlite_close_connections(async_sqlite_worker *worker)
+{
+	for (int i = 0; i < worker->numConnections; i++)
+		sqlite3_close(worker->connections[i].conn);
+
+	worker->numConnections = 0;
+	worker->epoch = async_sqlite_epoch;
+}
+
+/*
+==================
+async_sqlite_get_connection
+
+With a single worker every query runs on the handle returned by
+sqlite_open, as before. With more workers each one keeps its own
+connection per database file; in-memory and temporary databases cannot
+be shared that way and keep using the original handle. WAL mode lets
+readers run alongside a writer, but it changes the database file for
+every other program using it, so it is only switched on with
+sqlite_walMode.
+==================
+*/
+static sqlite3 *async_sqlite_get_connection(async_sqlite_worker *worker, sqlite3 *db)
+{
+	char filename[COD2_MAX_STRINGLENGTH];
+	sqlite3 *conn;
+
+	if (async_sqlite_worker_count < 2)
+		return db;
+
+	if (worker->epoch != async_sqlite_epoch)
+		async_sqlite_close_connections(worker);
+
+	for (int i = 0; i < worker->numConnections; i++)
+	{
+		if (worker->connections[i].db == db)
+			return worker->connections[i].conn;
+	}
+
+	if (worker->numConnections >= MAX_SQLITE_DB_STORES)
+		return db;
+
+	filename[0] = '\0';
+
+	Sys_EnterCriticalSection(CRITSECT_SQLITE);
+
+	for (sqlite_db_store *store = first_sqlite_db_store; store != NULL; store = store->next)
+	{
+		if (store->db == db)
+		{
+			strcpy(filename, store->filename);
+			break;
+		}
+	}
+
+	Sys_LeaveCriticalSection(CRITSECT_SQLITE);
+
+	if (!filename[0])
+		return db;
+
+	if (sqlite3_open_v2(filename, &conn, SQLITE_OPEN_READWRITE | SQLITE_OPEN_FULLMUTEX, NULL) != SQLITE_OK)
+	{
+		sqlite3_close(conn);
+		return db;
+	}
+
+	sqlite3_busy_timeout(conn, SQLITE_TIMEOUT);
+
+	if (sqlite_walMode->current.boolean)
+		sqlite3_exec(conn, "PRAGMA journal_mode=WAL;", NULL, NULL, NULL);
+
+	worker->connections[worker->numConnections].db = db;
+	worker->connections[worker->numConnections].conn = conn;
+	worker->numConnections++;
+
+	return conn;
+}
+
+/*
+==================
+async_sqlite_store_row
+
+Appends the statement's current row to the result, keeping integers and
+floats native. Returns false when out of memory.
+==================
+*/
+static bool async_sqlite_store_row(async_sqlite_result *results, sqlite3_stmt *statement)
+{
+	int columns = sqlite3_column_count(statement);
+
+	if (results->numCells + columns > results->maxCells)
+	{
+		int maxCells = results->maxCells ? results->maxCells * 2 : 16;
+
+		while (maxCells < results->numCells + columns)
+			maxCells *= 2;
+
+		async_sqlite_cell *cells = (async_sqlite_cell *)realloc(results->cells, maxCells * sizeof(async_sqlite_cell));
+
+		if (cells == NULL)
+			return false;
+
+		results->cells = cells;
+		results->maxCells = maxCells;
+	}
+
+	for (int i = 0; i < columns; i++)
+	{
+		async_sqlite_cell *cell = &results->cells[results->numCells + i];
+		int type = sqlite3_column_type(statement, i);
+
+		if (type == SQLITE_NULL)
+		{
+			cell->type = CELL_NULL;
+			continue;
+		}
+
+		if (type == SQLITE_INTEGER)
+		{
+			sqlite3_int64 value = sqlite3_column_int64(statement, i);
+
+			if (value >= INT_MIN && value <= INT_MAX)
+			{
+				cell->type = CELL_INT;
+				cell->intValue = (int)value;
+				continue;
+			}
+		}
+		else if (type == SQLITE_FLOAT)
+		{
+			cell->type = CELL_FLOAT;
+			cell->floatValue = (float)sqlite3_column_double(statement, i);
+			continue;
+		}
+
+		// text, blobs and integers wider than a script int
+		const unsigned char *text = sqlite3_column_text(statement, i);
+		int length = sqlite3_column_bytes(statement, i);
+
+		if (text == NULL)
+		{
+			cell->type = CELL_NULL;
+			continue;
+		}
+
+		if (results->textSize + length + 1 > results->maxText)
+		{
+			int maxText = results->maxText ? results->maxText * 2 : 256;
+
+			while (maxText < results->textSize + length + 1)
+				maxText *= 2;
+
+			char *buffer = (char *)realloc(results->text, maxText);
+
+			if (buffer == NULL)
+				return false;
+
+			results->text = buffer;
+			results->maxText = maxText;
+		}
+
+		cell->type = CELL_TEXT;
+		cell->textOffset = results->textSize;
+		memcpy(results->text + results->textSize, text, length);
+		results->text[results->textSize + length] = '\0';
+		results->textSize += length + 1;
+	}
+
+	results->numCells += columns;
+	results->columns = columns;
+	results->rows++;
+
+	return true;
+}
+
+/*
+==================
+async_sqlite_push_result
+
+Pushes the rows as an array of arrays; NULL columns are left out, as in
+sqlite_query
+==================
+*/
+static void async_sqlite_push_result(async_sqlite_result *results)
+{
+	async_sqlite_cell *cell = results->cells;
+
+	stackPushArray();
+
+	for (int i = 0; i < results->rows; i++)
+	{
+		stackPushArray();
+
+		for (int x = 0; x < results->columns; x++, cell++)
+		{
+			switch (cell->type)
+			{
+			case CELL_INT:
+				stackPushInt(cell->intValue);
+				break;
+
+			case CELL_FLOAT:
+				stackPushFloat(cell->floatValue);
+				break;
+
+			case CELL_TEXT:
+				stackPushString(results->text + cell->textOffset);
+				break;
+
+			default:
+				continue;
+			}
+
+			stackPushArrayLast();
+		}
+
+		stackPushArrayLast();
+	}
+}
+
+static void async_sqlite_delete_task(async_sqlite_task *task)
+{
+	free(task->results.cells);
+	free(task->results.text);
+
+	delete task;
+}
+
+/*
+==================
+async_sqlite_queue_task
+
+Appends a job to the pending queue and wakes one worker
+==================
+*/
+static void async_sqlite_queue_task(async_sqlite_task *task)
+{
+	task->next = NULL;
+	task->queueTime = Sys_Milliseconds();
+	memset(&task->results, 0, sizeof(task->results));
+
+	Sys_EnterCriticalSection(CRITSECT_SQLITE);
+
+	if (last_async_sqlite_task != NULL)
+		last_async_sqlite_task->next = task;
+	else
+		first_async_sqlite_task = task;
+
+	last_async_sqlite_task = task;
+
+	Sys_LeaveCriticalSection(CRITSECT_SQLITE);
+
+	async_sqlite_task_count++;
+	Sys_SemaphorePost(&async_sqlite_jobs);
+}
+
+/*
+==================
+async_sqlite_collect_completed
+
+Moves every job the workers finished onto the game thread's delivery
+list, keeping completion order
+==================
+*/
+static void async_sqlite_collect_completed()
+{
+	async_sqlite_task *task;
+	async_sqlite_task *ordered = NULL;
+
+	task = __sync_lock_test_and_set(&completed_async_sqlite_tasks, (async_sqlite_task *)NULL);
+
+	while (task != NULL)
+	{
+		async_sqlite_task *next = task->next;
+		task->next = ordered;
+		ordered = task;
+		task = next;
+	}
+
+	if (ordered == NULL)
+		return;
+
+	async_sqlite_task **tail = &delivered_async_sqlite_tasks;
+
+	while (*tail != NULL)
+		tail = &(*tail)->next;
+
+	*tail = ordered;
+}
+
 void free_sqlite_db_stores_and_tasks()
 {
 	Sys_EnterCriticalSection(CRITSECT_SQLITE);
@@ -72,23 +436,36 @@ void free_sqlite_db_stores_and_tasks()
 		async_sqlite_task *task = current;
 		current = current->next;
 
-		if (task->statement != NULL)
-		{
-			sqlite3_finalize(task->statement);
-			task->statement = NULL;
-		}
+		async_sqlite_delete_task(task);
+	}
 
-		if (task->next != NULL)
-			task->next->prev = task->prev;
+	first_async_sqlite_task = NULL;
+	last_async_sqlite_task = NULL;
 
-		if (task->prev != NULL)
-			task->prev->next = task->next;
-		else
-			first_async_sqlite_task = task->next;
+	Sys_LeaveCriticalSection(CRITSECT_SQLITE);
 
-		delete task;
+	// let queries already picked up by a worker finish before closing their databases
+	while (async_sqlite_running)
+		Sys_SleepMSec(1);
+
+	async_sqlite_collect_completed();
+
+	current = delivered_async_sqlite_tasks;
+
+	while (current != NULL)
+	{
+		async_sqlite_task *task = current;
+		current = current->next;
+
+		async_sqlite_delete_task(task);
 	}
 
+	delivered_async_sqlite_tasks = NULL;
+
+	async_sqlite_task_count = 0;
+
+	Sys_EnterCriticalSection(CRITSECT_SQLITE);
+
 	sqlite_db_store *current_store = first_sqlite_db_store;
 
 	while (current_store != NULL)
@@ -110,105 +487,166 @@ void free_sqlite_db_stores_and_tasks()
 		delete store;
 	}
 
+	__sync_fetch_and_add(&async_sqlite_epoch, 1);
+
 	Sys_LeaveCriticalSection(CRITSECT_SQLITE);
 }
 
-void *async_sqlite_query_handler(void*)
+static void async_sqlite_run_task(async_sqlite_task *task, sqlite3 *db)
 {
-	while(1)
+	sqlite3_stmt *statement = NULL;
+
+	task->result = sqlite3_prepare_v2(db, task->query, COD2_MAX_STRINGLENGTH, &statement, 0);
+
+	if (task->result != SQLITE_OK)
 	{
-		Sys_EnterCriticalSection(CRITSECT_SQLITE);
+		task->error = true;
+		strncpy(task->errorMessage, sqlite3_errmsg(db), COD2_MAX_STRINGLENGTH - 1);
+		task->errorMessage[COD2_MAX_STRINGLENGTH - 1] = '\0';
+	}
 
-		async_sqlite_task *current = first_async_sqlite_task;
+	if (!task->error)
+	{
+		task->result = sqlite3_step(statement);
 
-		while (current != NULL)
+		while (task->result != SQLITE_DONE)
 		{
-			async_sqlite_task *task = current;
-			current = current->next;
-
-			if (!task->done)
+			if (task->result == SQLITE_ROW)
 			{
-				task->result = sqlite3_prepare_v2(task->db, task->query, COD2_MAX_STRINGLENGTH, &task->statement, 0);
-
-				if (task->result != SQLITE_OK)
-				{
-					task->error = true;
-					strncpy(task->errorMessage, sqlite3_errmsg(task->db), COD2_MAX_STRINGLENGTH - 1);
-					task->errorMessage[COD2_MAX_STRINGLENGTH - 1] = '\0';
-				}
-
-				if (!task->error)
+				if (task->save && task->callback)
 				{
-					task->result = sqlite3_step(task->statement);
-					task->fields_size = 0;
-
-					while (task->result != SQLITE_DONE)
+					if (!async_sqlite_store_row(&task->results, statement))
 					{
-						if (task->result == SQLITE_ROW)
-						{
-							if (task->save && task->callback)
-							{
-								if (task->fields_size >= MAX_SQLITE_FIELDS)
-									break;
+						task->error = true;
+						strcpy(task->errorMessage, "out of memory");
+						break;
+					}
+				}
+			}
+			else
+			{
+				task->error = true;
+				strncpy(task->errorMessage, sqlite3_errmsg(db), COD2_MAX_STRINGLENGTH - 1);
+				task->errorMessage[COD2_MAX_STRINGLENGTH - 1] = '\0';
+				break;
+			}
 
-								task->rows_size = 0;
+			task->result = sqlite3_step(statement);
+		}
+	}
 
-								for (int i = 0; i < sqlite3_column_count(task->statement); i++)
-								{
-									if (task->rows_size >= MAX_SQLITE_ROWS)
-										break;
+	if (statement != NULL)
+		sqlite3_finalize(statement);
+}
 
-									const unsigned char *text = sqlite3_column_text(task->statement, i);
+void *async_sqlite_query_handler(void *arg)
+{
+	async_sqlite_worker *worker = (async_sqlite_worker *)arg;
 
-									if (text != NULL)
-									{
-										strncpy(task->row[task->fields_size][task->rows_size], reinterpret_cast<const char*>(text), MAX_SQLITE_ROW_LENGTH - 1);
-										task->row[task->fields_size][task->rows_size][MAX_SQLITE_ROW_LENGTH - 1] = '\0';
-									}
+	while(1)
+	{
+		Sys_SemaphoreWait(&async_sqlite_jobs);
 
-									task->rows_size++;
-								}
+		Sys_EnterCriticalSection(CRITSECT_SQLITE);
 
-								task->fields_size++;
-							}
-						}
-						else
-						{
-							task->error = true;
-							strncpy(task->errorMessage, sqlite3_errmsg(task->db), COD2_MAX_STRINGLENGTH - 1);
-							task->errorMessage[COD2_MAX_STRINGLENGTH - 1] = '\0';
-							break;
-						}
+		async_sqlite_task *task = first_async_sqlite_task;
 
-						task->result = sqlite3_step(task->statement);
-					}
+		if (task != NULL)
+		{
+			first_async_sqlite_task = task->next;
 
-					if (task->statement != NULL)
-					{
-						sqlite3_finalize(task->statement);
-						task->statement = NULL;
-					}
-				}
+			if (first_async_sqlite_task == NULL)
+				last_async_sqlite_task = NULL;
 
-				task->done = true;
-			}
+			__sync_fetch_and_add(&async_sqlite_running, 1);
 		}
 
 		Sys_LeaveCriticalSection(CRITSECT_SQLITE);
 
-		Sys_SleepMSec(50);
+		// the queue was flushed after this job was posted
+		if (task == NULL)
+			continue;
+
+		task->startTime = Sys_Milliseconds();
+		async_sqlite_run_task(task, async_sqlite_get_connection(worker, task->db));
+		task->finishTime = Sys_Milliseconds();
+
+		async_sqlite_task *head;
+
+		do
+		{
+			head = completed_async_sqlite_tasks;
+			task->next = head;
+		}
+		while (!__sync_bool_compare_and_swap(&completed_async_sqlite_tasks, head, task));
+
+		__sync_fetch_and_sub(&async_sqlite_running, 1);
 	}
 
 	return NULL;
 }
 
+static void async_sqlite_stats_f()
+{
+	async_sqlite_stats *stats = &async_sqlite_query_stats;
+	int queries = stats->queries ? stats->queries : 1;
+
+	Com_Printf("async sqlite: %i workers, %i queued or undelivered\n", async_sqlite_worker_count, async_sqlite_task_count);
+	Com_Printf("%i queries, %i errors\n", stats->queries, stats->errors);
+	Com_Printf("queue wait: avg %i ms, max %i ms\n", stats->totalWait / queries, stats->maxWait);
+	Com_Printf("execution: avg %i ms, max %i ms\n", stats->totalExec / queries, stats->maxExec);
+	Com_Printf("until callback: avg %i ms, max %i ms\n", stats->totalLatency / queries, stats->maxLatency);
+
+	if (Cmd_Argc() > 1 && !Q_stricmp(Cmd_Argv(1), "reset"))
+		memset(stats, 0, sizeof(*stats));
+}
+
+static void async_sqlite_record_stats(async_sqlite_task *task, int now)
+{
+	async_sqlite_stats *stats = &async_sqlite_query_stats;
+	int wait = task->startTime - task->queueTime;
+	int exec = task->finishTime - task->startTime;
+	int latency = now - task->queueTime;
+
+	stats->queries++;
+
+	if (task->error)
+		stats->errors++;
+
+	stats->totalWait += wait;
+	stats->totalExec += exec;
+	stats->totalLatency += latency;
+
+	if (wait > stats->maxWait)
+		stats->maxWait = wait;
+
+	if (exec > stats->maxExec)
+		stats->maxExec = exec;
+
+	if (latency > stats->maxLatency)
+		stats->maxLatency = latency;
+}
+
 void gsc_async_sqlite_initialize()
 {
 	threadid_t tinfo;
 
 	if (!async_sqlite_initialized)
 	{
-		Sys_CreateNewThread(async_sqlite_query_handler, &tinfo, NULL);
+		Sys_SemaphoreInit(&async_sqlite_jobs);
+
+		async_sqlite_worker_count = sqlite_asyncWorkers->current.integer;
+
+		for (int i = 0; i < async_sqlite_worker_count; i++)
+		{
+			if (!Sys_CreateNewThread(async_sqlite_query_handler, &tinfo, &async_sqlite_workers[i]))
+			{
+				async_sqlite_worker_count = i;
+				break;
+			}
+		}
+
+		Cmd_AddCommand("sqliteStats", async_sqlite_stats_f);
 		async_sqlite_initialized = 1;
 	}
 	else
@@ -236,28 +674,15 @@ void gsc_async_sqlite_create_query()
 		return;
 	}
 
-	async_sqlite_task *current = first_async_sqlite_task;
-
-	int task_count = 0;
-
-	while (current != NULL && current->next != NULL)
+	if (async_sqlite_task_count >= MAX_SQLITE_TASKS - 1)
 	{
-		if (task_count >= MAX_SQLITE_TASKS - 2)
-		{
-			stackError("gsc_async_sqlite_create_query() exceeded async task limit");
-			stackPushUndefined();
-			return;
-		}
-
-		current = current->next;
-		task_count++;
+		stackError("gsc_async_sqlite_create_query() exceeded async task limit");
+		stackPushUndefined();
+		return;
 	}
 
 	async_sqlite_task *newtask = new async_sqlite_task;
 
-	newtask->prev = current;
-	newtask->next = NULL;
-
 	newtask->db = (sqlite3 *)db;
 
 	strncpy(newtask->query, query, COD2_MAX_STRINGLENGTH - 1);
@@ -270,10 +695,8 @@ void gsc_async_sqlite_create_query()
 	else
 		newtask->callback = callback;
 
-	newtask->done = false;
 	newtask->save = true;
 	newtask->error = false;
-	newtask->remove = false;
 	newtask->hasargument = true;
 	newtask->hasentity = false;
 	newtask->gentity = NULL;
@@ -314,10 +737,7 @@ void gsc_async_sqlite_create_query()
 	else
 		newtask->hasargument = false;
 
-	if (current != NULL)
-		current->next = newtask;
-	else
-		first_async_sqlite_task = newtask;
+	async_sqlite_queue_task(newtask);
 
 	stackPushBool(qtrue);
 }
@@ -341,28 +761,15 @@ void gsc_async_sqlite_create_query_nosave()
 		return;
 	}
 
-	async_sqlite_task *current = first_async_sqlite_task;
-
-	int task_count = 0;
-
-	while (current != NULL && current->next != NULL)
+	if (async_sqlite_task_count >= MAX_SQLITE_TASKS - 1)
 	{
-		if (task_count >= MAX_SQLITE_TASKS - 2)
-		{
-			stackError("gsc_async_sqlite_create_query_nosave() exceeded async task limit");
-			stackPushUndefined();
-			return;
-		}
-
-		current = current->next;
-		task_count++;
+		stackError("gsc_async_sqlite_create_query_nosave() exceeded async task limit");
+		stackPushUndefined();
+		return;
 	}
 
 	async_sqlite_task *newtask = new async_sqlite_task;
 
-	newtask->prev = current;
-	newtask->next = NULL;
-
 	newtask->db = (sqlite3 *)db;
 
 	strncpy(newtask->query, query, COD2_MAX_STRINGLENGTH - 1);
@@ -375,10 +782,8 @@ void gsc_async_sqlite_create_query_nosave()
 	else
 		newtask->callback = callback;
 
-	newtask->done = false;
 	newtask->save = false;
 	newtask->error = false;
-	newtask->remove = false;
 	newtask->hasargument = true;
 	newtask->hasentity = false;
 	newtask->gentity = NULL;
@@ -419,10 +824,7 @@ void gsc_async_sqlite_create_query_nosave()
 	else
 		newtask->hasargument = false;
 
-	if (current != NULL)
-		current->next = newtask;
-	else
-		first_async_sqlite_task = newtask;
+	async_sqlite_queue_task(newtask);
 
 	stackPushBool(qtrue);
 }
@@ -446,28 +848,15 @@ void gsc_async_sqlite_create_entity_query(scr_entref_t entid)
 		return;
 	}
 
-	async_sqlite_task *current = first_async_sqlite_task;
-
-	int task_count = 0;
-
-	while (current != NULL && current->next != NULL)
+	if (async_sqlite_task_count >= MAX_SQLITE_TASKS - 1)
 	{
-		if (task_count >= MAX_SQLITE_TASKS - 2)
-		{
-			stackError("gsc_async_sqlite_create_entity_query() exceeded async task limit");
-			stackPushUndefined();
-			return;
-		}
-
-		current = current->next;
-		task_count++;
+		stackError("gsc_async_sqlite_create_entity_query() exceeded async task limit");
+		stackPushUndefined();
+		return;
 	}
 
 	async_sqlite_task *newtask = new async_sqlite_task;
 
-	newtask->prev = current;
-	newtask->next = NULL;
-
 	newtask->db = (sqlite3 *)db;
 
 	strncpy(newtask->query, query, COD2_MAX_STRINGLENGTH - 1);
@@ -480,10 +869,8 @@ void gsc_async_sqlite_create_entity_query(scr_entref_t entid)
 	else
 		newtask->callback = callback;
 
-	newtask->done = false;
 	newtask->save = true;
 	newtask->error = false;
-	newtask->remove = false;
 	newtask->hasargument = true;
 	newtask->hasentity = true;
 	newtask->gentity = &g_entities[entid.entnum];
@@ -524,10 +911,7 @@ void gsc_async_sqlite_create_entity_query(scr_entref_t entid)
 	else
 		newtask->hasargument = false;
 
-	if (current != NULL)
-		current->next = newtask;
-	else
-		first_async_sqlite_task = newtask;
+	async_sqlite_queue_task(newtask);
 
 	stackPushBool(qtrue);
 }
@@ -551,28 +935,15 @@ void gsc_async_sqlite_create_entity_query_nosave(scr_entref_t entid)
 		return;
 	}
 
-	async_sqlite_task *current = first_async_sqlite_task;
-
-	int task_count = 0;
-
-	while (current != NULL && current->next != NULL)
+	if (async_sqlite_task_count >= MAX_SQLITE_TASKS - 1)
 	{
-		if (task_count >= MAX_SQLITE_TASKS - 2)
-		{
-			stackError("gsc_async_sqlite_create_entity_query_nosave() exceeded async task limit");
-			stackPushUndefined();
-			return;
-		}
-
-		current = current->next;
-		task_count++;
+		stackError("gsc_async_sqlite_create_entity_query_nosave() exceeded async task limit");
+		stackPushUndefined();
+		return;
 	}
 
 	async_sqlite_task *newtask = new async_sqlite_task;
 
-	newtask->prev = current;
-	newtask->next = NULL;
-
 	newtask->db = (sqlite3 *)db;
 
 	strncpy(newtask->query, query, COD2_MAX_STRINGLENGTH - 1);
@@ -585,10 +956,8 @@ void gsc_async_sqlite_create_entity_query_nosave(scr_entref_t entid)
 	else
 		newtask->callback = callback;
 
-	newtask->done = false;
 	newtask->save = false;
 	newtask->error = false;
-	newtask->remove = false;
 	newtask->hasargument = true;
 	newtask->hasentity = true;
 	newtask->gentity = &g_entities[entid.entnum];
@@ -629,158 +998,118 @@ void gsc_async_sqlite_create_entity_query_nosave(scr_entref_t entid)
 	else
 		newtask->hasargument = false;
 
-	if (current != NULL)
-		current->next = newtask;
-	else
-		first_async_sqlite_task = newtask;
+	async_sqlite_queue_task(newtask);
 
 	stackPushBool(qtrue);
 }
 
 void gsc_async_sqlite_checkdone()
 {
-	async_sqlite_task *current = first_async_sqlite_task;
+	async_sqlite_collect_completed();
 
-	while (current != NULL)
+	int now = Sys_Milliseconds();
+
+	while (delivered_async_sqlite_tasks != NULL)
 	{
-		async_sqlite_task *task = current;
-		current = current->next;
+		async_sqlite_task *task = delivered_async_sqlite_tasks;
+		delivered_async_sqlite_tasks = task->next;
 
-		if (!task->remove)
+		async_sqlite_record_stats(task, now);
+
+		if (!task->error)
 		{
-			if (task->done)
+			if (task->save && task->callback)
 			{
-				if (!task->error)
+				if (task->hasentity)
 				{
-					if (task->save && task->callback)
+					if (task->gentity != NULL)
 					{
-						if (task->hasentity)
+						if (task->hasargument)
 						{
-							if (task->gentity != NULL)
+							switch(task->valueType)
 							{
-								if (task->hasargument)
-								{
-									switch(task->valueType)
-									{
-									case INT_VALUE:
-										stackPushInt(task->intValue);
-										break;
-
-									case FLOAT_VALUE:
-										stackPushFloat(task->floatValue);
-										break;
-
-									case STRING_VALUE:
-										stackPushString(task->stringValue);
-										break;
-
-									case VECTOR_VALUE:
-										stackPushVector(task->vectorValue);
-										break;
-
-									case OBJECT_VALUE:
-										stackPushObject(task->objectValue);
-										break;
-
-									default:
-										stackPushUndefined();
-										break;
-									}
-								}
-
-								stackPushArray();
-
-								for (int i = 0; i < task->fields_size; i++)
-								{
-									stackPushArray();
-
-									for (int x = 0; x < task->rows_size; x++)
-									{
-										if (task->row[i][x] != NULL)
-										{
-											stackPushString(task->row[i][x]);
-											stackPushArrayLast();
-										}
-									}
-
-									stackPushArrayLast();
-								}
-
-								short ret = Scr_ExecEntThread(task->gentity, task->callback, task->save + task->hasargument);
-								Scr_FreeThread(ret);
+							case INT_VALUE:
+								stackPushInt(task->intValue);
+								break;
+
+							case FLOAT_VALUE:
+								stackPushFloat(task->floatValue);
+								break;
+
+							case STRING_VALUE:
+								stackPushString(task->stringValue);
+								break;
+
+							case VECTOR_VALUE:
+								stackPushVector(task->vectorValue);
+								break;
+
+							case OBJECT_VALUE:
+								stackPushObject(task->objectValue);
+								break;
+
+							default:
+								stackPushUndefined();
+								break;
 							}
 						}
-						else
-						{
-							if (task->hasargument)
-							{
-								switch(task->valueType)
-								{
-								case INT_VALUE:
-									stackPushInt(task->intValue);
-									break;
-
-								case FLOAT_VALUE:
-									stackPushFloat(task->floatValue);
-									break;
-
-								case STRING_VALUE:
-									stackPushString(task->stringValue);
-									break;
-
-								case VECTOR_VALUE:
-									stackPushVector(task->vectorValue);
-									break;
-
-								default:
-									stackPushUndefined();
-									break;
-								}
-							}
 
-							stackPushArray();
+						async_sqlite_push_result(&task->results);
 
-							for (int i = 0; i < task->fields_size; i++)
-							{
-								stackPushArray();
+						short ret = Scr_ExecEntThread(task->gentity, task->callback, task->save + task->hasargument);
+						Scr_FreeThread(ret);
+					}
+				}
+				else
+				{
+					if (task->hasargument)
+					{
+						switch(task->valueType)
+						{
+						case INT_VALUE:
+							stackPushInt(task->intValue);
+							break;
+
+						case FLOAT_VALUE:
+							stackPushFloat(task->floatValue);
+							break;
 
-								for (int x = 0; x < task->rows_size; x++)
-								{
-									stackPushString(task->row[i][x]);
-									stackPushArrayLast();
-								}
+						case STRING_VALUE:
+							stackPushString(task->stringValue);
+							break;
 
-								stackPushArrayLast();
-							}
+						case VECTOR_VALUE:
+							stackPushVector(task->vectorValue);
+							break;
 
-							short ret = Scr_ExecThread(task->callback, task->save + task->hasargument);
-							Scr_FreeThread(ret);
+						default:
+							stackPushUndefined();
+							break;
 						}
 					}
-				}
-				else if (task->query[0] && task->errorMessage[0])
-					stackError("gsc_async_sqlite_checkdone() query error in '%s' - '%s'", task->query, task->errorMessage);
 
-				task->remove = true;
+					async_sqlite_push_result(&task->results);
+
+					short ret = Scr_ExecThread(task->callback, task->save + task->hasargument);
+					Scr_FreeThread(ret);
+				}
 			}
 		}
-		else
+		else if (task->query[0] && task->errorMessage[0])
 		{
-			if (Sys_TryEnterCriticalSection(CRITSECT_SQLITE) == 0)
-			{
-				if (task->next != NULL)
-					task->next->prev = task->prev;
+			char errorMessage[COD2_MAX_STRINGLENGTH];
 
-				if (task->prev != NULL)
-					task->prev->next = task->next;
-				else
-					first_async_sqlite_task = task->next;
+			Com_sprintf(errorMessage, sizeof(errorMessage), "gsc_async_sqlite_checkdone() query error in '%s' - '%s'", task->query, task->errorMessage);
 
-				delete task;
+			async_sqlite_task_count--;
+			async_sqlite_delete_task(task);
 
-				Sys_LeaveCriticalSection(CRITSECT_SQLITE);
-			}
+			stackError("%s", errorMessage);
+			continue;
 		}
+
+		async_sqlite_task_count--;
+		async_sqlite_delete_task(task);
 	}
 }
 
@@ -841,6 +1170,13 @@ void gsc_sqlite_open()
 
 	newstore->db = db;
 
+	const char *filename = sqlite3_db_filename(db, "main");
+
+	if (filename != NULL && strlen(filename) < sizeof(newstore->filename))
+		strcpy(newstore->filename, filename);
+	else
+		newstore->filename[0] = '\0';
+
 	if (current != NULL)
 		current->next = newstore;
 	else
@@ -952,6 +1288,8 @@ void gsc_sqlite_close()
 		}
 	}
 
+	__sync_fetch_and_add(&async_sqlite_epoch, 1);
+
 	stackPushBool(qtrue);
 
 	Sys_LeaveCriticalSection(CRITSECT_SQLITE);
@@ -991,17 +1329,7 @@ void gsc_sqlite_databases_count()
 
 void gsc_sqlite_tasks_count()
 {
-	async_sqlite_task *current = first_async_sqlite_task;
-
-	int task_count = 0;
-
-	while (current != NULL)
-	{
-		current = current->next;
-		task_count++;
-	}
-
-	stackPushInt(task_count);
+	stackPushInt(async_sqlite_task_count);
 }
 
 #endif
@@ -4,6 +4,8 @@
 /* gsc functions */
 #include "gsc.hpp"
 
+#define MAX_SQLITE_WORKERS 8
+
 void gsc_sqlite_open();
 void gsc_sqlite_query();
 void gsc_sqlite_close();
@@ -15,6 +15,11 @@ dvar_t *jump_bounceEnable;
 dvar_t *g_mantleBlockEnable;
 dvar_t *g_fixedWeaponSpreads;
 dvar_t *g_dropGrenadeOnDeath;
+dvar_t *sv_rateLimitSubnet;
+#if LIBCOD_COMPILE_SQLITE == 1
+dvar_t *sqlite_asyncWorkers;
+dvar_t *sqlite_walMode;
+#endif
 
 int codecallback_playercommand = 0;
 int codecallback_userinfochanged = 0;
@@ -45,6 +50,13 @@ void RegisterLibcodDvars()
 
 	g_fixedWeaponSpreads = Dvar_RegisterBool("g_fixedWeaponSpreads", false, DVAR_CHANGEABLE_RESET);
 	g_dropGrenadeOnDeath = Dvar_RegisterBool("g_dropGrenadeOnDeath", true, DVAR_CHANGEABLE_RESET);
+
+	sv_rateLimitSubnet = Dvar_RegisterInt("sv_rateLimitSubnet", 0, 0, 64, DVAR_ARCHIVE | DVAR_CHANGEABLE_RESET);
+
+#if LIBCOD_COMPILE_SQLITE == 1
+	sqlite_asyncWorkers = Dvar_RegisterInt("sqlite_asyncWorkers", 1, 1, MAX_SQLITE_WORKERS, DVAR_ARCHIVE | DVAR_CHANGEABLE_RESET);
+	sqlite_walMode = Dvar_RegisterBool("sqlite_walMode", false, DVAR_ARCHIVE | DVAR_CHANGEABLE_RESET);
+#endif
 }
 
 void InitLibcodCallbacks()
@@ -207,13 +219,28 @@ void manymaps_prepare(const char *mapname, int read)
 #define MAX_BUCKETS	16384
 #define MAX_HASHES 1024
 
+#define MAX_SUBNET_BUCKETS 4096
+
+// Buckets in use sit in a hash chain and in a list ordered by last use,
+// unused ones in a free list, so nothing ever scans the whole table
+typedef struct
+{
+	leakyBucket_t *buckets;
+	int numBuckets;
+	leakyBucket_t *hashes[ MAX_HASHES ];
+	leakyBucket_t *freeList;
+	leakyBucket_t *oldest;
+	leakyBucket_t *newest;
+} bucketTable_t;
+
 static leakyBucket_t buckets[ MAX_BUCKETS ];
-static leakyBucket_t* bucketHashes[ MAX_HASHES ];
+static leakyBucket_t subnetBuckets[ MAX_SUBNET_BUCKETS ];
+static bucketTable_t addressTable = { buckets, MAX_BUCKETS };
+static bucketTable_t subnetTable = { subnetBuckets, MAX_SUBNET_BUCKETS };
 leakyBucket_t outboundLeakyBucket;
 
-static long SVC_HashForAddress( netadr_t address )
+static long SVC_HashForAddress( const unsigned char *ip )
 {
-	unsigned char *ip = address.ip;
 	int	i;
 	long hash = 0;
 
@@ -228,74 +255,127 @@ static long SVC_HashForAddress( netadr_t address )
 	return hash;
 }
 
-static leakyBucket_t *SVC_BucketForAddress( netadr_t address, int burst, int period )
+static void SVC_UnlinkBucketUse( bucketTable_t *table, leakyBucket_t *bucket )
+{
+	if ( bucket->older != NULL )
+		bucket->older->newer = bucket->newer;
+	else
+		table->oldest = bucket->newer;
+
+	if ( bucket->newer != NULL )
+		bucket->newer->older = bucket->older;
+	else
+		table->newest = bucket->older;
+}
+
+static void SVC_LinkBucketUse( bucketTable_t *table, leakyBucket_t *bucket )
+{
+	bucket->older = table->newest;
+	bucket->newer = NULL;
+
+	if ( table->newest != NULL )
+		table->newest->newer = bucket;
+	else
+		table->oldest = bucket;
+
+	table->newest = bucket;
+}
+
+static void SVC_FreeBucket( bucketTable_t *table, leakyBucket_t *bucket )
+{
+	if ( bucket->prev != NULL )
+	{
+		bucket->prev->next = bucket->next;
+	}
+	else
+	{
+		table->hashes[ bucket->hash ] = bucket->next;
+	}
+
+	if ( bucket->next != NULL )
+	{
+		bucket->next->prev = bucket->prev;
+	}
+
+	SVC_UnlinkBucketUse( table, bucket );
+
+	memset( bucket, 0, sizeof( leakyBucket_t ) );
+
+	bucket->next = table->freeList;
+	table->freeList = bucket;
+}
+
+static leakyBucket_t *SVC_BucketForAddress( bucketTable_t *table, int type, const unsigned char *adr, int burst, int period )
 {
 	leakyBucket_t *bucket = NULL;
 	int	i;
-	long hash = SVC_HashForAddress( address );
+	long hash = SVC_HashForAddress( adr );
 	uint64_t now = Sys_Milliseconds64();
 
-	for ( bucket = bucketHashes[ hash ]; bucket; bucket = bucket->next )
+	for ( bucket = table->hashes[ hash ]; bucket; bucket = bucket->next )
 	{
-		if ( memcmp( bucket->adr, address.ip, 4 ) == 0 )
+		if ( memcmp( bucket->adr, adr, 4 ) == 0 )
 		{
+			SVC_UnlinkBucketUse( table, bucket );
+			SVC_LinkBucketUse( table, bucket );
+
 			return bucket;
 		}
 	}
 
-	for ( i = 0; i < MAX_BUCKETS; i++ )
+	if ( table->oldest == NULL && table->freeList == NULL )
 	{
-		int interval;
+		// first use, every bucket is free
+		for ( i = table->numBuckets - 1; i >= 0; i-- )
+		{
+			table->buckets[ i ].next = table->freeList;
+			table->freeList = &table->buckets[ i ];
+		}
+	}
 
-		bucket = &buckets[ i ];
-		interval = now - bucket->lastTime;
+	// Reclaim expired buckets, the least recently used ones expire first
+	while ( table->oldest != NULL )
+	{
+		int interval = now - table->oldest->lastTime;
 
-		// Reclaim expired buckets
-		if ( bucket->lastTime > 0 && ( interval > ( burst * period ) ||
-		                               interval < 0 ) )
+		if ( interval <= ( burst * period ) && interval >= 0 )
 		{
-			if ( bucket->prev != NULL )
-			{
-				bucket->prev->next = bucket->next;
-			}
-			else
-			{
-				bucketHashes[ bucket->hash ] = bucket->next;
-			}
+			break;
+		}
 
-			if ( bucket->next != NULL )
-			{
-				bucket->next->prev = bucket->prev;
-			}
+		SVC_FreeBucket( table, table->oldest );
+	}
 
-			memset( bucket, 0, sizeof( leakyBucket_t ) );
-		}
+	bucket = table->freeList;
 
-		if ( bucket->type == 0 )
-		{
-			bucket->type = address.type;
-			memcpy( bucket->adr, address.ip, 4 );
+	if ( bucket == NULL )
+	{
+		// Couldn't allocate a bucket for this address
+		return NULL;
+	}
 
-			bucket->lastTime = now;
-			bucket->burst = 0;
-			bucket->hash = hash;
+	table->freeList = bucket->next;
 
-			// Add to the head of the relevant hash chain
-			bucket->next = bucketHashes[ hash ];
-			if ( bucketHashes[ hash ] != NULL )
-			{
-				bucketHashes[ hash ]->prev = bucket;
-			}
+	bucket->type = type;
+	memcpy( bucket->adr, adr, 4 );
 
-			bucket->prev = NULL;
-			bucketHashes[ hash ] = bucket;
+	bucket->lastTime = now;
+	bucket->burst = 0;
+	bucket->hash = hash;
 
-			return bucket;
-		}
+	// Add to the head of the relevant hash chain
+	bucket->next = table->hashes[ hash ];
+	if ( table->hashes[ hash ] != NULL )
+	{
+		table->hashes[ hash ]->prev = bucket;
 	}
 
-	// Couldn't allocate a bucket for this address
-	return NULL;
+	bucket->prev = NULL;
+	table->hashes[ hash ] = bucket;
+
+	SVC_LinkBucketUse( table, bucket );
+
+	return bucket;
 }
 
 bool SVC_RateLimit( leakyBucket_t *bucket, int burst, int period )
@@ -334,11 +414,41 @@ bool SVC_RateLimitAddress( netadr_t from, int burst, int period )
 	if (Sys_IsLANAddress(from))
 		return false;
 
-	leakyBucket_t *bucket = SVC_BucketForAddress( from, burst, period );
+	// A flood from one /24 runs out of its shared bucket before it can
+	// take per-address buckets away from everybody else
+	if ( sv_rateLimitSubnet->current.integer && from.type == NA_IP )
+	{
+		unsigned char subnet[4] = { from.ip[0], from.ip[1], from.ip[2], 0 };
+		int subnetBurst = burst * sv_rateLimitSubnet->current.integer;
+
+		leakyBucket_t *subnetBucket = SVC_BucketForAddress( &subnetTable, from.type, subnet, subnetBurst, period );
+
+		if ( SVC_RateLimit( subnetBucket, subnetBurst, period ) )
+			return true;
+	}
+
+	leakyBucket_t *bucket = SVC_BucketForAddress( &addressTable, from.type, from.ip, burst, period );
 
 	return SVC_RateLimit( bucket, burst, period );
 }
 
+bool manymaps_getLibraryIwd(const char *mapname, char *path, int size)
+{
+	char library_path[MAX_OSPATH];
+
+	dvar_t *fs_homepath = Dvar_FindVar("fs_homepath");
+	dvar_t *fs_game = Dvar_FindVar("fs_game");
+
+	if (strlen(fs_library->current.string))
+		Q_strncpyz(library_path, fs_library->current.string, sizeof(library_path));
+	else
+		snprintf(library_path, sizeof(library_path), "%s/%s/Library", fs_homepath->current.string, fs_game->current.string);
+
+	Com_sprintf(path, size, "%s/%s.iwd", library_path, mapname);
+
+	return access(path, F_OK) != -1;
+}
+
 int hook_findMap(const char *qpath, void **buffer)
 {
 	int read = FS_ReadFile(qpath, buffer);
@@ -378,18 +488,244 @@ bool hook_SV_MapExists(const char *mapname)
 }
 
 #define IP_BAN_LIST_NAME "iplist.txt"
-bool SV_IsBannedIp(netadr_t adr)
+
+static banListFile_t banIpFile = { IP_BAN_LIST_NAME };
+
+// Exact entries, matched against NET_AdrToStringNoPort like before. Slots
+// hold an offset into banIpStrings plus one, 0 marks an empty slot
+static char *banIpStrings;
+static int banIpStringsSize;
+static int banIpStringsAlloc;
+static int *banIpSlots;
+static int banIpCount;
+static int banIpMask;
+
+// "a.b.c.d/n" entries also ban the whole range, one trie level per bit
+typedef struct
 {
+	int child[2];
 	bool banned;
+} banIpNode_t;
+
+static banIpNode_t *banIpNodes;
+static int banIpNodeCount;
+static int banIpNodeAlloc;
+
+static unsigned int SV_HashBannedIp( const char *ip )
+{
+	unsigned int hash = 2166136261u;
+
+	while ( *ip )
+		hash = (hash ^ (unsigned char)*ip++) * 16777619u;
+
+	return hash;
+}
+
+static bool SV_FindBannedIpSlot( const char *ip, int *slot )
+{
+	int offset;
+
+	for ( *slot = SV_HashBannedIp(ip) & banIpMask; banIpSlots[*slot]; *slot = (*slot + 1) & banIpMask )
+	{
+		offset = banIpSlots[*slot] - 1;
+
+		if ( strcmp(&banIpStrings[offset], ip) == 0 )
+			return true;
+	}
+
+	return false;
+}
+
+static void SV_AddBannedIp( const char *ip )
+{
+	int *oldSlots;
+	int oldMask;
+	int slot;
+	int len;
+	int i;
+	char *oldStrings;
+
+	if ( (banIpCount + 1) * 2 > banIpMask + 1 )
+	{
+		oldSlots = banIpSlots;
+		oldMask = banIpMask;
+
+		banIpMask = banIpMask ? banIpMask * 2 + 1 : 1023;
+		banIpSlots = (int *)Z_Malloc(sizeof(int) * (banIpMask + 1));
+
+		if ( oldSlots )
+		{
+			for ( i = 0; i <= oldMask; i++ )
+			{
+				if ( !oldSlots[i] )
+					continue;
+
+				SV_FindBannedIpSlot(&banIpStrings[oldSlots[i] - 1], &slot);
+				banIpSlots[slot] = oldSlots[i];
+			}
+
+			Z_Free(oldSlots);
+		}
+	}
+
+	if ( SV_FindBannedIpSlot(ip, &slot) )
+		return;
+
+	len = strlen(ip) + 1;
+
+	if ( banIpStringsSize + len > banIpStringsAlloc )
+	{
+		oldStrings = banIpStrings;
+
+		banIpStringsAlloc = banIpStringsAlloc ? banIpStringsAlloc * 2 : 16384;
+		while ( banIpStringsSize + len > banIpStringsAlloc )
+			banIpStringsAlloc *= 2;
+		banIpStrings = (char *)Z_Malloc(banIpStringsAlloc);
+
+		if ( oldStrings )
+		{
+			memcpy(banIpStrings, oldStrings, banIpStringsSize);
+			Z_Free(oldStrings);
+		}
+	}
+
+	memcpy(&banIpStrings[banIpStringsSize], ip, len);
+	banIpSlots[slot] = banIpStringsSize + 1;
+	banIpStringsSize += len;
+	banIpCount++;
+}
+
+static int SV_AllocBannedIpNode()
+{
+	banIpNode_t *oldNodes;
+
+	if ( banIpNodeCount == banIpNodeAlloc )
+	{
+		oldNodes = banIpNodes;
+
+		banIpNodeAlloc = banIpNodeAlloc ? banIpNodeAlloc * 2 : 1024;
+		banIpNodes = (banIpNode_t *)Z_Malloc(sizeof(banIpNode_t) * banIpNodeAlloc);
+
+		if ( oldNodes )
+		{
+			memcpy(banIpNodes, oldNodes, sizeof(banIpNode_t) * banIpNodeCount);
+			Z_Free(oldNodes);
+		}
+	}
+
+	memset(&banIpNodes[banIpNodeCount], 0, sizeof(banIpNode_t));
+	return banIpNodeCount++;
+}
+
+static void SV_AddBannedIpRange( const unsigned char *ip, int bits )
+{
+	int node;
+	int next;
+	int bit;
+	int i;
+
+	// node 0 is the root, so a child index of 0 means no child
+	if ( !banIpNodeCount )
+		SV_AllocBannedIpNode();
+
+	node = 0;
+
+	for ( i = 0; i < bits; i++ )
+	{
+		if ( banIpNodes[node].banned )
+			return; // already covered by a shorter prefix
+
+		bit = (ip[i >> 3] >> (7 - (i & 7))) & 1;
+		next = banIpNodes[node].child[bit];
+
+		if ( !next )
+		{
+			next = SV_AllocBannedIpNode();
+			banIpNodes[node].child[bit] = next;
+		}
+
+		node = next;
+	}
+
+	banIpNodes[node].banned = true;
+}
+
+static bool SV_IsBannedIpRange( const unsigned char *ip )
+{
+	int node;
+	int i;
+
+	if ( !banIpNodeCount )
+		return false;
+
+	node = 0;
+
+	for ( i = 0; i < 32; i++ )
+	{
+		if ( banIpNodes[node].banned )
+			return true;
+
+		node = banIpNodes[node].child[(ip[i >> 3] >> (7 - (i & 7))) & 1];
+
+		if ( !node )
+			return false;
+	}
+
+	return banIpNodes[node].banned;
+}
+
+static void SV_ParseBannedIpRange( const char *token, const char *text )
+{
+	unsigned int a, b, c, d;
+	unsigned char ip[4];
+	int bits;
+	char end;
+
+	// the number parser stops at the slash, leaving the prefix length behind
+	if ( text[0] != '/' || !isdigit(text[1]) )
+		return;
+
+	bits = atoi(text + 1);
+
+	if ( bits > 32 )
+		return;
+
+	if ( sscanf(token, "%u.%u.%u.%u%c", &a, &b, &c, &d, &end) != 4 || a > 255 || b > 255 || c > 255 || d > 255 )
+		return;
+
+	ip[0] = a;
+	ip[1] = b;
+	ip[2] = c;
+	ip[3] = d;
+
+	SV_AddBannedIpRange(ip, bits);
+}
+
+static void SV_UpdateBannedIps()
+{
 	char *file;
 	const char *token;
 	const char *text;
 
-	if ( FS_ReadFile(IP_BAN_LIST_NAME, (void **)&file) < 0 )
-		return false;
+	switch ( SV_ReadBanListFile(&banIpFile, &file, &text) )
+	{
+	case BANLIST_UNCHANGED:
+		return;
+
+	case BANLIST_RELOADED:
+		if ( banIpSlots )
+			memset(banIpSlots, 0, sizeof(int) * (banIpMask + 1));
+		banIpCount = 0;
+		banIpStringsSize = 0;
+		banIpNodeCount = 0;
+		break;
+
+	case BANLIST_APPENDED:
+		break;
+	}
 
-	text = file;
-	banned = false;
+	if ( !file )
+		return;
 
 	while ( 1 )
 	{
@@ -398,18 +734,28 @@ bool SV_IsBannedIp(netadr_t adr)
 		if ( !token[0] )
 			break;
 
-		if ( strcmp(token, NET_AdrToStringNoPort(adr)) == 0 )
-		{
-			banned = true;
-			break;
-		}
+		SV_AddBannedIp(token);
+		SV_ParseBannedIpRange(token, text);
 
 		Com_SkipRestOfLine(&text);
 	}
 
 	FS_FreeFile(file);
+}
+
+bool SV_IsBannedIp(netadr_t adr)
+{
+	int slot;
+
+	SV_UpdateBannedIps();
+
+	if ( adr.type == NA_IP && SV_IsBannedIpRange(adr.ip) )
+		return true;
+
+	if ( !banIpCount )
+		return false;
 
-	return banned;
+	return SV_FindBannedIpSlot(NET_AdrToStringNoPort(adr), &slot);
 }
 
 int clientfps[MAX_CLIENTS] = {0};
@@ -735,6 +1081,7 @@ void SV_CheckTimeouts_libcod( void )
 		if (cl->state == CS_ZOMBIE && cl->lastPacketTime < zombiepoint)
 		{
 			cl->state = CS_FREE; // can now be reused
+			SV_UnlinkClientAddress(cl);
 			continue;
 		}
 
@@ -746,6 +1093,7 @@ void SV_CheckTimeouts_libcod( void )
 			{
 				SV_DropClient(cl, "EXE_TIMEDOUT");
 				cl->state = CS_FREE; // don't bother with zombie state
+				SV_UnlinkClientAddress(cl);
 			}
 		}
 		else
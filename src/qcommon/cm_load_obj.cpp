@@ -1,5 +1,6 @@
 #include "qcommon.h"
 #include "cm_local.h"
+#include "sys_thread.h"
 
 struct dbrush_t
 {
@@ -383,16 +384,83 @@ static int CMod_GetLeafTerrainContents(cLeaf_s *leaf)
 	return contents;
 }
 
+/*
+=================
+PARALLEL LEAF BRUSH PARTITIONING
+
+With sv_mapLoadThreads > 1 every leaf and submodel is queued while the lumps
+are walked, partitioned on the worker pool into a private node block, and
+the blocks are then appended to temp memory in the original order. Child
+offsets are relative to their parent and each leaf owns a disjoint slice of
+cm.leafbrushes, so the final node array is identical to the serial build.
+=================
+*/
+#define MAX_PARALLEL_LEAF_BRUSHES 512 // deeper recursion stays on the main thread stack
+
+typedef struct
+{
+	cLeafBrushNode_s *nodes;
+	int numNodes;
+	int maxNodes;
+} leafBrushNodePool_t;
+
+typedef struct
+{
+	uint16_t *leafBrushes;
+	int numLeafBrushes;
+	cLeaf_s *leaf;
+	vec3_t mins;
+	vec3_t maxs;
+	leafBrushNodePool_t pool;
+} leafBrushPartition_t;
+
+static int cmLoadThreads;
+static leafBrushPartition_t *cmPartitions;
+static int cmNumPartitions;
+
+/*
+=================
+CM_SetLoadThreads
+=================
+*/
+void CM_SetLoadThreads( int numThreads )
+{
+	cmLoadThreads = numThreads;
+}
+
+/*
+=================
+CMod_PrintLoadTime
+=================
+*/
+static void CMod_PrintLoadTime( const char *stage, int *time )
+{
+	int now;
+
+	now = Sys_Milliseconds();
+	Com_DPrintf("CM_LoadMapFromBsp: %s took %i msec\n", stage, now - *time);
+	*time = now;
+}
+
 /*
 =================
 CMod_AllocLeafBrushNode
 =================
 */
-static cLeafBrushNode_s *CMod_AllocLeafBrushNode()
+static cLeafBrushNode_s *CMod_AllocLeafBrushNode( leafBrushNodePool_t *pool )
 {
 	cLeafBrushNode_s *node;
 
-	node = (cLeafBrushNode_s *)TempMalloc(sizeof(cLeafBrushNode_s));
+	if ( pool )
+	{
+		assert(pool->numNodes < pool->maxNodes);
+		node = &pool->nodes[pool->numNodes++];
+	}
+	else
+	{
+		node = (cLeafBrushNode_s *)TempMalloc(sizeof(cLeafBrushNode_s));
+	}
+
 	Com_Memset(node, 0, sizeof(cLeafBrushNode_s));
 	node->data.children.dist = -FLT_MAX;
 
@@ -461,10 +529,12 @@ static float CMod_GetPartitionScore(uint16_t *leafBrushes, int numLeafBrushes, i
 
 /*
 =================
-CMod_PartionLeafBrushes_r
+CMod_PartionLeafBrushesPool_r
+
+Nodes come from pool when given, otherwise from temp memory
 =================
 */
-cLeafBrushNode_s* CMod_PartionLeafBrushes_r(uint16_t *leafBrushes, int numLeafBrushes, const vec3_t mins, const vec3_t maxs)
+static cLeafBrushNode_s* CMod_PartionLeafBrushesPool_r(leafBrushNodePool_t *pool, uint16_t *leafBrushes, int numLeafBrushes, const vec3_t mins, const vec3_t maxs)
 {
 	int nodeOffset;
 	cLeafBrushNode_s *node;
@@ -489,7 +559,7 @@ cLeafBrushNode_s* CMod_PartionLeafBrushes_r(uint16_t *leafBrushes, int numLeafBr
 
 	assert(numLeafBrushes);
 
-	node = CMod_AllocLeafBrushNode();
+	node = CMod_AllocLeafBrushNode(pool);
 
 	bestScore = 0.0;
 	axis = -1;
@@ -530,7 +600,12 @@ cLeafBrushNode_s* CMod_PartionLeafBrushes_r(uint16_t *leafBrushes, int numLeafBr
 	if ( axis >= 0 )
 	{
 		len = sizeof(*leafBrushes) * numLeafBrushes;
-		leafBrushesCopy = (uint16_t *)CM_Hunk_AllocateTempMemoryHigh(sizeof(*leafBrushes) * numLeafBrushes);
+
+		if ( pool )
+			leafBrushesCopy = (uint16_t *)Z_MallocGarbage(len);
+		else
+			leafBrushesCopy = (uint16_t *)CM_Hunk_AllocateTempMemoryHigh(len);
+
 		Com_Memcpy(leafBrushesCopy, leafBrushes, len);
 		numLeafBrushesChild = 0;
 
@@ -548,7 +623,7 @@ cLeafBrushNode_s* CMod_PartionLeafBrushes_r(uint16_t *leafBrushes, int numLeafBr
 
 		if ( numLeafBrushesChild )
 		{
-			returnNode = CMod_PartionLeafBrushes_r(leafBrushes, numLeafBrushesChild, mins, maxs);
+			returnNode = CMod_PartionLeafBrushesPool_r(pool, leafBrushes, numLeafBrushesChild, mins, maxs);
 			assert(returnNode == node + 1);
 			node->leafBrushCount = -1;
 			node->contents = returnNode->contents;
@@ -564,6 +639,9 @@ cLeafBrushNode_s* CMod_PartionLeafBrushes_r(uint16_t *leafBrushes, int numLeafBr
 nextside:
 		if ( side > 1 )
 		{
+			if ( pool )
+				Z_Free(leafBrushesCopy);
+
 			node->data.children.range = range;
 			return node;
 		}
@@ -588,7 +666,7 @@ nextside:
 					childMins[axis] = dist + range;
 				}
 
-				childNode = CMod_PartionLeafBrushes_r(leafBrushes, numLeafBrushesChild, childMins, childMaxs);
+				childNode = CMod_PartionLeafBrushesPool_r(pool, leafBrushes, numLeafBrushesChild, childMins, childMaxs);
 				nodeOffset = childNode - node;
 				node->data.children.childOffset[side] = nodeOffset;
 
@@ -651,6 +729,175 @@ nextside:
 	return node;
 }
 
+/*
+=================
+CMod_PartionLeafBrushes_r
+=================
+*/
+cLeafBrushNode_s* CMod_PartionLeafBrushes_r(uint16_t *leafBrushes, int numLeafBrushes, const vec3_t mins, const vec3_t maxs)
+{
+	return CMod_PartionLeafBrushesPool_r(NULL, leafBrushes, numLeafBrushes, mins, maxs);
+}
+
+/*
+=================
+CMod_PartionLeafBrushesJob
+=================
+*/
+static void CMod_PartionLeafBrushesJob( void *data, int index )
+{
+	leafBrushPartition_t *part;
+
+	part = &((leafBrushPartition_t *)data)[index];
+
+	if ( part->numLeafBrushes > MAX_PARALLEL_LEAF_BRUSHES && !Sys_IsMainThread() )
+	{
+		return;
+	}
+
+	CMod_PartionLeafBrushesPool_r(&part->pool, part->leafBrushes, part->numLeafBrushes, part->mins, part->maxs);
+}
+
+/*
+=================
+CMod_CanPartitionInParallel
+
+The in-place reordering of one leaf must never touch the brushes of
+another, so overlapping leaf ranges or flat brushes, which can land on
+both sides of a split, keep the serial build
+=================
+*/
+static bool CMod_CanPartitionInParallel()
+{
+	int i;
+	int j;
+	int k;
+	byte *used;
+	DiskLeafCollision *in;
+	int count;
+	int first;
+	int num;
+	bool ok;
+
+	for ( i = 0; i < cm.numBrushes; i++ )
+	{
+		for ( j = 0; j < 3; j++ )
+		{
+			if ( cm.brushes[i].mins[j] >= cm.brushes[i].maxs[j] )
+				return false;
+		}
+	}
+
+	in = (DiskLeafCollision*)Com_GetBspLump(LUMP_LEAFS, sizeof(DiskLeafCollision), &count);
+	used = (byte *)Z_Malloc(cm.numLeafBrushes + 1);
+	ok = true;
+
+	for ( i = 0; i < count && ok; i++, in++ )
+	{
+		first = LittleLong(in->firstLeafBrush);
+		num = LittleLong(in->numLeafBrushes);
+
+		if ( first < 0 || num < 0 || first + num > cm.numLeafBrushes )
+		{
+			ok = false;
+			break;
+		}
+
+		for ( k = first; k < first + num; k++ )
+		{
+			if ( used[k] )
+			{
+				ok = false;
+				break;
+			}
+
+			used[k] = 1;
+		}
+	}
+
+	Z_Free(used);
+	return ok;
+}
+
+/*
+=================
+CMod_BeginParallelPartition
+=================
+*/
+static int CMod_BeginParallelPartition()
+{
+	int numThreads;
+
+	numThreads = cmLoadThreads;
+
+	if ( numThreads < 2 )
+		return 0;
+
+	if ( !Sys_InitWorkerThreads(numThreads - 1) || !CMod_CanPartitionInParallel() )
+		return 0;
+
+	cmPartitions = (leafBrushPartition_t *)Z_Malloc(sizeof(*cmPartitions) * (cm.numLeafs + cm.numSubModels));
+	cmNumPartitions = 0;
+
+	return numThreads;
+}
+
+/*
+=================
+CMod_FinishParallelPartition
+=================
+*/
+static void CMod_FinishParallelPartition( int numThreads )
+{
+	int i;
+	int totalNodes;
+	cLeafBrushNode_s *nodes;
+	cLeafBrushNode_s *out;
+	leafBrushPartition_t *part;
+
+	totalNodes = 0;
+
+	for ( i = 0; i < cmNumPartitions; i++ )
+	{
+		// every split sends each brush to exactly one child, so a leaf with n brushes needs at most 2n - 1 nodes
+		totalNodes += 2 * cmPartitions[i].numLeafBrushes - 1;
+	}
+
+	nodes = (cLeafBrushNode_s *)Z_MallocGarbage(sizeof(*nodes) * (totalNodes + 1));
+	totalNodes = 0;
+
+	for ( i = 0; i < cmNumPartitions; i++ )
+	{
+		part = &cmPartitions[i];
+		part->pool.nodes = &nodes[totalNodes];
+		part->pool.numNodes = 0;
+		part->pool.maxNodes = 2 * part->numLeafBrushes - 1;
+		totalNodes += part->pool.maxNodes;
+	}
+
+	Sys_RunWorkerJobs(CMod_PartionLeafBrushesJob, cmPartitions, cmNumPartitions, numThreads);
+
+	for ( i = 0; i < cmNumPartitions; i++ )
+	{
+		part = &cmPartitions[i];
+
+		if ( !part->pool.numNodes )
+		{
+			CMod_PartionLeafBrushesJob(cmPartitions, i);
+		}
+
+		out = (cLeafBrushNode_s *)TempMalloc(sizeof(*out) * part->pool.numNodes);
+		Com_Memcpy(out, part->pool.nodes, sizeof(*out) * part->pool.numNodes);
+		part->leaf->leafBrushNode = out - cm.leafbrushNodes;
+	}
+
+	Z_Free(nodes);
+	Z_Free(cmPartitions);
+
+	cmPartitions = NULL;
+	cmNumPartitions = 0;
+}
+
 /*
 =================
 CMod_PartionLeafBrushes
@@ -664,6 +911,7 @@ static void CMod_PartionLeafBrushes(uint16_t *leafBrushes, int numLeafBrushes, c
 	cbrush_t *b;
 	vec3_t maxs;
 	int brushnum;
+	leafBrushPartition_t *part;
 
 	if ( !numLeafBrushes )
 	{
@@ -701,6 +949,17 @@ static void CMod_PartionLeafBrushes(uint16_t *leafBrushes, int numLeafBrushes, c
 		leaf->maxs[j] = leaf->maxs[j] + SURFACE_CLIP_EPSILON;
 	}
 
+	if ( cmPartitions )
+	{
+		part = &cmPartitions[cmNumPartitions++];
+		part->leafBrushes = leafBrushes;
+		part->numLeafBrushes = numLeafBrushes;
+		part->leaf = leaf;
+		VectorCopy(mins, part->mins);
+		VectorCopy(maxs, part->maxs);
+		return;
+	}
+
 	CM_Hunk_CheckTempMemoryHighClear();
 	leaf->leafBrushNode = CMod_PartionLeafBrushes_r(leafBrushes, numLeafBrushes, mins, maxs) - cm.leafbrushNodes;
 	CM_Hunk_ClearTempMemoryHigh();
@@ -829,7 +1088,7 @@ static void CM_InitBoxHull( void )
 	cm.box_brush->axialMaterialNum[1][1] = -1;
 	cm.box_brush->axialMaterialNum[1][2] = -1;
 
-	node = CMod_AllocLeafBrushNode();
+	node = CMod_AllocLeafBrushNode(NULL);
 	cm.box_model.leaf.leafBrushNode = node - cm.leafbrushNodes;
 
 	node->leafBrushCount = 1;
@@ -847,20 +1106,37 @@ static void CMod_LoadBrushRelated(bool usePvs)
 {
 	int leafbrushNodesCount;
 	cLeafBrushNode_s *leafbrushNodes;
+	int numThreads;
+	int time;
+
+	time = Sys_Milliseconds();
 
 	CMod_LoadBrushes();
 	CMod_LoadLeafBrushes();
 	CMod_LoadCollisionAabbTrees();
 	CMod_LoadLeafs(usePvs);
 	CMod_LoadSubmodels();
+	CMod_PrintLoadTime("brushes and leafs", &time);
 
 	TempMemoryReset();
 
 	cm.leafbrushNodes = ((cLeafBrushNode_s*)TempMalloc(0) - 1);
 
+	numThreads = CMod_BeginParallelPartition();
+
 	CMod_LoadLeafBrushNodes();
 	CMod_LoadSubmodelBrushNodes();
 
+	if ( numThreads )
+	{
+		CMod_FinishParallelPartition(numThreads);
+		CMod_PrintLoadTime(va("leaf brush nodes (%i threads)", numThreads), &time);
+	}
+	else
+	{
+		CMod_PrintLoadTime("leaf brush nodes", &time);
+	}
+
 	CM_InitBoxHull();
 
 	cm.leafbrushNodes++;
@@ -1294,6 +1570,10 @@ CM_LoadMapFromBsp
 void CM_LoadMapFromBsp(const char *name, bool usePvs)
 {
 	dheader_t *header;
+	int start;
+	int time;
+
+	start = Sys_Milliseconds();
 
 	// free old stuff
 	Com_Memset( &cm, 0, sizeof( cm ) );
@@ -1304,17 +1584,23 @@ void CM_LoadMapFromBsp(const char *name, bool usePvs)
 	header = Com_GetBsp(0, &cm.checksum);
 	cm.header = header;
 
+	time = Sys_Milliseconds();
+
 	// load into heap
 	CMod_LoadMaterials();
 	CMod_LoadPlanes();
+	CMod_PrintLoadTime("materials and planes", &time);
 	CMod_LoadBrushRelated(usePvs);
+	time = Sys_Milliseconds();
 	CMod_LoadNodes();
 	CMod_LoadLeafSurfaces();
+	CMod_PrintLoadTime("nodes and leaf surfaces", &time);
 	CMod_LoadCollisionVerts();
 	CMod_LoadCollisionEdges();
 	CMod_LoadCollisionTriangles();
 	CMod_LoadCollisionBorders();
 	CMod_LoadCollisionPartitions();
+	CMod_PrintLoadTime("collision geometry", &time);
 
 	if ( usePvs )
 	{
@@ -1326,6 +1612,9 @@ void CM_LoadMapFromBsp(const char *name, bool usePvs)
 	}
 
 	CMod_LoadEntityString();
+	CMod_PrintLoadTime("visibility and entities", &time);
 
 	cm.header = NULL;
+
+	Com_DPrintf("CM_LoadMapFromBsp: %s loaded in %i msec\n", name, Sys_Milliseconds() - start);
 }
\ No newline at end of file
@@ -6,6 +6,292 @@
 
 cm_world_t cm_world;
 
+/*
+=============================================================================
+
+Entity bounds mirror
+
+The absmin/absmax of every linked entity packed by world sector, in the
+same order as the sector lists, so area queries can reject entities four
+at a time without touching their gentity_t. Contents are still read from
+the gentity once the box overlaps, game code changes r.contents without
+relinking. Every sector owns a slice with some spare room, a list change
+only marks its sector and just that slice is refilled before the next
+query. A sector that outgrows its slice moves to the end of the pool,
+and the whole pool is repacked once it runs out. Relinking in place only
+refreshes the bounds.
+
+=============================================================================
+*/
+
+#define CM_BOUNDS_POOL ( 4 * MAX_GENTITIES )
+
+typedef struct
+{
+	float absmin[3][CM_BOUNDS_POOL + 4];
+	float absmax[3][CM_BOUNDS_POOL + 4];
+	unsigned short entnum[CM_BOUNDS_POOL];
+	unsigned short slot[MAX_GENTITIES];
+	unsigned short first[AREA_NODES];
+	unsigned short count[AREA_NODES];
+	unsigned short capacity[AREA_NODES];
+	unsigned short dirtySectors[AREA_NODES];
+	byte sectorDirty[AREA_NODES];
+	int numDirtySectors;
+	int used;
+	qboolean dirty;     // the whole pool has to be repacked
+} cmEntityBounds_t;
+
+static cmEntityBounds_t cm_bounds;
+static qboolean cm_simdBounds;
+
+/*
+===============
+CM_SectorBoundsCapacity
+===============
+*/
+static int CM_SectorBoundsCapacity( int count )
+{
+	return count ? count + ( count >> 1 ) + 1 : 0;
+}
+
+/*
+===============
+CM_FillSectorBounds
+
+Writes the sector's entities into its slice, which must be big enough
+===============
+*/
+static void CM_FillSectorBounds( int nodeIndex )
+{
+	gentity_t *gcheck;
+	unsigned short entnum;
+	int i, n;
+
+	n = cm_bounds.first[nodeIndex];
+
+	for ( entnum = cm_world.sectors[nodeIndex].contents.entities; entnum; entnum = sv.svEntities[entnum - 1].nextEntityInWorldSector )
+	{
+		gcheck = SV_GEntityForSvEntity(&sv.svEntities[entnum - 1]);
+
+		for ( i = 0; i < 3; i++ )
+		{
+			cm_bounds.absmin[i][n] = gcheck->r.absmin[i];
+			cm_bounds.absmax[i][n] = gcheck->r.absmax[i];
+		}
+
+		cm_bounds.entnum[n] = entnum - 1;
+		cm_bounds.slot[entnum - 1] = n;
+		n++;
+	}
+
+	cm_bounds.count[nodeIndex] = n - cm_bounds.first[nodeIndex];
+}
+
+/*
+===============
+CM_CountSectorEntities
+===============
+*/
+static int CM_CountSectorEntities( int nodeIndex )
+{
+	unsigned short entnum;
+	int count;
+
+	count = 0;
+
+	for ( entnum = cm_world.sectors[nodeIndex].contents.entities; entnum; entnum = sv.svEntities[entnum - 1].nextEntityInWorldSector )
+	{
+		count++;
+	}
+
+	return count;
+}
+
+/*
+===============
+CM_RebuildEntityBounds
+===============
+*/
+static void CM_RebuildEntityBounds()
+{
+	int nodeIndex;
+
+	cm_bounds.used = 0;
+
+	for ( nodeIndex = 0; nodeIndex < AREA_NODES; nodeIndex++ )
+	{
+		cm_bounds.first[nodeIndex] = cm_bounds.used;
+		CM_FillSectorBounds(nodeIndex);
+		cm_bounds.capacity[nodeIndex] = CM_SectorBoundsCapacity(cm_bounds.count[nodeIndex]);
+		cm_bounds.used += cm_bounds.capacity[nodeIndex];
+		cm_bounds.sectorDirty[nodeIndex] = 0;
+	}
+
+	assert(cm_bounds.used <= CM_BOUNDS_POOL);
+
+	cm_bounds.numDirtySectors = 0;
+	cm_bounds.dirty = qfalse;
+}
+
+/*
+===============
+CM_MarkSectorBoundsDirty
+===============
+*/
+static void CM_MarkSectorBoundsDirty( int nodeIndex )
+{
+	if ( cm_bounds.dirty || cm_bounds.sectorDirty[nodeIndex] )
+	{
+		return;
+	}
+
+	cm_bounds.sectorDirty[nodeIndex] = 1;
+	cm_bounds.dirtySectors[cm_bounds.numDirtySectors++] = nodeIndex;
+}
+
+/*
+===============
+CM_RefreshEntityBounds
+
+Brings the mirror up to date before a query
+===============
+*/
+static void CM_RefreshEntityBounds()
+{
+	int nodeIndex;
+	int capacity;
+	int count;
+	int i;
+
+	if ( cm_bounds.dirty )
+	{
+		CM_RebuildEntityBounds();
+		return;
+	}
+
+	for ( i = 0; i < cm_bounds.numDirtySectors; i++ )
+	{
+		nodeIndex = cm_bounds.dirtySectors[i];
+		cm_bounds.sectorDirty[nodeIndex] = 0;
+		count = CM_CountSectorEntities(nodeIndex);
+
+		if ( count > cm_bounds.capacity[nodeIndex] )
+		{
+			capacity = CM_SectorBoundsCapacity(count);
+
+			if ( cm_bounds.used + capacity > CM_BOUNDS_POOL )
+			{
+				CM_RebuildEntityBounds();
+				return;
+			}
+
+			cm_bounds.first[nodeIndex] = cm_bounds.used;
+			cm_bounds.capacity[nodeIndex] = capacity;
+			cm_bounds.used += capacity;
+		}
+
+		CM_FillSectorBounds(nodeIndex);
+	}
+
+	cm_bounds.numDirtySectors = 0;
+}
+
+/*
+===============
+CM_UpdateEntityBounds
+
+The entity was relinked into the sector it was already in
+===============
+*/
+static void CM_UpdateEntityBounds( svEntity_t *ent )
+{
+	gentity_t *gcheck;
+	int slot;
+	int i;
+
+	if ( cm_bounds.dirty || cm_bounds.sectorDirty[ent->worldSector] )
+	{
+		return;
+	}
+
+	gcheck = SV_GEntityForSvEntity(ent);
+	slot = cm_bounds.slot[ent - sv.svEntities];
+
+	assert(cm_bounds.entnum[slot] == ent - sv.svEntities);
+
+	for ( i = 0; i < 3; i++ )
+	{
+		cm_bounds.absmin[i][slot] = gcheck->r.absmin[i];
+		cm_bounds.absmax[i][slot] = gcheck->r.absmax[i];
+	}
+}
+
+#if defined( __GNUC__ ) && ( defined( __i386__ ) || defined( __x86_64__ ) )
+#include <xmmintrin.h>
+#define CM_SIMD_BOUNDS
+
+/*
+===============
+CM_BoundsOverlapSSE
+
+Bit n is set when mirror slot first + n overlaps the box
+===============
+*/
+__attribute__((target("sse")))
+static unsigned int CM_BoundsOverlapSSE( int first, const float *mins, const float *maxs )
+{
+	__m128 out;
+	int i;
+
+	out = _mm_setzero_ps();
+
+	for ( i = 0; i < 3; i++ )
+	{
+		out = _mm_or_ps(out, _mm_cmpgt_ps(_mm_loadu_ps(&cm_bounds.absmin[i][first]), _mm_set1_ps(maxs[i])));
+		out = _mm_or_ps(out, _mm_cmplt_ps(_mm_loadu_ps(&cm_bounds.absmax[i][first]), _mm_set1_ps(mins[i])));
+	}
+
+	return ~_mm_movemask_ps(out) & 15;
+}
+#endif
+
+/*
+===============
+CM_BoundsOverlap
+===============
+*/
+static unsigned int CM_BoundsOverlap( int first, const float *mins, const float *maxs )
+{
+	unsigned int mask;
+	int n, i;
+
+#ifdef CM_SIMD_BOUNDS
+	if ( cm_simdBounds )
+		return CM_BoundsOverlapSSE(first, mins, maxs);
+#endif
+
+	mask = 0;
+
+	for ( n = 0; n < 4; n++ )
+	{
+		for ( i = 0; i < 3; i++ )
+		{
+			if ( cm_bounds.absmin[i][first + n] > maxs[i] || cm_bounds.absmax[i][first + n] < mins[i] )
+			{
+				break;
+			}
+		}
+
+		if ( i == 3 )
+		{
+			mask |= 1 << n;
+		}
+	}
+
+	return mask;
+}
+
 /*
 ===============
 CM_UnlinkEntity
@@ -28,6 +314,7 @@ void CM_UnlinkEntity( svEntity_t *ent )
 
 	node = &cm_world.sectors[nodeIndex];
 	ent->worldSector = 0;
+	CM_MarkSectorBoundsDirty(nodeIndex);
 
 	assert(node->contents.entities);
 
@@ -135,40 +422,48 @@ CM_AreaEntities_r
 static void CM_AreaEntities_r( unsigned short nodeIndex, areaParms_t *ap )
 {
 	gentity_t *gcheck;
-	unsigned short entnum;
+	unsigned int overlap;
+	int first, count;
+	int i, slot;
 
 	if ( !(cm_world.sectors[nodeIndex].contents.contentsEntities & ap->contentmask) )
 	{
 		return;
 	}
 
-	for ( entnum = cm_world.sectors[nodeIndex].contents.entities; entnum; entnum = sv.svEntities[entnum - 1].nextEntityInWorldSector )
+	first = cm_bounds.first[nodeIndex];
+	count = cm_bounds.count[nodeIndex];
+
+	for ( i = 0; i < count; i += 4 )
 	{
-		gcheck = SV_GEntityForSvEntity(&sv.svEntities[entnum - 1]);
+		overlap = CM_BoundsOverlap(first + i, ap->mins, ap->maxs);
 
-		if ( !(gcheck->r.contents & ap->contentmask) )
+		if ( count - i < 4 )
 		{
-			continue;
+			overlap &= ( 1 << ( count - i ) ) - 1; // the rest belongs to the next sector
 		}
 
-		if (	          	 gcheck->r.absmin[ 0 ] > ap->maxs[ 0 ]
-		                     || gcheck->r.absmax[ 0 ] < ap->mins[ 0 ]
-		                     || gcheck->r.absmin[ 1 ] > ap->maxs[ 1 ]
-		                     || gcheck->r.absmax[ 1 ] < ap->mins[ 1 ]
-		                     || gcheck->r.absmin[ 2 ] > ap->maxs[ 2 ]
-		                     || gcheck->r.absmax[ 2 ] < ap->mins[ 2 ] )
+		while ( overlap )
 		{
-			continue;
-		}
+			slot = first + i + __builtin_ctz(overlap);
+			overlap &= overlap - 1;
 
-		if ( ap->count == ap->maxcount )
-		{
-			Com_DPrintf("CM_AreaEntities: MAXCOUNT\n");
-			return;
-		}
+			gcheck = SV_GEntityForSvEntity(&sv.svEntities[cm_bounds.entnum[slot]]);
+
+			if ( !(gcheck->r.contents & ap->contentmask) )
+			{
+				continue;
+			}
 
-		ap->list[ap->count] = &sv.svEntities[entnum - 1] - sv.svEntities;
-		ap->count++;
+			if ( ap->count == ap->maxcount )
+			{
+				Com_DPrintf("CM_AreaEntities: MAXCOUNT\n");
+				return;
+			}
+
+			ap->list[ap->count] = cm_bounds.entnum[slot];
+			ap->count++;
+		}
 	}
 
 	// recurse down both sides
@@ -199,6 +494,7 @@ int CM_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int
 	ap.maxcount = maxcount;
 	ap.contentmask = contentmask;
 
+	CM_RefreshEntityBounds();
 	CM_AreaEntities_r(1, &ap);
 
 	return ap.count;
@@ -289,6 +585,7 @@ static void CM_AddEntityToNode( svEntity_t *ent, unsigned short childNodeIndex )
 	{
 		if ( (unsigned short)(*prevEnt - 1) > entnum )
 		{
+			CM_MarkSectorBoundsDirty(childNodeIndex);
 			ent->worldSector = childNodeIndex;
 			ent->nextEntityInWorldSector = *prevEnt;
 			*prevEnt = entnum + 1;
@@ -369,6 +666,7 @@ addEntity:
 			assert(!prevEnt || (&sv.svEntities[prevEnt->nextEntityInWorldSector - 1] == ent));
 
 			CM_AddEntityToNode(ent, childNodeIndex);
+			CM_MarkSectorBoundsDirty(nodeIndex);
 
 			cm_world.sectors[childNodeIndex].contents.contentsEntities |= SV_GEntityForSvEntity(ent)->r.contents;
 			cm_world.sectors[childNodeIndex].contents.contentsEntities |= ent->linkcontents;
@@ -537,6 +835,7 @@ void CM_LinkEntity( svEntity_t *ent, vec3_t absmin, vec3_t absmax, clipHandle_t
 			ent->linkcontents = linkcontents;
 			Vector2Copy(absmin, ent->linkmin);
 			Vector2Copy(absmax, ent->linkmax);
+			CM_UpdateEntityBounds(ent);
 			return;
 		}
 LABEL_13:
@@ -557,6 +856,7 @@ LABEL_18:
 	ent->linkcontents = linkcontents;
 	Vector2Copy(absmin, ent->linkmin);
 	Vector2Copy(absmax, ent->linkmax);
+	CM_UpdateEntityBounds(ent);
 	CM_SortNode(nodeIndex, mins, maxs);
 }
 
@@ -1302,6 +1602,12 @@ void CM_ClearWorld()
 	int i;
 
 	memset(&cm_world, 0, sizeof(cm_world));
+	cm_bounds.dirty = qtrue;
+
+#ifdef CM_SIMD_BOUNDS
+	__builtin_cpu_init();
+	cm_simdBounds = __builtin_cpu_supports("sse") ? qtrue : qfalse;
+#endif
 
 	CM_ModelBounds(0, cm_world.mins, cm_world.maxs);
 
@@ -1,4 +1,5 @@
 #include "qcommon.h"
+#include "sys_thread.h"
 
 #define IBSP_VERSION 4
 
@@ -27,6 +28,38 @@ static_assert((sizeof(comBspGlob_t) == 0xC), "ERROR: comBspGlob_t size is invali
 
 comBspGlob_t comBspGlob;
 
+// set when comBspGlob.header is a file mapping rather than a heap copy
+static int comBspMapLength;
+
+enum
+{
+	BSP_PREFETCH_IDLE,
+	BSP_PREFETCH_RUNNING,
+	BSP_PREFETCH_DONE
+};
+
+// A map read ahead of time by a background thread. The thread only touches
+// its own zip handle, so it never races the file system. It posts finished
+// once when it is done, and the main thread waits for that post before it
+// leaves BSP_PREFETCH_RUNNING, so every thread is waited for exactly once.
+typedef struct
+{
+	int state;
+	qboolean initialized;
+	semaphore_t finished;
+	volatile int threadDone;
+	char filename[MAX_QPATH];
+	char iwdPath[MAX_OSPATH];
+	long pos;
+	dheader_t *header;
+	int fileSize;
+	unsigned int crc;
+	unsigned int checksum;
+	int msec;
+} bspPrefetch_t;
+
+static bspPrefetch_t bspPrefetch;
+
 qboolean Com_IsBspLoaded()
 {
 	return comBspGlob.header != NULL;
@@ -44,7 +77,16 @@ const char *GetBspExtension()
 
 void Com_UnloadBsp()
 {
-	Z_Free(comBspGlob.header);
+	if ( comBspMapLength )
+	{
+		Sys_UnmapFile(comBspGlob.header, comBspMapLength);
+		comBspMapLength = 0;
+	}
+	else
+	{
+		Z_Free(comBspGlob.header);
+	}
+
 	comBspGlob.header = NULL;
 }
 
@@ -102,6 +144,207 @@ bool Com_BspHasLump(int type)
 	return count != 0;
 }
 
+/*
+=================
+Com_PrefetchBspThread
+=================
+*/
+static void *Com_PrefetchBspThread(void *arg)
+{
+	unzFile uf;
+	unz_file_info info;
+	dheader_t *header;
+	int bytesRead;
+	int start;
+	int err;
+
+	start = Sys_Milliseconds();
+	header = NULL;
+	uf = unzOpen(bspPrefetch.iwdPath);
+
+	if ( !uf )
+		goto done;
+
+	if ( bspPrefetch.pos < 0 )
+		err = unzLocateFile(uf, bspPrefetch.filename, 2);
+	else
+		err = unzSetCurrentFileInfoPosition(uf, bspPrefetch.pos);
+
+	if ( err != UNZ_OK || unzGetCurrentFileInfo(uf, &info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK )
+		goto close;
+
+	if ( info.uncompressed_size < sizeof(*header) || info.uncompressed_size > 0x7FFFFFFF )
+		goto close;
+
+	if ( unzOpenCurrentFile(uf) != UNZ_OK )
+		goto close;
+
+	header = (dheader_t *)Z_MallocGarbage(info.uncompressed_size);
+
+	bytesRead = unzReadCurrentFile(uf, header, info.uncompressed_size);
+
+	// closing the file checks the data against the crc
+	if ( unzCloseCurrentFile(uf) != UNZ_OK || bytesRead != (int)info.uncompressed_size )
+	{
+		Z_Free(header);
+		header = NULL;
+		goto close;
+	}
+
+	bspPrefetch.fileSize = info.uncompressed_size;
+	bspPrefetch.crc = info.crc;
+	bspPrefetch.checksum = Com_BlockChecksum(header, info.uncompressed_size);
+
+close:
+	unzClose(uf);
+
+done:
+	bspPrefetch.header = header;
+	bspPrefetch.msec = Sys_Milliseconds() - start;
+	__sync_synchronize();
+	bspPrefetch.threadDone = qtrue;
+	Sys_SemaphorePost(&bspPrefetch.finished);
+
+	return NULL;
+}
+
+/*
+=================
+Com_WaitForPrefetchedBsp
+=================
+*/
+static void Com_WaitForPrefetchedBsp()
+{
+	if ( bspPrefetch.state != BSP_PREFETCH_RUNNING )
+		return;
+
+	Sys_SemaphoreWait(&bspPrefetch.finished);
+	__sync_synchronize();
+	bspPrefetch.state = BSP_PREFETCH_DONE;
+}
+
+/*
+=================
+Com_DiscardPrefetchedBsp
+=================
+*/
+static void Com_DiscardPrefetchedBsp()
+{
+	Com_WaitForPrefetchedBsp();
+
+	if ( bspPrefetch.state != BSP_PREFETCH_DONE )
+		return;
+
+	if ( bspPrefetch.header )
+	{
+		Z_Free(bspPrefetch.header);
+		bspPrefetch.header = NULL;
+	}
+
+	bspPrefetch.state = BSP_PREFETCH_IDLE;
+}
+
+/*
+=================
+Com_PrefetchBsp
+
+Starts reading filename out of iwdPath in the background. pos is the
+position of its entry in the zip directory, or -1 to look it up by name.
+=================
+*/
+void Com_PrefetchBsp(const char *filename, const char *iwdPath, long pos)
+{
+	threadid_t tid;
+
+	if ( bspPrefetch.state == BSP_PREFETCH_RUNNING && !bspPrefetch.threadDone )
+	{
+		Com_Printf("Still prefetching %s\n", bspPrefetch.filename);
+		return;
+	}
+
+	Com_WaitForPrefetchedBsp();
+
+	if ( bspPrefetch.state == BSP_PREFETCH_DONE && bspPrefetch.header && !I_stricmp(bspPrefetch.filename, filename) )
+		return;
+
+	Com_DiscardPrefetchedBsp();
+
+	I_strncpyz(bspPrefetch.filename, filename, sizeof(bspPrefetch.filename));
+	I_strncpyz(bspPrefetch.iwdPath, iwdPath, sizeof(bspPrefetch.iwdPath));
+	bspPrefetch.pos = pos;
+	bspPrefetch.header = NULL;
+	bspPrefetch.threadDone = qfalse;
+	bspPrefetch.state = BSP_PREFETCH_RUNNING;
+
+	if ( !bspPrefetch.initialized )
+	{
+		Sys_SemaphoreInit(&bspPrefetch.finished);
+		bspPrefetch.initialized = qtrue;
+	}
+
+	__sync_synchronize();
+
+	if ( !Sys_CreateNewThread(Com_PrefetchBspThread, &tid, NULL) )
+	{
+		bspPrefetch.state = BSP_PREFETCH_IDLE;
+		return;
+	}
+
+	Com_Printf("Prefetching %s from %s\n", filename, iwdPath);
+}
+
+/*
+=================
+Com_ShutdownBspPrefetch
+
+Waits for a prefetch still in flight and frees what it read
+=================
+*/
+void Com_ShutdownBspPrefetch()
+{
+	Com_DiscardPrefetchedBsp();
+}
+
+/*
+=================
+Com_TakePrefetchedBsp
+
+Hands over the prefetched copy of filename if it is the same zip entry the
+file system just opened as h, waiting for the read to finish if needed
+=================
+*/
+static qboolean Com_TakePrefetchedBsp(const char *filename, fileHandle_t h, int fileSize)
+{
+	unsigned int crc;
+
+	if ( bspPrefetch.state == BSP_PREFETCH_IDLE )
+		return qfalse;
+
+	if ( I_stricmp(bspPrefetch.filename, filename) )
+	{
+		// the rotation went somewhere else
+		Com_DiscardPrefetchedBsp();
+		return qfalse;
+	}
+
+	Com_WaitForPrefetchedBsp();
+
+	if ( !bspPrefetch.header || bspPrefetch.fileSize != fileSize || !FS_GetIwdFileCrc(h, &crc) || crc != bspPrefetch.crc )
+	{
+		Com_DiscardPrefetchedBsp();
+		return qfalse;
+	}
+
+	Com_Printf("Using %s prefetched in %i msec\n", filename, bspPrefetch.msec);
+
+	comBspGlob.header = bspPrefetch.header;
+	comBspGlob.checksum = bspPrefetch.checksum;
+	bspPrefetch.header = NULL;
+	bspPrefetch.state = BSP_PREFETCH_IDLE;
+
+	return qtrue;
+}
+
 void Com_LoadBsp(const char *filename)
 {
 	fileHandle_t h;
@@ -115,24 +358,45 @@ void Com_LoadBsp(const char *filename)
 		Com_Error(ERR_DROP, "EXE_ERR_COULDNT_LOAD\x15%s", filename);
 	}
 
-	comBspGlob.header = (dheader_t *)Z_MallocGarbage(comBspGlob.fileSize);
-	bytesRead = FS_Read(comBspGlob.header, comBspGlob.fileSize, h);
-	FS_FCloseFile(h);
-
-	if ( bytesRead != comBspGlob.fileSize || comBspGlob.fileSize < sizeof(*comBspGlob.header) )
+	if ( Com_TakePrefetchedBsp(filename, h, comBspGlob.fileSize) )
 	{
-		Z_Free(comBspGlob.header);
-		Com_Error(ERR_DROP, "EXE_ERR_COULDNT_LOAD\x15%s", filename);
+		FS_FCloseFile(h);
 	}
+	else if ( (comBspGlob.header = (dheader_t *)FS_MapFile(h, &comBspMapLength)) != NULL )
+	{
+		// loose map: lumps are read straight from the page cache, and only
+		// pages that get written to (the header below) are copied
+		FS_FCloseFile(h);
 
-	comBspGlob.checksum = Com_BlockChecksum(comBspGlob.header, comBspGlob.fileSize);
+		if ( comBspMapLength < comBspGlob.fileSize || comBspGlob.fileSize < (int)sizeof(*comBspGlob.header) )
+		{
+			Com_UnloadBsp();
+			Com_Error(ERR_DROP, "EXE_ERR_COULDNT_LOAD\x15%s", filename);
+		}
+
+		comBspGlob.checksum = Com_BlockChecksum(comBspGlob.header, comBspGlob.fileSize);
+	}
+	else
+	{
+		comBspGlob.header = (dheader_t *)Z_MallocGarbage(comBspGlob.fileSize);
+		bytesRead = FS_Read(comBspGlob.header, comBspGlob.fileSize, h);
+		FS_FCloseFile(h);
+
+		if ( bytesRead != comBspGlob.fileSize || comBspGlob.fileSize < sizeof(*comBspGlob.header) )
+		{
+			Z_Free(comBspGlob.header);
+			Com_Error(ERR_DROP, "EXE_ERR_COULDNT_LOAD\x15%s", filename);
+		}
+
+		comBspGlob.checksum = Com_BlockChecksum(comBspGlob.header, comBspGlob.fileSize);
+	}
 
 	comBspGlob.header->ident = LittleLong(comBspGlob.header->ident);
 	comBspGlob.header->version = LittleLong(comBspGlob.header->version);
 
 	if ( comBspGlob.header->ident != (uint32_t)'PSBI' || comBspGlob.header->version != IBSP_VERSION )
 	{
-		Z_Free(comBspGlob.header);
+		Com_UnloadBsp();
 		Com_Error(ERR_DROP, "EXE_ERR_WRONG_MAP_VERSION_NUM\x15%s", filename);
 	}
 
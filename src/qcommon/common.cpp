@@ -21,6 +21,8 @@ dvar_t *sv_paused;
 dvar_t *cl_paused;
 dvar_t *com_introPlayed;
 dvar_t *com_animCheck;
+dvar_t *com_frameWait;
+dvar_t *com_scriptCompileCache;
 dvar_t *com_sv_running;
 
 dvar_t *ui_errorMessage;
@@ -200,6 +202,16 @@ void Com_PushEvent( sysEvent_t *event )
 	sysEvent_t      *ev;
 	static int printedWarning = 0; // bk001129 - init, bk001204 - explicit int
 
+	// packets still in the system receive ring are only valid
+	// until the next Sys_GetEvent, so keep a copy
+	if ( event->evType == SE_PACKET && event->evValue )
+	{
+		void *ptr = Z_Malloc( event->evPtrLength );
+		Com_Memcpy( ptr, event->evPtr, event->evPtrLength );
+		event->evPtr = ptr;
+		event->evValue = 0;
+	}
+
 	ev = &com_pushedEvents[ com_pushedEventsHead & ( MAX_PUSHED_EVENTS - 1 ) ];
 
 	if ( com_pushedEventsHead - com_pushedEventsTail >= MAX_PUSHED_EVENTS )
@@ -1069,6 +1081,7 @@ int Com_EventLoop( void )
 	netadr_t	evFrom;
 	byte		bufData[MAX_MSGLEN];
 	msg_t		buf;
+	msg_t		slotBuf;
 
 	MSG_Init( &buf, bufData, sizeof( bufData ) );
 
@@ -1110,6 +1123,35 @@ int Com_EventLoop( void )
 			break;
 		case SE_PACKET:
 			evFrom = *(netadr_t *)ev.evPtr;
+
+			// packets from the system receive ring are processed in
+			// place, evValue is the size of their slot. Netchan fragments
+			// are the exception, the last one gets the reassembled message
+			// copied over it, which only fits in bufData
+			if ( ev.evValue )
+			{
+				MSG_Init( &slotBuf, (byte *)((netadr_t *)ev.evPtr + 1), ev.evValue );
+				slotBuf.cursize = ev.evPtrLength - sizeof( evFrom );
+
+				if ( slotBuf.cursize >= 4 && ( LittleLong( *(int *)slotBuf.data ) & ( 1 << 31 ) ) && *(int *)slotBuf.data != -1 )
+				{
+					buf.cursize = slotBuf.cursize;
+					Com_Memcpy( buf.data, slotBuf.data, buf.cursize );
+
+					if ( com_sv_running->current.boolean )
+					{
+						SV_PacketEvent( evFrom, &buf );
+					}
+					break;
+				}
+
+				if ( com_sv_running->current.boolean )
+				{
+					SV_PacketEvent( evFrom, &slotBuf );
+				}
+				break;
+			}
+
 			buf.cursize = ev.evPtrLength - sizeof( evFrom );
 
 			// we must copy the contents of the message out, because
@@ -1200,6 +1242,85 @@ static void Com_Crash_f( void )
 	* ( int * ) 0 = 0x12345678;
 }
 
+typedef struct
+{
+	int frames;
+	int lateTotal;
+	int lateMax;
+	int lastStart;
+	int intervals;
+	double intervalTotal;
+	double intervalSqrTotal;
+} frameStats_t;
+
+static frameStats_t com_frameStats;
+
+/*
+=================
+Com_FrameStats_f
+
+Prints how late scheduled server frames started and how
+evenly they were spaced since the last call
+=================
+*/
+static void Com_FrameStats_f( void )
+{
+	frameStats_t *stats;
+	double mean;
+	double variance;
+
+	stats = &com_frameStats;
+
+	if ( !stats->frames )
+	{
+		Com_Printf("No scheduled frames, set com_frameWait 1 on a dedicated server\n");
+		return;
+	}
+
+	Com_Printf("frames: %i\n", stats->frames);
+	Com_Printf("oversleep: avg %.2f msec, max %i msec\n", (float)stats->lateTotal / stats->frames, stats->lateMax);
+
+	if ( stats->intervals )
+	{
+		mean = stats->intervalTotal / stats->intervals;
+		variance = stats->intervalSqrTotal / stats->intervals - mean * mean;
+
+		if ( variance < 0 )
+			variance = 0;
+
+		Com_Printf("interval: avg %.2f msec, jitter %.2f msec\n", mean, sqrt(variance));
+	}
+
+	memset(stats, 0, sizeof(*stats));
+}
+
+/*
+=================
+Com_ScheduledFrameMsec
+
+Returns how long a dedicated server can block until its next
+game frame is due, or 0 if it should keep the old polling
+=================
+*/
+static int Com_ScheduledFrameMsec()
+{
+	int remaining;
+
+	if ( !com_frameWait->current.boolean || !com_dedicated->current.integer )
+		return 0;
+
+	// frame time isn't wall clock time with these
+	if ( com_fixedtime->current.integer || com_timescale->current.decimal != 1.0 || com_codeTimeScale != 1.0 )
+		return 0;
+
+	remaining = SV_FrameMsecRemaining();
+
+	if ( remaining < 1 )
+		return 0;
+
+	return remaining;
+}
+
 /*
 =================
 Com_Frame_Try_Block_Function
@@ -1208,6 +1329,9 @@ Com_Frame_Try_Block_Function
 static void Com_Frame_Try_Block_Function()
 {
 	int msec, minMsec;
+	int scheduledMsec;
+	int interval;
+	int late;
 
 	Com_WriteConfiguration();
 	Com_DedicatedModified();
@@ -1222,6 +1346,13 @@ static void Com_Frame_Try_Block_Function()
 			minMsec = 1;
 	}
 
+	// a dedicated server has nothing to do until its next game frame,
+	// so block until then, packets still wake up the event loop
+	scheduledMsec = Com_ScheduledFrameMsec();
+
+	if ( scheduledMsec )
+		minMsec = scheduledMsec;
+
 	while (1)
 	{
 		com_frameTime = Com_EventLoop();
@@ -1234,7 +1365,33 @@ static void Com_Frame_Try_Block_Function()
 		if ( msec >= minMsec )
 			break;
 
-		NET_Sleep(0);
+		NET_Sleep( scheduledMsec ? minMsec - msec : 0 );
+	}
+
+	if ( scheduledMsec )
+	{
+		late = msec - minMsec;
+
+		com_frameStats.frames++;
+		com_frameStats.lateTotal += late;
+
+		if ( late > com_frameStats.lateMax )
+			com_frameStats.lateMax = late;
+
+		if ( com_frameStats.lastStart )
+		{
+			interval = com_frameTime - com_frameStats.lastStart;
+
+			com_frameStats.intervals++;
+			com_frameStats.intervalTotal += interval;
+			com_frameStats.intervalSqrTotal += (double)interval * interval;
+		}
+
+		com_frameStats.lastStart = com_frameTime;
+	}
+	else
+	{
+		com_frameStats.lastStart = 0;
 	}
 
 	Cbuf_Execute();
@@ -1292,9 +1449,12 @@ static void Com_Init_Try_Block_Function( char *commandLine )
 		Cmd_AddCommand("error", Com_Error_f);
 		Cmd_AddCommand("crash", Com_Crash_f);
 		Cmd_AddCommand("freeze", Com_Freeze_f);
+		Cmd_AddCommand("huffBenchmark", MSG_HuffBenchmark_f);
+		Cmd_AddCommand("msgBitTest", MSG_BitTest_f);
 	}
 	Cmd_AddCommand("quit", Com_Quit_f);
 	Cmd_AddCommand("writeconfig", Com_WriteConfig_f);
+	Cmd_AddCommand("frameStats", Com_FrameStats_f);
 	Cmd_AddCommand("writedefaults", Com_WriteDefaults_f);
 	Dvar_RegisterString("version", va("%s %s build %s %s", GAME_STRING,PRODUCT_VERSION,CPUSTRING, __DATE__), DVAR_ROM | DVAR_CHANGEABLE_RESET);
 	Dvar_RegisterString("shortversion", PRODUCT_VERSION, DVAR_SERVERINFO | DVAR_ROM | DVAR_CHANGEABLE_RESET);
@@ -1464,6 +1624,8 @@ void Com_InitDvars()
 	com_sv_running = Dvar_RegisterBool("sv_running", false, DVAR_ROM | DVAR_CHANGEABLE_RESET);
 	com_introPlayed = Dvar_RegisterBool("com_introPlayed", false, DVAR_ARCHIVE | DVAR_CHANGEABLE_RESET);
 	com_animCheck = Dvar_RegisterBool("com_animCheck", false, DVAR_CHANGEABLE_RESET);
+	com_scriptCompileCache = Dvar_RegisterBool("com_scriptCompileCache", false, DVAR_ARCHIVE | DVAR_CHANGEABLE_RESET);
+	com_frameWait = Dvar_RegisterBool("com_frameWait", false, DVAR_ARCHIVE | DVAR_CHANGEABLE_RESET);
 
 	if ( com_dedicated->current.integer )
 	{
@@ -37,27 +37,24 @@ static int bloc = 0;
 
 //bani - optimized version
 //clears data along the way so we dont have to memset() it ahead of time
+//works on the caller's offset only, so it is safe to use from worker threads
 void    Huff_putBit( int bit, byte *fout, int *offset ) {
 	int x, y;
-	bloc = *offset;
-	x = bloc >> 3;
-	y = bloc & 7;
+	x = *offset >> 3;
+	y = *offset & 7;
 	if ( !y ) {
 		fout[ x ] = 0;
 	}
 	fout[ x ] |= bit << y;
-	bloc++;
-	*offset = bloc;
+	( *offset )++;
 }
 
 //bani - optimized version
 //optimization works on gcc 3.x, but not 2.95 ? most curious.
 int Huff_getBit( byte *fin, int *offset ) {
 	int t;
-	bloc = *offset;
-	t = fin[ bloc >> 3 ] >> ( bloc & 7 ) & 0x1;
-	bloc++;
-	*offset = bloc;
+	t = fin[ *offset >> 3 ] >> ( *offset & 7 ) & 0x1;
+	( *offset )++;
 	return t;
 }
 
@@ -333,10 +330,64 @@ void Huff_transmit( huff_t *huff, int ch, byte *fout ) {
 	}
 }
 
+/* Send the prefix code for this node at *offset, without touching bloc */
+static void offsetSend( node_t *node, node_t *child, byte *fout, int *offset ) {
+	if ( node->parent ) {
+		offsetSend( node->parent, node, fout, offset );
+	}
+	if ( child ) {
+		Huff_putBit( node->right == child, fout, offset );
+	}
+}
+
 void Huff_offsetTransmit( huff_t *huff, int ch, byte *fout, int *offset ) {
-	bloc = *offset;
-	send( huff->loc[ch], NULL, fout );
-	*offset = bloc;
+	offsetSend( huff->loc[ch], NULL, fout, offset );
+}
+
+/* Flatten a tree that will not be updated any more into per-symbol codes
+ * and a HUFF_LOOKUP_BITS wide decode table. The codes are the tree's own,
+ * so table and tree output stay bit-identical. */
+void Huff_BuildTables( huff_t *huff, huffTables_t *tables ) {
+	node_t *node;
+	int i, j, length;
+	unsigned int code;
+
+	Com_Memset( tables, 0, sizeof( *tables ) );
+
+	for ( i = 0; i <= HMAX; i++ ) {
+		if ( !huff->loc[i] ) {
+			return;
+		}
+		code = 0;
+		length = 0;
+		for ( node = huff->loc[i]; node->parent; node = node->parent ) {
+			if ( length == 32 ) {
+				return;
+			}
+			code = ( code << 1 ) | ( node->parent->right == node );
+			length++;
+		}
+		tables->codes[i].code = code;
+		tables->codes[i].length = length;
+	}
+
+	for ( i = 0; i < ( 1 << HUFF_LOOKUP_BITS ); i++ ) {
+		node = huff->tree;
+		for ( j = 0; j < HUFF_LOOKUP_BITS && node->symbol == INTERNAL_NODE; j++ ) {
+			node = ( i >> j ) & 1 ? node->right : node->left;
+			if ( !node ) {
+				return;
+			}
+		}
+		tables->lookup[i].length = j;
+		if ( node->symbol == INTERNAL_NODE ) {
+			tables->lookup[i].node = node;
+		} else {
+			tables->lookup[i].symbol = node->symbol;
+		}
+	}
+
+	tables->valid = qtrue;
 }
 
 void Huff_Decompress( msg_t *mbuf, int offset ) {
@@ -2,6 +2,10 @@
 #include "sys_thread.h"
 
 static huffman_t msgHuff;
+static huffTables_t msgHuffEncode;
+static huffTables_t msgHuffDecode;
+
+static void MSG_InitFieldLayouts();
 static qboolean msgInit = qfalse;
 
 /*
@@ -233,10 +237,12 @@ int MSG_ReadBit( msg_t *msg )
 
 /*
 ==============
-MSG_ReadBits
+MSG_ReadBitsReference
+
+One bit at a time, also used whenever the read would run off the end
 ==============
 */
-int MSG_ReadBits( msg_t *msg, int bits )
+static int MSG_ReadBitsReference( msg_t *msg, int bits )
 {
 	assert((unsigned)bits <= 32);
 	int value = 0;
@@ -249,6 +255,59 @@ int MSG_ReadBits( msg_t *msg, int bits )
 	return value;
 }
 
+/*
+==============
+MSG_ReadBits
+
+Takes the rest of the current bit byte in one step, then the following
+whole bytes. Bytes for bit data are claimed at readcount just like
+MSG_ReadBit does, so reads interleaved with MSG_ReadByte are unchanged.
+==============
+*/
+int MSG_ReadBits( msg_t *msg, int bits )
+{
+	assert((unsigned)bits <= 32);
+	unsigned int value;
+	int used;
+	int bytes;
+	int bit;
+	int i;
+
+	bit = msg->bit & 7;
+	used = bit ? 8 - bit : 0;
+
+	if ( used > bits )
+		used = bits;
+
+	bytes = ( bits - used + 7 ) >> 3;
+
+	if ( msg->readcount + bytes > msg->cursize )
+		return MSG_ReadBitsReference( msg, bits );
+
+	value = 0;
+
+	if ( used )
+	{
+		value = msg->data[msg->bit >> 3] >> bit;
+		msg->bit += used;
+	}
+
+	if ( bytes )
+	{
+		msg->bit = msg->readcount * 8 + ( bits - used );
+
+		for ( i = 0; i < bytes; i++ )
+			value |= (unsigned int)msg->data[msg->readcount + i] << ( used + i * 8 );
+
+		msg->readcount += bytes;
+	}
+
+	if ( bits < 32 )
+		value &= ( 1u << bits ) - 1;
+
+	return value;
+}
+
 /*
 ==============
 MSG_WriteBit1
@@ -332,10 +391,12 @@ void MSG_WriteBit( msg_t *msg, int value )
 
 /*
 ==============
-MSG_WriteBits
+MSG_WriteBitsReference
+
+One bit at a time, also used whenever the write would reach maxsize
 ==============
 */
-void MSG_WriteBits( msg_t *msg, int value, int bits )
+static void MSG_WriteBitsReference( msg_t *msg, int value, int bits )
 {
 	assert((unsigned)bits <= 32);
 
@@ -346,6 +407,63 @@ void MSG_WriteBits( msg_t *msg, int value, int bits )
 	}
 }
 
+/*
+==============
+MSG_WriteBits
+
+Fills the rest of the current bit byte in one step and stores the
+remaining bits as whole bytes at cursize, the same bytes MSG_WriteBit
+would claim one by one
+==============
+*/
+void MSG_WriteBits( msg_t *msg, int value, int bits )
+{
+	assert((unsigned)bits <= 32);
+	unsigned int v;
+	int used;
+	int bytes;
+	int bit;
+	int i;
+
+	bit = msg->bit & 7;
+	used = bit ? 8 - bit : 0;
+
+	if ( used > bits )
+		used = bits;
+
+	bytes = ( bits - used + 7 ) >> 3;
+
+	// every bit must see cursize < maxsize, including those after the last new byte
+	if ( msg->cursize + bytes >= msg->maxsize )
+	{
+		MSG_WriteBitsReference( msg, value, bits );
+		return;
+	}
+
+	v = value;
+
+	if ( bits < 32 )
+		v &= ( 1u << bits ) - 1;
+
+	if ( used )
+	{
+		msg->data[msg->bit >> 3] |= ( v << bit ) & 0xFF;
+		msg->bit += used;
+		v >>= used;
+	}
+
+	if ( bytes )
+	{
+		msg->bit = msg->cursize * 8 + ( bits - used );
+
+		for ( i = 0; i < bytes; i++ )
+		{
+			msg->data[msg->cursize++] = (byte)v;
+			v >>= 8;
+		}
+	}
+}
+
 /*
 ==============
 MSG_GetUsedBitCount
@@ -356,6 +474,79 @@ int MSG_GetUsedBitCount( const msg_t *msg )
 	return 8 * (msg->cursize) - ((8 - msg->bit) & 7);
 }
 
+/*
+==============
+MSG_BeginSplice
+
+Prepares scratch to record writes the way they would land in msg. Bit
+data only depends on msg's bit phase, so the recording can be replayed
+with MSG_WriteSplice into any message at that phase.
+==============
+*/
+void MSG_BeginSplice( msg_t *scratch, byte *data, int length, const msg_t *msg )
+{
+	MSG_Init(scratch, data, length);
+
+	if ( msg->bit & 7 )
+	{
+		// stands in for msg's partially used bit byte
+		scratch->data[0] = 0;
+		scratch->cursize = 1;
+		scratch->bit = msg->bit & 7;
+	}
+}
+
+/*
+==============
+MSG_EndSplice
+==============
+*/
+qboolean MSG_EndSplice( const msg_t *scratch, int phase, msgSplice_t *splice )
+{
+	if ( scratch->overflowed )
+		return qfalse;
+
+	splice->phase = phase;
+	splice->partial = phase ? scratch->data[0] : 0;
+	splice->data = scratch->data + ( phase ? 1 : 0 );
+	splice->length = scratch->cursize - ( phase ? 1 : 0 );
+	splice->bit = scratch->bit;
+
+	return qtrue;
+}
+
+/*
+==============
+MSG_WriteSplice
+
+Replays a recording made at msg's bit phase. Returns qfalse without
+touching msg when it would come near maxsize, so the caller can write
+the data normally and get the usual overflow behaviour.
+==============
+*/
+qboolean MSG_WriteSplice( msg_t *msg, const msgSplice_t *splice )
+{
+	int base;
+
+	if ( ( msg->bit & 7 ) != splice->phase || msg->cursize + splice->length >= msg->maxsize )
+		return qfalse;
+
+	if ( splice->phase )
+		msg->data[msg->bit >> 3] |= splice->partial;
+
+	base = splice->phase ? 1 : 0;
+
+	if ( splice->bit <= ( splice->phase ? 8 : 0 ) )
+		msg->bit = ( msg->bit & ~7 ) + splice->bit; // bits never left msg's current bit byte
+	else
+		msg->bit = ( msg->cursize - base ) * 8 + splice->bit;
+
+	memcpy(msg->data + msg->cursize, splice->data, splice->length);
+	msg->cursize += splice->length;
+
+	return qtrue;
+}
+
 /*
 ==============
 MSG_BeginReading
@@ -767,10 +958,12 @@ void MSG_WriteAngle16( msg_t *sb, float f )
 
 /*
 ==============
-MSG_ReadBitsCompress
+MSG_ReadBitsCompressTree
+
+Reference decoder, walks the tree one bit at a time
 ==============
 */
-int MSG_ReadBitsCompress( byte *from, byte *to, int toSizeBytes )
+static int MSG_ReadBitsCompressTree( byte *from, byte *to, int toSizeBytes )
 {
 	byte *data;
 	int bit;
@@ -791,6 +984,86 @@ int MSG_ReadBitsCompress( byte *from, byte *to, int toSizeBytes )
 	return data - to;
 }
 
+/*
+==============
+MSG_ReadBitsCompress
+
+Decodes through the lookup table from a 64-bit window refilled a byte
+at a time, never past toSizeBytes. The last few bits, and any code too
+long for the table, go through the tree walk exactly as before.
+==============
+*/
+int MSG_ReadBitsCompress( byte *from, byte *to, int toSizeBytes )
+{
+	const huffLookup_t *entry;
+	uint64_t window;
+	int avail;
+	int pos;
+	byte *data;
+	int bit;
+	int bits;
+	int get;
+
+	if ( !msgHuffDecode.valid )
+		return MSG_ReadBitsCompressTree(from, to, toSizeBytes);
+
+	bits = toSizeBytes * 8;
+	data = to;
+	bit = 0;
+	window = 0;
+	avail = 0;
+	pos = 0;
+
+	while ( bits > bit )
+	{
+		if ( avail < HUFF_LOOKUP_BITS )
+		{
+			while ( avail <= 56 && pos < toSizeBytes )
+			{
+				window |= (uint64_t)from[pos++] << avail;
+				avail += 8;
+			}
+
+			if ( avail < HUFF_LOOKUP_BITS )
+				break;
+		}
+
+		entry = &msgHuffDecode.lookup[window & ( ( 1 << HUFF_LOOKUP_BITS ) - 1 )];
+
+		if ( entry->node )
+		{
+			bit += HUFF_LOOKUP_BITS;
+			Huff_offsetReceive(entry->node, &get, from, &bit);
+			*data++ = get;
+
+			// restart the window at the new position
+			pos = bit >> 3;
+			window = 0;
+			avail = 0;
+
+			if ( pos < toSizeBytes )
+			{
+				window = from[pos++] >> ( bit & 7 );
+				avail = 8 - ( bit & 7 );
+			}
+			continue;
+		}
+
+		*data++ = entry->symbol;
+		window >>= entry->length;
+		avail -= entry->length;
+		bit += entry->length;
+	}
+
+	while ( bits > bit )
+	{
+		Huff_offsetReceive(msgHuff.decompressor.tree, &get, from, &bit);
+		*data++ = get;
+	}
+
+	return data - to;
+}
+
 // Q3 TA freq. table.
 static const int msg_hData[256] =
 {
@@ -1071,6 +1344,10 @@ static void MSG_InitHuffmanInternal()
 			Huff_addRef(&msgHuff.decompressor,	(byte)i);			// Do update
 		}
 	}
+
+	// the trees are fixed from here on
+	Huff_BuildTables(&msgHuff.compressor, &msgHuffEncode);
+	Huff_BuildTables(&msgHuff.decompressor, &msgHuffDecode);
 }
 
 /*
@@ -1082,6 +1359,7 @@ void MSG_InitHuffman()
 {
 	msgInit = qtrue;
 	MSG_InitHuffmanInternal();
+	MSG_InitFieldLayouts();
 }
 
 #define KEY_MASK_MOVE_FORWARD 1
@@ -1259,10 +1537,12 @@ void MSG_WriteDeltaUsercmdKey( msg_t *msg, int key, usercmd_t *from, usercmd_t *
 
 /*
 ==============
-MSG_WriteBitsCompress
+MSG_WriteBitsCompressTree
+
+Reference encoder, walks the tree one bit at a time
 ==============
 */
-int MSG_WriteBitsCompress( byte *from, byte *to, int fromSizeBytes )
+static int MSG_WriteBitsCompressTree( byte *from, byte *to, int fromSizeBytes )
 {
 	int bit;
 	int data;
@@ -1280,6 +1560,156 @@ int MSG_WriteBitsCompress( byte *from, byte *to, int fromSizeBytes )
 	return (bit + 7) >> 3;
 }
 
+/*
+==============
+MSG_WriteBitsCompress
+
+Emits the flattened codes through a 64-bit accumulator, 32 bits at a
+time. Writes exactly the bytes the tree walk would, with the unused high
+bits of the last byte cleared.
+==============
+*/
+int MSG_WriteBitsCompress( byte *from, byte *to, int fromSizeBytes )
+{
+	const huffCode_t *code;
+	uint64_t bits;
+	int count;
+	byte *out;
+
+	if ( !msgHuffEncode.valid )
+		return MSG_WriteBitsCompressTree(from, to, fromSizeBytes);
+
+	bits = 0;
+	count = 0;
+	out = to;
+
+	while ( fromSizeBytes-- )
+	{
+		code = &msgHuffEncode.codes[*from++];
+		bits |= (uint64_t)code->code << count;
+		count += code->length;
+
+		if ( count >= 32 )
+		{
+			out[0] = (byte)bits;
+			out[1] = (byte)( bits >> 8 );
+			out[2] = (byte)( bits >> 16 );
+			out[3] = (byte)( bits >> 24 );
+			out += 4;
+			bits >>= 32;
+			count -= 32;
+		}
+	}
+
+	while ( count > 0 )
+	{
+		*out++ = (byte)bits;
+		bits >>= 8;
+		count -= 8;
+	}
+
+	return out - to;
+}
+
+/*
+==============
+MSG_HuffBenchmark_f
+
+Times the tree and table coders on snapshot-like data and checks that
+they produce identical output
+==============
+*/
+#define HUFF_BENCHMARK_BYTES 1400
+
+void MSG_HuffBenchmark_f()
+{
+	static byte source[HUFF_BENCHMARK_BYTES];
+	static byte treeOut[HUFF_BENCHMARK_BYTES * 4];
+	static byte tableOut[HUFF_BENCHMARK_BYTES * 4];
+	static byte decoded[HUFF_BENCHMARK_BYTES * 16];
+	int iterations;
+	int treeSize;
+	int tableSize;
+	int decodedSize;
+	int start;
+	int msec[4];
+	unsigned int total;
+	unsigned int pick;
+	int i;
+	int j;
+
+	if ( !msgInit )
+		MSG_InitHuffman();
+
+	iterations = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 2000;
+
+	if ( iterations < 1 )
+		iterations = 1;
+
+	// draw symbols with the frequencies the tree was built from
+	for ( total = 0, i = 0; i < 256; i++ )
+		total += msg_hData[i];
+
+	for ( i = 0; i < HUFF_BENCHMARK_BYTES; i++ )
+	{
+		pick = ( ( (unsigned int)rand() << 15 ) ^ (unsigned int)rand() ) % total;
+
+		for ( j = 0; pick >= (unsigned int)msg_hData[j]; j++ )
+			pick -= msg_hData[j];
+
+		source[i] = j;
+	}
+
+	treeSize = MSG_WriteBitsCompressTree(source, treeOut, HUFF_BENCHMARK_BYTES);
+	tableSize = MSG_WriteBitsCompress(source, tableOut, HUFF_BENCHMARK_BYTES);
+
+	if ( treeSize != tableSize || memcmp(treeOut, tableOut, treeSize) )
+	{
+		Com_Printf("huffBenchmark: table encoder output differs from the tree\n");
+		return;
+	}
+
+	decodedSize = MSG_ReadBitsCompress(treeOut, decoded, treeSize);
+
+	if ( decodedSize < HUFF_BENCHMARK_BYTES || memcmp(decoded, source, HUFF_BENCHMARK_BYTES) )
+	{
+		Com_Printf("huffBenchmark: table decoder does not round-trip\n");
+		return;
+	}
+
+	start = Sys_Milliseconds();
+	for ( i = 0; i < iterations; i++ )
+		MSG_WriteBitsCompressTree(source, treeOut, HUFF_BENCHMARK_BYTES);
+	msec[0] = Sys_Milliseconds() - start;
+
+	start = Sys_Milliseconds();
+	for ( i = 0; i < iterations; i++ )
+		MSG_WriteBitsCompress(source, tableOut, HUFF_BENCHMARK_BYTES);
+	msec[1] = Sys_Milliseconds() - start;
+
+	start = Sys_Milliseconds();
+	for ( i = 0; i < iterations; i++ )
+		MSG_ReadBitsCompressTree(treeOut, decoded, treeSize);
+	msec[2] = Sys_Milliseconds() - start;
+
+	start = Sys_Milliseconds();
+	for ( i = 0; i < iterations; i++ )
+		MSG_ReadBitsCompress(treeOut, decoded, treeSize);
+	msec[3] = Sys_Milliseconds() - start;
+
+	for ( i = 0; i < 4; i++ )
+	{
+		if ( msec[i] < 1 )
+			msec[i] = 1;
+	}
+
+	Com_Printf("%i x %i bytes, %i compressed\n", iterations, HUFF_BENCHMARK_BYTES, treeSize);
+	Com_Printf("encode: tree %.1f MB/s, table %.1f MB/s\n",
+		(float)iterations * HUFF_BENCHMARK_BYTES / msec[0] / 1000.0f, (float)iterations * HUFF_BENCHMARK_BYTES / msec[1] / 1000.0f);
+	Com_Printf("decode: tree %.1f MB/s, table %.1f MB/s\n",
+		(float)iterations * HUFF_BENCHMARK_BYTES / msec[2] / 1000.0f, (float)iterations * HUFF_BENCHMARK_BYTES / msec[3] / 1000.0f);
+}
+
 /*
 ==============
 MSG_Init
@@ -1460,6 +1890,257 @@ void MSG_WriteValueNoXor( msg_t *msg, int value, int bits )
 	}
 }
 
+/*
+=============================================================================
+
+changed field detection
+
+Each netField table gets a layout mapping the dwords of its struct back to
+field indices. A whole-struct compare, done with SSE2 where the CPU has it,
+then yields the changed fields and the last changed index in one pass
+instead of a scalar compare per field.
+
+=============================================================================
+*/
+
+#define MAX_LAYOUT_FIELDS 128
+#define MAX_LAYOUT_WORDS 1024
+
+typedef struct
+{
+	const netField_t *fields;
+	int numFields;
+	int numWords; // 0 when the fields can't be mapped to dwords, compare them one by one
+	short wordField[MAX_LAYOUT_WORDS];
+} netFieldLayout_t;
+
+static netFieldLayout_t msgFieldLayouts[6];
+static int msgNumFieldLayouts;
+static qboolean msgSimdCompare;
+
+#if defined( __GNUC__ ) && ( defined( __i386__ ) || defined( __x86_64__ ) )
+#include <emmintrin.h>
+#define MSG_SIMD_COMPARE
+
+/*
+==============
+MSG_DiffWordsSSE2
+
+Sets a bit in diff for every dword that differs, returns non-zero if any did
+==============
+*/
+__attribute__((target("sse2")))
+static unsigned int MSG_DiffWordsSSE2( const int *from, const int *to, int numWords, unsigned int *diff )
+{
+	unsigned int any;
+	unsigned int mask;
+	int i;
+
+	any = 0;
+
+	for ( i = 0; i + 4 <= numWords; i += 4 )
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)( from + i ));
+		__m128i b = _mm_loadu_si128((const __m128i *)( to + i ));
+
+		mask = ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b))) & 15;
+
+		if ( mask )
+		{
+			diff[i >> 5] |= mask << ( i & 31 );
+			any |= mask;
+		}
+	}
+
+	for ( ; i < numWords; i++ )
+	{
+		if ( from[i] != to[i] )
+		{
+			diff[i >> 5] |= 1u << ( i & 31 );
+			any = 1;
+		}
+	}
+
+	return any;
+}
+#endif
+
+/*
+==============
+MSG_DiffWords
+==============
+*/
+static unsigned int MSG_DiffWords( const int *from, const int *to, int numWords, unsigned int *diff )
+{
+	unsigned int any;
+	int i;
+
+#ifdef MSG_SIMD_COMPARE
+	if ( msgSimdCompare )
+		return MSG_DiffWordsSSE2(from, to, numWords, diff);
+#endif
+
+	any = 0;
+
+	for ( i = 0; i < numWords; i++ )
+	{
+		if ( from[i] != to[i] )
+		{
+			diff[i >> 5] |= 1u << ( i & 31 );
+			any = 1;
+		}
+	}
+
+	return any;
+}
+
+/*
+==============
+MSG_BuildFieldLayout
+==============
+*/
+static void MSG_BuildFieldLayout( const netField_t *fields, int numFields )
+{
+	netFieldLayout_t *layout;
+	int word;
+	int i;
+
+	assert(msgNumFieldLayouts < ARRAY_COUNT(msgFieldLayouts));
+	layout = &msgFieldLayouts[msgNumFieldLayouts++];
+
+	layout->fields = fields;
+	layout->numFields = numFields;
+	layout->numWords = 0;
+
+	if ( numFields > MAX_LAYOUT_FIELDS )
+		return;
+
+	for ( i = 0; i < MAX_LAYOUT_WORDS; i++ )
+		layout->wordField[i] = -1;
+
+	for ( i = 0; i < numFields; i++ )
+	{
+		word = fields[i].offset >> 2;
+
+		if ( ( fields[i].offset & 3 ) || word >= MAX_LAYOUT_WORDS || layout->wordField[word] != -1 )
+			return;
+
+		layout->wordField[word] = i;
+
+		if ( word >= layout->numWords )
+			layout->numWords = word + 1;
+	}
+}
+
+/*
+==============
+MSG_GetChangedFields
+
+Fills changed with one bit per field whose value differs and returns the
+index one past the last changed field, 0 if nothing changed
+==============
+*/
+static int MSG_GetChangedFields( const netField_t *fields, int numFields, const byte *from, const byte *to, unsigned int *changed )
+{
+	const netFieldLayout_t *layout;
+	unsigned int diff[MAX_LAYOUT_WORDS / 32];
+	unsigned int bits;
+	int field;
+	int lc;
+	int i;
+
+	assert(numFields <= MAX_LAYOUT_FIELDS);
+	memset(changed, 0, MAX_LAYOUT_FIELDS / 8);
+	lc = 0;
+
+	for ( i = 0, layout = msgFieldLayouts; i < msgNumFieldLayouts; i++, layout++ )
+	{
+		if ( layout->fields == fields && layout->numFields == numFields )
+			break;
+	}
+
+	if ( i == msgNumFieldLayouts || !layout->numWords )
+	{
+		for ( i = 0; i < numFields; i++ )
+		{
+			if ( *(const int *)( from + fields[i].offset ) != *(const int *)( to + fields[i].offset ) )
+			{
+				changed[i >> 5] |= 1u << ( i & 31 );
+				lc = i + 1;
+			}
+		}
+
+		return lc;
+	}
+
+	memset(diff, 0, ( ( layout->numWords + 31 ) >> 5 ) * sizeof(diff[0]));
+
+	if ( !MSG_DiffWords((const int *)from, (const int *)to, layout->numWords, diff) )
+		return 0;
+
+	for ( i = 0; i < layout->numWords; i += 32 )
+	{
+		for ( bits = diff[i >> 5]; bits; bits &= bits - 1 )
+		{
+			field = layout->wordField[i + __builtin_ctz(bits)];
+
+			if ( field < 0 )
+				continue;
+
+			changed[field >> 5] |= 1u << ( field & 31 );
+
+			if ( field + 1 > lc )
+				lc = field + 1;
+		}
+	}
+
+	return lc;
+}
+
+/*
+==============
+MSG_NextChangedField
+
+Index of the first changed field at or after start, end if there is none
+==============
+*/
+static int MSG_NextChangedField( const unsigned int *changed, int start, int end )
+{
+	unsigned int bits;
+	int i;
+
+	for ( i = start; i < end; i = ( i | 31 ) + 1 )
+	{
+		bits = changed[i >> 5] >> ( i & 31 );
+
+		if ( bits )
+		{
+			i += __builtin_ctz(bits);
+			return i < end ? i : end;
+		}
+	}
+
+	return end;
+}
+
+/*
+==============
+MSG_WriteUnchangedFields
+
+One 0 bit per unchanged field, as MSG_WriteBit0 per field would write
+==============
+*/
+static void MSG_WriteUnchangedFields( msg_t *msg, int count )
+{
+	while ( count > 32 )
+	{
+		MSG_WriteBits(msg, 0, 32);
+		count -= 32;
+	}
+
+	MSG_WriteBits(msg, 0, count);
+}
+
 /*
 ==============
 MSG_WriteDeltaPlayerstate
@@ -1467,9 +2148,10 @@ MSG_WriteDeltaPlayerstate
 */
 void MSG_WriteDeltaPlayerstate( msg_t *msg, playerState_t *from, playerState_t *to, int number )
 {
-	int *fromF, *toF;
+	int *toF;
 	netField_t *field;
 	playerState_t dummy;
+	unsigned int changed[MAX_LAYOUT_FIELDS / 32];
 	int i, j, lc;
 
 	if ( !from )
@@ -1478,29 +2160,19 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, playerState_t *from, playerState_t *
 		memset( &dummy, 0, sizeof( dummy ) );
 	}
 
-	lc = 0;
-	for ( i = 0, field = playerStateFields ; i < ARRAY_COUNT( playerStateFields ) ; i++, field++ )
-	{
-		fromF = ( int * )( (byte *)from + field->offset );
-		toF = ( int * )( (byte *)to + field->offset );
-		if ( *fromF != *toF )
-		{
-			lc = i + 1;
-		}
-	}
+	lc = MSG_GetChangedFields( playerStateFields, ARRAY_COUNT( playerStateFields ), (byte *)from, (byte *)to, changed );
 
 	MSG_WriteByte( msg, lc ); // # of changes
 
-	for ( i = 0, field = playerStateFields ; i < lc ; i++, field++ )
+	for ( i = 0 ; i < lc ; i++ )
 	{
-		fromF = ( int * )( (byte *)from + field->offset );
-		toF = ( int * )( (byte *)to + field->offset );
+		// no change bits up to the next changed field, lc - 1 always is one
+		j = MSG_NextChangedField( changed, i, lc );
+		MSG_WriteUnchangedFields( msg, j - i );
+		i = j;
 
-		if ( *fromF == *toF )
-		{
-			MSG_WriteBit0( msg ); // no change
-			continue;
-		}
+		field = &playerStateFields[i];
+		toF = ( int * )( (byte *)to + field->offset );
 
 		MSG_WriteBit1( msg );  // changed
 
@@ -2127,6 +2799,20 @@ void MSG_WriteDeltaEntity( msg_t *msg, entityState_t *from, entityState_t *to, q
 	MSG_WriteDeltaStruct(msg, (byte *)from, (byte *)to, force, ARRAY_COUNT(entityStateFields), GENTITYNUM_BITS, entityStateFields, qfalse);
 }
 
+/*
+==============
+MSG_EntityStateChanged
+
+True when MSG_WriteDeltaEntity would send any field of to
+==============
+*/
+qboolean MSG_EntityStateChanged( entityState_t *from, entityState_t *to )
+{
+	unsigned int changed[MAX_LAYOUT_FIELDS / 32];
+
+	return MSG_GetChangedFields(entityStateFields, ARRAY_COUNT(entityStateFields), (byte *)from, (byte *)to, changed) != 0;
+}
+
 /*
 ==============
 MSG_ReadDeltaPlayerstate
@@ -2537,6 +3223,28 @@ netField_t hudElemFields[] =
 	{ HEF( foreground ), 1},
 };
 
+/*
+==============
+MSG_InitFieldLayouts
+==============
+*/
+static void MSG_InitFieldLayouts()
+{
+#ifdef MSG_SIMD_COMPARE
+	__builtin_cpu_init();
+	msgSimdCompare = __builtin_cpu_supports("sse2") ? qtrue : qfalse;
+#endif
+
+	msgNumFieldLayouts = 0;
+
+	MSG_BuildFieldLayout(playerStateFields, ARRAY_COUNT(playerStateFields));
+	MSG_BuildFieldLayout(objectiveFields, ARRAY_COUNT(objectiveFields));
+	MSG_BuildFieldLayout(clientStateFields, ARRAY_COUNT(clientStateFields));
+	MSG_BuildFieldLayout(archivedEntityFields, ARRAY_COUNT(archivedEntityFields));
+	MSG_BuildFieldLayout(entityStateFields, ARRAY_COUNT(entityStateFields));
+	MSG_BuildFieldLayout(hudElemFields, ARRAY_COUNT(hudElemFields));
+}
+
 /*
 ==============
 MSG_WriteDeltaHudElems
@@ -2544,7 +3252,7 @@ MSG_WriteDeltaHudElems
 */
 void MSG_WriteDeltaHudElems( msg_t *msg, hudelem_s *from, hudelem_s *to, int count )
 {
-	int *fromF, *toF;
+	unsigned int changed[MAX_LAYOUT_FIELDS / 32];
 	int i, j, inuse, lc;
 	netField_t *field;
 
@@ -2562,16 +3270,11 @@ void MSG_WriteDeltaHudElems( msg_t *msg, hudelem_s *from, hudelem_s *to, int cou
 
 	for ( i = 0; i < inuse; i++ )
 	{
-		lc = 0;
-		for (j = 0, field = hudElemFields; j < ARRAY_COUNT(hudElemFields); j++, field++)
-		{
-			fromF = ( int * )( (byte *)(from + i) + field->offset );
-			toF = ( int * )( (byte *)(to + i) + field->offset );
-			if ( *fromF != *toF )
-			{
-				lc = j;
-			}
-		}
+		// index of the last changed field rather than one past it
+		lc = MSG_GetChangedFields(hudElemFields, ARRAY_COUNT(hudElemFields), (byte *)(from + i), (byte *)(to + i), changed);
+
+		if ( lc )
+			lc--;
 
 		MSG_WriteBits(msg, lc, 5);
 
@@ -2632,7 +3335,7 @@ MSG_WriteDeltaStruct
 */
 void MSG_WriteDeltaStruct( msg_t *msg, byte *from, byte *to, qboolean force, int numFields, int indexBits, const netField_t *stateFields, qboolean bChangeBit )
 {
-	int *fromF, *toF;
+	unsigned int changed[MAX_LAYOUT_FIELDS / 32];
 	int i, lc;
 	const netField_t *field;
 
@@ -2648,16 +3351,7 @@ void MSG_WriteDeltaStruct( msg_t *msg, byte *from, byte *to, qboolean force, int
 		return;
 	}
 
-	lc = 0;
-	for ( i = 0, field = stateFields; i < numFields; i++, field++ )
-	{
-		fromF = ( int * )( (byte *)from + field->offset );
-		toF = ( int * )( (byte *)to + field->offset );
-		if ( *fromF != *toF )
-		{
-			lc = i + 1;
-		}
-	}
+	lc = MSG_GetChangedFields(stateFields, numFields, from, to, changed);
 
 	assert(*reinterpret_cast< unsigned * >( to ) < (1u << indexBits));
 
@@ -2812,4 +3506,138 @@ void MSG_ReadDeltaFields( msg_t *msg, byte *from, byte *to, int numFields, const
 			*toF = *fromF;
 		}
 	}
-}
\ No newline at end of file
+}
+
+/*
+==============
+MSG_BitTest_f
+
+Writes and reads back random values with the widths of every netField
+table, mixed with byte writes and single bits, through both the
+bit-at-a-time and the word-at-a-time paths and compares the results.
+Buffers are kept small so the overflow paths are covered too.
+==============
+*/
+#define MSG_BITTEST_MAXSIZE 512
+
+void MSG_BitTest_f()
+{
+	static const struct
+	{
+		const char *name;
+		const netField_t *fields;
+		int count;
+	} tables[] =
+	{
+		{ "playerState", playerStateFields, ARRAY_COUNT(playerStateFields) },
+		{ "objective", objectiveFields, ARRAY_COUNT(objectiveFields) },
+		{ "clientState", clientStateFields, ARRAY_COUNT(clientStateFields) },
+		{ "archivedEntity", archivedEntityFields, ARRAY_COUNT(archivedEntityFields) },
+		{ "entityState", entityStateFields, ARRAY_COUNT(entityStateFields) },
+		{ "hudElem", hudElemFields, ARRAY_COUNT(hudElemFields) },
+	};
+	byte dataRef[MSG_BITTEST_MAXSIZE];
+	byte dataNew[MSG_BITTEST_MAXSIZE];
+	int widths[MSG_BITTEST_MAXSIZE * 8];
+	int ops[MSG_BITTEST_MAXSIZE * 8];
+	int values[MSG_BITTEST_MAXSIZE * 8];
+	msg_t ref;
+	msg_t cur;
+	int iterations;
+	int failures;
+	int count;
+	int bits;
+	int iter;
+	int t;
+	int i;
+
+	iterations = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 1000;
+	failures = 0;
+
+	for ( t = 0; t < (int)ARRAY_COUNT(tables); t++ )
+	{
+		for ( iter = 0; iter < iterations; iter++ )
+		{
+			MSG_Init(&ref, dataRef, 1 + rand() % MSG_BITTEST_MAXSIZE);
+			MSG_Init(&cur, dataNew, ref.maxsize);
+			memset(dataRef, 0xAA, sizeof(dataRef));
+			memset(dataNew, 0xAA, sizeof(dataNew));
+
+			count = 1 + rand() % ( ARRAY_COUNT(ops) - 1 );
+
+			for ( i = 0; i < count; i++ )
+			{
+				bits = tables[t].fields[rand() % tables[t].count].bits;
+
+				if ( bits == 0 )
+					bits = rand() & 1 ? 32 : 5;
+				else if ( abs(bits) > 32 )
+					bits = rand() % 33;
+				else
+					bits = abs(bits);
+
+				ops[i] = rand() % 8;
+				widths[i] = bits;
+				values[i] = (int)( ( (unsigned int)rand() << 16 ) ^ (unsigned int)rand() );
+
+				switch ( ops[i] )
+				{
+				case 0:
+					MSG_WriteByte(&ref, values[i]);
+					MSG_WriteByte(&cur, values[i]);
+					break;
+				case 1:
+					MSG_WriteBit1(&ref);
+					MSG_WriteBit1(&cur);
+					break;
+				default:
+					MSG_WriteBitsReference(&ref, values[i], bits);
+					MSG_WriteBits(&cur, values[i], bits);
+					break;
+				}
+			}
+
+			if ( ref.cursize != cur.cursize || ref.bit != cur.bit || ref.overflowed != cur.overflowed
+			        || memcmp(dataRef, dataNew, ref.cursize) )
+			{
+				Com_Printf("msgBitTest: %s write mismatch at iteration %i\n", tables[t].name, iter);
+				failures++;
+				continue;
+			}
+
+			MSG_BeginReading(&ref);
+			MSG_BeginReading(&cur);
+
+			// read past the end on purpose so overflow reads are compared as well
+			for ( i = 0; i < count + 4; i++ )
+			{
+				if ( i < count && ops[i] == 0 )
+				{
+					if ( MSG_ReadByte(&ref) != MSG_ReadByte(&cur) )
+						break;
+				}
+				else
+				{
+					bits = i < count ? widths[i] : 32;
+
+					if ( i < count && ops[i] == 1 )
+						bits = 1;
+
+					if ( MSG_ReadBitsReference(&ref, bits) != MSG_ReadBits(&cur, bits) )
+						break;
+				}
+
+				if ( ref.readcount != cur.readcount || ref.bit != cur.bit || ref.overflowed != cur.overflowed )
+					break;
+			}
+
+			if ( i < count + 4 )
+			{
+				Com_Printf("msgBitTest: %s read mismatch at iteration %i\n", tables[t].name, iter);
+				failures++;
+			}
+		}
+	}
+
+	Com_Printf("msgBitTest: %i tables x %i iterations, %i failures\n", ARRAY_COUNT(tables), iterations, failures);
+}
@@ -26,6 +26,7 @@ extern dvar_t *com_logfile;
 extern dvar_t *com_dedicated;
 extern dvar_t *com_viewlog;
 extern dvar_t *com_developer;
+extern dvar_t *com_scriptCompileCache;
 extern dvar_t *cl_paused;
 
 // returnbed by Sys_GetProcessorId
@@ -85,6 +86,10 @@ void Sys_StreamSeek( fileHandle_t f, int offset, int origin );
 void Sys_EndStreamedFile( fileHandle_t f );
 qboolean Sys_DirectoryHasContents(const char *dir);
 void Sys_Mkdir( const char *path );
+void *Sys_MapFile( const char *path, int *length );
+void *Sys_MapFileStream( FILE *f, int *length );
+void Sys_UnmapFile( void *base, int length );
+qboolean Sys_ReplaceFile( const char *from, const char *to );
 char *Sys_Cwd( void );
 void Sys_SetDefaultCDPath(const char *path);
 const char *Sys_DefaultCDPath(void);
@@ -145,6 +150,8 @@ void NET_Shutdown( void );
 void NET_Restart( void );
 void NET_Config( qboolean enableNetworking );
 void NET_Sleep(int msec);
+void NET_BeginSendBatch( void );
+void NET_FlushSendBatch( void );
 
 enum conChannel_t
 {
@@ -292,6 +299,39 @@ typedef struct
 	huff_t decompressor;
 } huffman_t;
 
+#define HUFF_LOOKUP_BITS 11
+
+typedef struct
+{
+	unsigned int code; // first bit sent in bit 0
+	int length;
+} huffCode_t;
+
+typedef struct
+{
+	int symbol;
+	int length;
+	node_t *node; // code is longer than HUFF_LOOKUP_BITS, continue walking from here
+} huffLookup_t;
+
+// flattened form of a huff_t that no longer changes
+typedef struct
+{
+	qboolean valid;
+	huffCode_t codes[HMAX + 1];
+	huffLookup_t lookup[1 << HUFF_LOOKUP_BITS];
+} huffTables_t;
+
+// writes recorded at one bit phase, see MSG_BeginSplice
+typedef struct
+{
+	int phase;
+	int partial;
+	const byte *data;
+	int length;
+	int bit;
+} msgSplice_t;
+
 typedef struct NetField
 {
 	const char *name;
@@ -318,15 +358,21 @@ void Huff_offsetReceive( node_t *node, int *ch, byte *fin, int *offset );
 void Huff_offsetTransmit( huff_t *huff, int ch, byte *fout, int *offset );
 void Huff_putBit( int bit, byte *fout, int *offset );
 int  Huff_getBit( byte *fout, int *offset );
+void Huff_BuildTables( huff_t *huff, huffTables_t *tables );
 
 void MSG_Init( msg_t *buf, byte *data, int length );
 void MSG_BeginReading( msg_t *msg );
+void MSG_BeginSplice( msg_t *scratch, byte *data, int length, const msg_t *msg );
+qboolean MSG_EndSplice( const msg_t *scratch, int phase, msgSplice_t *splice );
+qboolean MSG_WriteSplice( msg_t *msg, const msgSplice_t *splice );
 void MSG_WriteBits( msg_t *msg, int value, int bits );
 void MSG_WriteBit0( msg_t* msg );
 void MSG_WriteBit1(msg_t *msg);
 int MSG_ReadBits(msg_t *msg, int bits);
 int MSG_ReadBit(msg_t *msg);
 int MSG_WriteBitsCompress( byte *from, byte *to, int fromSizeBytes );
+void MSG_HuffBenchmark_f();
+void MSG_BitTest_f();
 int MSG_ReadBitsCompress( byte *from, byte *to, int toSizeBytes );
 void MSG_WriteByte( msg_t *msg, int c );
 void MSG_WriteData(msg_t *buf, const void *data, int length);
@@ -346,6 +392,7 @@ void MSG_ReadDeltaUsercmdKey(msg_t *msg, int key, usercmd_t *from, usercmd_t *to
 void MSG_WriteDeltaField( msg_t *msg, byte *from, byte *to, const netField_t *field );
 void MSG_WriteDeltaStruct( msg_t *msg, byte *from, byte *to, qboolean force, int numFields, int indexBits, const netField_t *stateFields, qboolean bChangeBit );
 void MSG_WriteDeltaEntity(msg_t *msg, entityState_t *from, entityState_t *to, qboolean force);
+qboolean MSG_EntityStateChanged(entityState_t *from, entityState_t *to);
 void MSG_WriteDeltaArchivedEntity(msg_t *msg, archivedEntity_t *from, archivedEntity_t *to, int flags);
 void MSG_WriteDeltaClient(msg_t *msg, clientState_t *from, clientState_t *to, qboolean force);
 void MSG_ReadDeltaField( msg_t *msg, byte *from, byte *to, const netField_t *field, qboolean print );
@@ -390,6 +437,8 @@ void Info_Print( const char *s );
 
 const char *GetBspExtension();
 void Com_LoadBsp(const char *filename);
+void Com_PrefetchBsp(const char *filename, const char *iwdPath, long pos);
+void Com_ShutdownBspPrefetch();
 void Com_UnloadBsp();
 void Com_CleanupBsp();
 qboolean Com_IsBspLoaded();
@@ -429,6 +478,7 @@ byte* Com_GetBspLump(int type, int elemSize, int *count);
 bool Com_BspHasLump(int type);
 void CM_LoadMapFromBsp(const char *name, bool usePvs);
 void CM_LoadMap(const char *name, int *checksum);
+void CM_SetLoadThreads(int numThreads);
 void CM_LoadStaticModels();
 void CM_Cleanup(void);
 void CM_Shutdown();
@@ -239,4 +239,170 @@ void Sys_SleepMSec(int msec)
 	ts.tv_nsec = (msec % 1000) * 1000000;
 	nanosleep(&ts, NULL);
 }
-#endif
\ No newline at end of file
+#endif
+
+/*
+==================
+Worker threads
+
+A small fixed pool used to split independent per-item work (one index per
+item) across cores. The calling thread always takes part, so numThreads
+counts the caller. Jobs must not call Com_Error or touch the VM.
+==================
+*/
+typedef struct
+{
+	workerJob_t job;
+	void *data;
+	int count;
+	volatile int nextIndex;
+} workerBatch_t;
+
+static workerBatch_t workerBatch;
+static semaphore_t workerStart;
+static semaphore_t workerDone;
+static int workerThreadCount;
+
+#ifdef _WIN32
+void Sys_SemaphoreInit( semaphore_t *sem )
+{
+	*sem = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+}
+
+void Sys_SemaphoreWait( semaphore_t *sem )
+{
+	WaitForSingleObject(*sem, INFINITE);
+}
+
+void Sys_SemaphorePost( semaphore_t *sem )
+{
+	ReleaseSemaphore(*sem, 1, NULL);
+}
+#else
+void Sys_SemaphoreInit( semaphore_t *sem )
+{
+	sem_init(sem, 0, 0);
+}
+
+void Sys_SemaphoreWait( semaphore_t *sem )
+{
+	while ( sem_wait(sem) == -1 && errno == EINTR )
+		;
+}
+
+void Sys_SemaphorePost( semaphore_t *sem )
+{
+	sem_post(sem);
+}
+#endif
+
+static void Sys_ProcessWorkerBatch( workerBatch_t *batch )
+{
+	int index;
+
+	while ( 1 )
+	{
+		index = __sync_fetch_and_add(&batch->nextIndex, 1);
+
+		if ( index >= batch->count )
+			break;
+
+		batch->job(batch->data, index);
+	}
+}
+
+static void* Sys_WorkerThreadMain( void *arg )
+{
+	while ( 1 )
+	{
+		Sys_SemaphoreWait(&workerStart);
+		Sys_ProcessWorkerBatch(&workerBatch);
+		Sys_SemaphorePost(&workerDone);
+	}
+
+	return NULL;
+}
+
+/*
+==================
+Sys_InitWorkerThreads
+
+Grows the pool to count threads; never shrinks it
+==================
+*/
+qboolean Sys_InitWorkerThreads( int count )
+{
+	threadid_t tid;
+
+	assert(Sys_IsMainThread());
+
+	if ( count > MAX_WORKER_THREADS )
+		count = MAX_WORKER_THREADS;
+
+	if ( !workerThreadCount && count > 0 )
+	{
+		Sys_SemaphoreInit(&workerStart);
+		Sys_SemaphoreInit(&workerDone);
+	}
+
+	while ( workerThreadCount < count )
+	{
+		if ( !Sys_CreateNewThread(Sys_WorkerThreadMain, &tid, NULL) )
+			return qfalse;
+
+		workerThreadCount++;
+	}
+
+	return qtrue;
+}
+
+/*
+==================
+Sys_GetWorkerThreadCount
+==================
+*/
+int Sys_GetWorkerThreadCount()
+{
+	return workerThreadCount;
+}
+
+/*
+==================
+Sys_RunWorkerJobs
+
+Runs job(data, 0 .. count - 1) on the caller plus up to numThreads - 1
+pool threads and returns once every index has been processed
+==================
+*/
+void Sys_RunWorkerJobs( workerJob_t job, void *data, int count, int numThreads )
+{
+	int i;
+	int helpers;
+
+	assert(Sys_IsMainThread());
+
+	helpers = numThreads - 1;
+
+	if ( helpers > workerThreadCount )
+		helpers = workerThreadCount;
+
+	if ( helpers > count - 1 )
+		helpers = count - 1;
+
+	workerBatch.job = job;
+	workerBatch.data = data;
+	workerBatch.count = count;
+	workerBatch.nextIndex = 0;
+
+	for ( i = 0; i < helpers; i++ )
+	{
+		Sys_SemaphorePost(&workerStart);
+	}
+
+	Sys_ProcessWorkerBatch(&workerBatch);
+
+	for ( i = 0; i < helpers; i++ )
+	{
+		Sys_SemaphoreWait(&workerDone);
+	}
+}
@@ -7,14 +7,17 @@
 #include <windows.h>
 #else
 #include <pthread.h>
+#include <semaphore.h>
 #endif
 
 #ifdef _WIN32
 typedef DWORD threadid_t;
 typedef HANDLE mutex_t;
+typedef HANDLE semaphore_t;
 #else
 typedef pthread_t threadid_t;
 typedef pthread_mutex_t mutex_t;
+typedef sem_t semaphore_t;
 #endif
 
 #include "cm_local.h"
@@ -23,6 +26,8 @@ typedef pthread_mutex_t mutex_t;
 #define MAX_KEYS 3
 #define MAX_VASTRINGS 2
 
+#define MAX_WORKER_THREADS 16
+
 #define THREAD_CONTEXT_MAIN 0
 #define THREAD_CONTEXT_DATABASE 1
 
@@ -66,4 +71,14 @@ void Sys_LeaveCriticalSection(int section);
 
 qboolean Sys_CreateNewThread(void* (*ThreadMain)(void*), threadid_t *tid, void* arg);
 void Sys_ExitThread(int code);
-void Sys_SleepMSec(int msec);
\ No newline at end of file
+void Sys_SleepMSec(int msec);
+
+void Sys_SemaphoreInit(semaphore_t *sem);
+void Sys_SemaphoreWait(semaphore_t *sem);
+void Sys_SemaphorePost(semaphore_t *sem);
+
+typedef void (*workerJob_t)(void *data, int index);
+
+qboolean Sys_InitWorkerThreads(int count);
+int Sys_GetWorkerThreadCount();
+void Sys_RunWorkerJobs(workerJob_t job, void *data, int count, int numThreads);
\ No newline at end of file
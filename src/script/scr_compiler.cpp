@@ -70,6 +70,207 @@ static_assert((sizeof(scrCompileGlob_t) == 0x1DC), "ERROR: scrCompileGlob_t size
 
 scrCompileGlob_t scrCompileGlob;
 
+/*
+==============
+COMPILED SCRIPT CACHE
+
+With com_scriptCompileCache set the code emitted for every script is kept
+across map changes, together with a fixup for each place where it depends on
+state that is rebuilt for every load: string list handles, canonical string
+indices, builtin function indices, thread and call positions, animations and
+switch tables. A script whose source is unchanged is then restored by copying
+its code and applying the fixups instead of being parsed and compiled again
+==============
+*/
+enum
+{
+	FIXUP_INCLUDE,
+	FIXUP_USINGTREE,
+	FIXUP_SPECIFY_THREAD,
+	FIXUP_THREAD,
+	FIXUP_BUILTIN_CHECK,
+	FIXUP_CANONICAL_STRING,
+	FIXUP_STRING,
+	FIXUP_BUILTIN,
+	FIXUP_FUNCTION,
+	FIXUP_ANIMATION,
+	FIXUP_ANIMTREE,
+	FIXUP_CASE_STRING,
+	FIXUP_SWITCH,
+};
+
+struct CompiledScriptFixup
+{
+	byte type;
+	bool developer;
+	bool farFunction;
+	unsigned int offset;
+	unsigned int sourcePos;
+	unsigned int name;
+	unsigned int nameLen;
+	unsigned int fileName;
+	intptr_t value;
+};
+
+struct CompiledScript
+{
+	char *filename;
+	bool developer_script;
+	unsigned int sourceChecksum;
+	int sourceLen;
+	const char *source;
+	const char *code;
+	int codeLen;
+	intptr_t codeStart;
+	CompiledScriptFixup *fixups;
+	int fixupCount;
+	const char *names;
+	unsigned int checksumScale;
+	unsigned int checksumOffset;
+	CompiledScript *next;
+};
+
+struct CompiledScriptBuffer
+{
+	char *data;
+	int len;
+	int maxLen;
+};
+
+#define COMPILED_SCRIPT_HASH_SIZE 256
+
+typedef struct scrCompileCacheGlob_s
+{
+	CompiledScript *hashTable[COMPILED_SCRIPT_HASH_SIZE];
+	const char *filename;
+	const char *source;
+	int sourceLen;
+	unsigned int sourceChecksum;
+	bool recording;
+	char *codeStart;
+	unsigned int checksumStart;
+	unsigned int checksumScale;
+	CompiledScriptBuffer fixups;
+	CompiledScriptBuffer names;
+	CompiledScriptBuffer fileThreads;
+	int scriptCount;
+} scrCompileCacheGlob_t;
+
+static scrCompileCacheGlob_t scrCompileCacheGlob;
+
+static void* AllocCompiledScriptBuffer(CompiledScriptBuffer *buffer, int size)
+{
+	char *data;
+
+	if ( buffer->len + size > buffer->maxLen )
+	{
+		if ( !buffer->maxLen )
+			buffer->maxLen = 4096;
+
+		while ( buffer->len + size > buffer->maxLen )
+			buffer->maxLen *= 2;
+
+		data = (char *)Z_MallocInternal(buffer->maxLen);
+
+		if ( buffer->data )
+		{
+			memcpy(data, buffer->data, buffer->len);
+			Z_FreeInternal(buffer->data);
+		}
+
+		buffer->data = data;
+	}
+
+	data = &buffer->data[buffer->len];
+	buffer->len += size;
+
+	return data;
+}
+
+static unsigned int AddCompiledScriptName(unsigned int name)
+{
+	unsigned int offset;
+	int len;
+
+	len = SL_GetStringLen(name) + 1;
+	offset = scrCompileCacheGlob.names.len;
+	memcpy(AllocCompiledScriptBuffer(&scrCompileCacheGlob.names, len), SL_ConvertToString(name), len);
+
+	return offset;
+}
+
+static CompiledScriptFixup* AddCompiledScriptFixup(int type, const char *pos, unsigned int name, unsigned int sourcePos, intptr_t value)
+{
+	CompiledScriptFixup *fixup;
+
+	if ( !scrCompileCacheGlob.recording || scrCompilePub.developer_statement == 2 )
+		return NULL;
+
+	fixup = (CompiledScriptFixup *)AllocCompiledScriptBuffer(&scrCompileCacheGlob.fixups, sizeof(CompiledScriptFixup));
+	fixup->type = type;
+	fixup->developer = scrCompilePub.developer_statement != 0;
+	fixup->farFunction = 0;
+	fixup->offset = pos - scrCompileCacheGlob.codeStart;
+	fixup->sourcePos = sourcePos;
+	fixup->name = 0;
+	fixup->nameLen = 0;
+	fixup->fileName = 0;
+	fixup->value = value;
+
+	if ( name )
+	{
+		fixup->nameLen = SL_GetStringLen(name) + 1;
+		fixup->name = AddCompiledScriptName(name);
+	}
+
+	return fixup;
+}
+
+/*
+ * Names that other scripts referenced in this one before it was compiled
+ * decide whether a call is a builtin or a script function, see Scr_GetBuiltin
+ */
+static bool IsCompiledScriptFileThread(unsigned int name)
+{
+	unsigned int *threads;
+	int count;
+	int i;
+
+	threads = (unsigned int *)scrCompileCacheGlob.fileThreads.data;
+	count = scrCompileCacheGlob.fileThreads.len / sizeof(unsigned int);
+
+	for ( i = 0; i < count; ++i )
+	{
+		if ( threads[i] == name )
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Case names are string list handles or, for integer cases, internal
+ * variable indices that lie above every handle, see EmitCaseStatement
+ */
+static void AddCompiledScriptSwitch(char *table, int count)
+{
+	intptr_t name;
+	int i;
+
+	if ( !scrCompileCacheGlob.recording )
+		return;
+
+	for ( i = 0; i < count; ++i )
+	{
+		name = *(intptr_t *)&table[i * sizeof(intptr_t) * 2];
+
+		if ( name && name < (intptr_t)GetInternalVariableIndex(0) )
+			AddCompiledScriptFixup(FIXUP_CASE_STRING, &table[i * sizeof(intptr_t) * 2], name, 0, 0);
+	}
+
+	AddCompiledScriptFixup(FIXUP_SWITCH, table, 0, 0, count);
+}
+
 int GetExpressionCount(sval_u exprlist)
 {
 	int expr_count;
@@ -105,6 +306,7 @@ void EmitCanonicalString(unsigned int stringValue)
 			SL_AddRefToString(stringValue);
 
 		pos = scrCompileGlob.codePos;
+		AddCompiledScriptFixup(FIXUP_CANONICAL_STRING, pos, stringValue, 0, 0);
 		*(uint16_t *)pos = Scr_GetCanonicalStringIndex(stringValue);
 	}
 }
@@ -193,6 +395,7 @@ void EmitGetString(unsigned int value, sval_u sourcePos)
 	EmitOpcode(OP_GetString, 1, CALL_NONE);
 	AddOpcodePos(sourcePos.sourcePosValue, SOURCE_TYPE_BREAKPOINT);
 	EmitShort(value);
+	AddCompiledScriptFixup(FIXUP_STRING, scrCompileGlob.codePos, value, 0, 0);
 	CompileTransferRefToString(value, 1);
 }
 
@@ -201,6 +404,7 @@ void EmitGetIString(unsigned int value, sval_u sourcePos)
 	EmitOpcode(OP_GetIString, 1, CALL_NONE);
 	AddOpcodePos(sourcePos.sourcePosValue, SOURCE_TYPE_BREAKPOINT);
 	EmitShort(value);
+	AddCompiledScriptFixup(FIXUP_STRING, scrCompileGlob.codePos, value, 0, 0);
 	CompileTransferRefToString(value, 1);
 }
 
@@ -340,6 +544,7 @@ void EmitOpcode(unsigned int op, int offset, int callType)
 
 	scrVarPub.checksum *= 31;
 	scrVarPub.checksum += op;
+	scrCompileCacheGlob.checksumScale *= 31;
 
 	if ( scrCompilePub.opcodePos )
 	{
@@ -585,6 +790,7 @@ void EmitInclude(sval_u val)
 	unsigned int filename;
 
 	filename = Scr_CreateCanonicalFilename(SL_ConvertToString(val.node[1].stringValue));
+	AddCompiledScriptFixup(FIXUP_INCLUDE, (char *)TempMalloc(0), val.node[1].stringValue, val.node[2].sourcePosValue, 0);
 	Scr_CompileRemoveRefToString(val.node[1].stringValue);
 	AddFilePrecache(filename, val.node[2].sourcePosValue, 1);
 }
@@ -671,6 +877,7 @@ void SpecifyThread(sval_u val)
 			type = VAR_CODEPOS;
 
 		SpecifyThreadPosition(posId, val.node[1].sourcePosValue, val.node[4].sourcePosValue, type);
+		AddCompiledScriptFixup(FIXUP_SPECIFY_THREAD, (char *)TempMalloc(0), val.node[1].stringValue, val.node[4].sourcePosValue, type);
 	}
 }
 
@@ -1582,6 +1789,7 @@ unsigned int Scr_GetBuiltin(sval_u func_name)
 {
 	sval_u *func_namea;
 	sval_u *func_nameb;
+	unsigned int name;
 
 	if ( func_name.node->type != ENUM_script_call )
 		return 0;
@@ -1596,10 +1804,15 @@ unsigned int Scr_GetBuiltin(sval_u func_name)
 	if ( func_nameb->type != ENUM_local_function )
 		return 0;
 
-	if ( FindVariable(scrCompileGlob.filePosId, func_nameb[1].idValue) )
+	name = func_nameb[1].idValue;
+
+	if ( scrCompileCacheGlob.recording )
+		AddCompiledScriptFixup(FIXUP_BUILTIN_CHECK, (char *)TempMalloc(0), name, 0, IsCompiledScriptFileThread(name));
+
+	if ( FindVariable(scrCompileGlob.filePosId, name) )
 		return 0;
 
-	return func_nameb[1].idValue;
+	return name;
 }
 
 int Scr_FindLocalVarIndex(unsigned int name, sval_u sourcePos, bool create, scr_block_s *block)
@@ -1773,6 +1986,7 @@ void EmitAnimation(sval_u anim, sval_u sourcePos)
 	EmitOpcode(OP_GetAnimation, 1, CALL_NONE);
 	AddOpcodePos(sourcePos.sourcePosValue, SOURCE_TYPE_BREAKPOINT);
 	EmitCodepos((const char *)0xFFFFFFFF);
+	AddCompiledScriptFixup(FIXUP_ANIMATION, scrCompileGlob.codePos, anim.stringValue, sourcePos.sourcePosValue, 0);
 	Scr_EmitAnimation(scrCompileGlob.codePos, anim.stringValue, sourcePos.sourcePosValue);
 	Scr_CompileRemoveRefToString(anim.stringValue);
 }
@@ -1786,7 +2000,10 @@ void EmitCastBool(sval_u sourcePos)
 void EmitAnimTree(sval_u sourcePos)
 {
 	if ( scrAnimPub.animTreeIndex )
+	{
 		EmitGetInteger(scrAnimPub.animTreeIndex, sourcePos);
+		AddCompiledScriptFixup(FIXUP_ANIMTREE, scrCompileGlob.codePos, 0, 0, 0);
+	}
 	else
 		CompileError(sourcePos.sourcePosValue, "#using_animtree was not specified");
 }
@@ -2472,8 +2689,10 @@ void EmitRemoveLocalVars(scr_block_s *block, scr_block_s *outerBlock)
 void EmitNOP2(bool lastStatement, unsigned int endSourcePos, scr_block_s *block)
 {
 	unsigned int checksum;
+	unsigned int checksumScale;
 
 	checksum = scrVarPub.checksum;
+	checksumScale = scrCompileCacheGlob.checksumScale;
 
 	if ( lastStatement )
 	{
@@ -2486,6 +2705,7 @@ void EmitNOP2(bool lastStatement, unsigned int endSourcePos, scr_block_s *block)
 	}
 
 	scrVarPub.checksum = checksum + 1;
+	scrCompileCacheGlob.checksumScale = checksumScale;
 }
 
 void EmitIfStatement(sval_u expr, sval_u stmt, sval_u sourcePos, bool lastStatement, unsigned int endSourcePos, scr_block_s *block, sval_u *ifStatBlock)
@@ -2928,6 +3148,7 @@ void EmitIfElseStatement(sval_u expr, sval_u stmt1, sval_u stmt2, sval_u sourceP
 	int childCount;
 	scr_block_s *childBlocks[2];
 	unsigned int checksum;
+	unsigned int checksumScale;
 	char *nextPos;
 	char *pos1;
 	char *pos2;
@@ -2951,6 +3172,7 @@ void EmitIfElseStatement(sval_u expr, sval_u stmt1, sval_u stmt2, sval_u sourceP
 	}
 
 	checksum = scrVarPub.checksum;
+	checksumScale = scrCompileCacheGlob.checksumScale;
 
 	if ( lastStatement )
 	{
@@ -2970,6 +3192,7 @@ void EmitIfElseStatement(sval_u expr, sval_u stmt1, sval_u stmt2, sval_u sourceP
 	}
 
 	scrVarPub.checksum = checksum + 1;
+	scrCompileCacheGlob.checksumScale = checksumScale;
 	*(uint16_t *)codePos = (intptr_t)TempMalloc(0) - (intptr_t)pos1;
 	Scr_TransferBlock(block, elseStatBlock->block);
 	EmitStatement(stmt2, lastStatement, endSourcePos, elseStatBlock->block);
@@ -3137,6 +3360,7 @@ void EmitSwitchStatement(sval_u expr, sval_u stmtlist, sval_u sourcePos, bool la
 
 	*(uint16_t *)pos2 = num;
 	qsort(pos3, num, sizeof(intptr_t) * sizeof(uint16_t), CompareCaseInfo);
+	AddCompiledScriptSwitch(pos3, num);
 
 	while ( num > 1 )
 	{
@@ -3347,6 +3571,7 @@ void EmitDeveloperStatementList(sval_u val, sval_u sourcePos, scr_block_s *block
 {
 	char *savedPos;
 	unsigned int savedChecksum;
+	unsigned int savedChecksumScale;
 
 	if ( scrCompilePub.developer_statement )
 	{
@@ -3355,6 +3580,7 @@ void EmitDeveloperStatementList(sval_u val, sval_u sourcePos, scr_block_s *block
 	else
 	{
 		savedChecksum = scrVarPub.checksum;
+		savedChecksumScale = scrCompileCacheGlob.checksumScale;
 		Scr_TransferBlock(block, devStatBlock->block);
 
 		if ( scrVarPub.developer_script )
@@ -3373,6 +3599,7 @@ void EmitDeveloperStatementList(sval_u val, sval_u sourcePos, scr_block_s *block
 
 		scrCompilePub.developer_statement = 0;
 		scrVarPub.checksum = savedChecksum;
+		scrCompileCacheGlob.checksumScale = savedChecksumScale;
 	}
 }
 
@@ -3747,6 +3974,7 @@ void EmitCall(sval_u func_name, sval_u params, bool bStatement, scr_block_s *blo
 				EmitCallBuiltinOpcode(param_count, sourcePos);
 				newFuncIndex = AddFunction((intptr_t)func);
 				EmitShort(newFuncIndex);
+				AddCompiledScriptFixup(FIXUP_BUILTIN, scrCompileGlob.codePos, 0, 0, (intptr_t)func);
 				AddExpressionListOpcodePos(params);
 
 				if ( bStatement )
@@ -3773,12 +4001,10 @@ script_function:
 	}
 }
 
-void EmitFunction(sval_u func, sval_u sourcePos)
+void EmitFunctionPos(unsigned int filename, unsigned int funcName, unsigned int sourcePos)
 {
-	const char *funcName;
 	int scope;
 	bool bExists;
-	unsigned int name;
 	unsigned int fileId;
 	unsigned int id;
 	unsigned int countId;
@@ -3788,54 +4014,38 @@ void EmitFunction(sval_u func, sval_u sourcePos)
 	VariableValue value;
 	VariableValue count;
 
-	if ( scrCompilePub.developer_statement == 2 )
-	{
-		Scr_CompileRemoveRefToString(func.node[1].stringValue);
-
-		if ( func.node->type == ENUM_far_function )
-		{
-			Scr_CompileRemoveRefToString(func.node[2].stringValue);
-			--scrCompilePub.far_function_count;
-		}
-
-		return;
-	}
-
 	threadId = 0;
 
-	if ( func.node->type == ENUM_local_function )
+	if ( !filename )
 	{
 		scope = 0;
-		threadName = GetVariable(scrCompileGlob.filePosId, func.node[1].idValue);
-		CompileTransferRefToString(func.node[1].stringValue, 2u);
+		threadName = GetVariable(scrCompileGlob.filePosId, funcName);
+		CompileTransferRefToString(funcName, 2u);
 		threadId = GetObjectA(threadName);
 	}
 	else
 	{
 		scope = 1;
-		funcName = SL_ConvertToString(func.node[1].stringValue);
-		name = Scr_CreateCanonicalFilename(funcName);
-		Scr_CompileRemoveRefToString(func.node[1].stringValue);
-		Scr_EvalVariable(&value, FindVariable(scrCompilePub.loadedscripts, name));
+		Scr_EvalVariable(&value, FindVariable(scrCompilePub.loadedscripts, filename));
 		bExists = value.type != VAR_UNDEFINED;
-		fileId = AddFilePrecache(name, sourcePos.sourcePosValue, 0);
+		fileId = AddFilePrecache(filename, sourcePos, 0);
 
 		if ( bExists )
 		{
-			threadName = FindVariable(fileId, func.node[2].idValue);
+			threadName = FindVariable(fileId, funcName);
 
 			if ( !threadName || Scr_GetObjectType(threadName) != VAR_OBJECT )
 			{
-				CompileError(sourcePos.sourcePosValue, "unknown function");
+				CompileError(sourcePos, "unknown function");
 				return;
 			}
 		}
 		else
 		{
-			threadName = GetVariable(fileId, func.node[2].idValue);
+			threadName = GetVariable(fileId, funcName);
 		}
 
-		CompileTransferRefToString(func.node[2].stringValue, 2u);
+		CompileTransferRefToString(funcName, 2u);
 		threadId = GetObjectA(threadName);
 		posId = FindVariable(threadId, 1u);
 
@@ -3845,7 +4055,7 @@ void EmitFunction(sval_u func, sval_u sourcePos)
 
 			if ( value.type == VAR_INCLUDE_CODEPOS )
 			{
-				CompileError(sourcePos.sourcePosValue, "unknown function");
+				CompileError(sourcePos, "unknown function");
 				return;
 			}
 
@@ -3854,7 +4064,7 @@ void EmitFunction(sval_u func, sval_u sourcePos)
 				if ( value.type == VAR_CODEPOS || scrCompilePub.developer_statement )
 					EmitCodepos(value.u.codePosValue);
 				else
-					CompileError(sourcePos.sourcePosValue, "normal script cannot reference a function in a /# ... #/ comment");
+					CompileError(sourcePos, "normal script cannot reference a function in a /# ... #/ comment");
 
 				return;
 			}
@@ -3882,7 +4092,48 @@ void EmitFunction(sval_u func, sval_u sourcePos)
 	SetNewVariableValue(id, &value);
 	++count.u.intValue;
 	SetVariableValue(countId, &count);
-	AddOpcodePos(sourcePos.sourcePosValue, SOURCE_TYPE_NONE);
+	AddOpcodePos(sourcePos, SOURCE_TYPE_NONE);
+}
+
+void EmitFunction(sval_u func, sval_u sourcePos)
+{
+	const char *funcName;
+	unsigned int name;
+	CompiledScriptFixup *fixup;
+
+	if ( scrCompilePub.developer_statement == 2 )
+	{
+		Scr_CompileRemoveRefToString(func.node[1].stringValue);
+
+		if ( func.node->type == ENUM_far_function )
+		{
+			Scr_CompileRemoveRefToString(func.node[2].stringValue);
+			--scrCompilePub.far_function_count;
+		}
+
+		return;
+	}
+
+	if ( func.node->type == ENUM_local_function )
+	{
+		AddCompiledScriptFixup(FIXUP_FUNCTION, (char *)TempMalloc(0), func.node[1].stringValue, sourcePos.sourcePosValue, 0);
+		EmitFunctionPos(0, func.node[1].stringValue, sourcePos.sourcePosValue);
+	}
+	else
+	{
+		fixup = AddCompiledScriptFixup(FIXUP_FUNCTION, (char *)TempMalloc(0), func.node[2].stringValue, sourcePos.sourcePosValue, 0);
+
+		if ( fixup )
+		{
+			fixup->farFunction = 1;
+			fixup->fileName = AddCompiledScriptName(func.node[1].stringValue);
+		}
+
+		funcName = SL_ConvertToString(func.node[1].stringValue);
+		name = Scr_CreateCanonicalFilename(funcName);
+		Scr_CompileRemoveRefToString(func.node[1].stringValue);
+		EmitFunctionPos(name, func.node[2].stringValue, sourcePos.sourcePosValue);
+	}
 }
 
 void EmitMethod(sval_u expr, sval_u func_name, sval_u params, sval_u methodSourcePos, bool bStatement, scr_block_s *block)
@@ -3942,6 +4193,7 @@ void EmitMethod(sval_u expr, sval_u func_name, sval_u params, sval_u methodSourc
 				EmitCallBuiltinMethodOpcode(param_count, sourcePos);
 				newMethIndex = AddFunction((intptr_t)meth);
 				EmitShort(newMethIndex);
+				AddCompiledScriptFixup(FIXUP_BUILTIN, scrCompileGlob.codePos, 0, 0, (intptr_t)meth);
 				AddOpcodePos(methodSourcePos.sourcePosValue, SOURCE_TYPE_NONE);
 				AddExpressionListOpcodePos(params);
 
@@ -4030,6 +4282,7 @@ void EmitNormalThread(sval_u val, sval_u *stmttblock)
 	posId = FindVariable(scrCompileGlob.filePosId, val.node[1].sourcePosValue);
 	threadId = FindObject(posId);
 	SetThreadPosition(threadId);
+	AddCompiledScriptFixup(FIXUP_THREAD, (char *)TempMalloc(0), val.node[1].stringValue, 0, 0);
 	EmitThreadInternal(threadId, val, val.node[4], val.node[5], stmttblock->block);
 }
 
@@ -4039,6 +4292,7 @@ void EmitDeveloperThread(sval_u val, sval_u *stmttblock)
 	char *pos;
 	unsigned int threadId;
 	unsigned int checksum;
+	unsigned int checksumScale;
 
 	if ( scrVarPub.developer_script )
 	{
@@ -4047,17 +4301,20 @@ void EmitDeveloperThread(sval_u val, sval_u *stmttblock)
 		posId = FindVariable(scrCompileGlob.filePosId, val.node[1].sourcePosValue);
 		threadId = FindObject(posId);
 		SetThreadPosition(threadId);
+		AddCompiledScriptFixup(FIXUP_THREAD, (char *)TempMalloc(0), val.node[1].stringValue, 0, 0);
 		EmitThreadInternal(threadId, val, val.node[4], val.node[5], stmttblock->block);
 	}
 	else
 	{
 		pos = (char *)TempMalloc(0);
 		checksum = scrVarPub.checksum;
+		checksumScale = scrCompileCacheGlob.checksumScale;
 		scrCompilePub.developer_statement = 2;
 		InitThread(1);
 		EmitThreadInternal(0, val, val.node[4], val.node[5], stmttblock->block);
 		TempMemorySetPos(pos);
 		scrVarPub.checksum = checksum;
+		scrCompileCacheGlob.checksumScale = checksumScale;
 	}
 
 	scrCompilePub.developer_statement = 0;
@@ -4084,6 +4341,7 @@ void EmitThread(sval_u val)
 			else
 			{
 				Scr_UsingTree(SL_ConvertToString(val.node[1].stringValue), val.node[3].sourcePosValue);
+				AddCompiledScriptFixup(FIXUP_USINGTREE, (char *)TempMalloc(0), val.node[1].stringValue, val.node[3].sourcePosValue, 0);
 				Scr_CompileRemoveRefToString(val.node[1].stringValue);
 			}
 		}
@@ -4119,25 +4377,9 @@ void EmitThreadList(sval_u val)
 		EmitThread(node2[0]);
 }
 
-void ScriptCompile(sval_u val, unsigned int filePosId, unsigned int scriptId)
+PrecacheEntry* InitScriptCompile(unsigned int filePosId)
 {
-	VariableValueInternal_u *pos;
-	unsigned int includePosId;
-	unsigned int threadCountId;
-	VariableValue includePos;
-	unsigned int index;
-	unsigned short name;
-	VariableValue value;
-	unsigned int posId;
-	unsigned int id;
-	unsigned int includeFilePosId;
-	PrecacheEntry *precachescript;
-	PrecacheEntry *precachescript2;
 	PrecacheEntry *precachescriptList;
-	unsigned short filename;
-	int func_count;
-	int j;
-	int i;
 
 	scrCompileGlob.filePosId = filePosId;
 	scrCompileGlob.bConstRefCount = 0;
@@ -4157,10 +4399,28 @@ void ScriptCompile(sval_u val, unsigned int filePosId, unsigned int scriptId)
 		scrCompileGlob.precachescriptListHead = precachescriptList;
 	}
 
-	EmitIncludeList(val.node[0]);
-	EmitThreadList(val.node[1]);
-	scrCompilePub.programLen = (char *)TempMalloc(0) - scrVarPub.programBuffer;
-	Hunk_ClearTempMemoryHighInternal();
+	return precachescriptList;
+}
+
+void LinkScript(unsigned int filePosId, unsigned int scriptId, PrecacheEntry *precachescriptList)
+{
+	VariableValueInternal_u *pos;
+	unsigned int includePosId;
+	unsigned int threadCountId;
+	VariableValue includePos;
+	unsigned int index;
+	unsigned short name;
+	VariableValue value;
+	unsigned int posId;
+	unsigned int id;
+	unsigned int includeFilePosId;
+	PrecacheEntry *precachescript;
+	PrecacheEntry *precachescript2;
+	unsigned short filename;
+	int func_count;
+	int j;
+	int i;
+
 	func_count = scrCompilePub.far_function_count;
 
 	for ( i = 0; i < func_count; ++i )
@@ -4232,6 +4492,349 @@ void ScriptCompile(sval_u val, unsigned int filePosId, unsigned int scriptId)
 	SetVariableValue(scriptId, &value);
 }
 
+static unsigned int HashCompiledScriptName(const char *filename)
+{
+	unsigned int hash;
+
+	for ( hash = 0; *filename; filename++ )
+		hash = hash * 31 + (unsigned char)*filename;
+
+	return hash & (COMPILED_SCRIPT_HASH_SIZE - 1);
+}
+
+static CompiledScript** FindCompiledScript(const char *filename)
+{
+	CompiledScript **script;
+
+	for ( script = &scrCompileCacheGlob.hashTable[HashCompiledScriptName(filename)]; *script; script = &(*script)->next )
+	{
+		if ( !strcmp((*script)->filename, filename) )
+			break;
+	}
+
+	return script;
+}
+
+static void Scr_ClearCompiledScripts()
+{
+	CompiledScript *script;
+	CompiledScript *next;
+	int i;
+
+	for ( i = 0; i < COMPILED_SCRIPT_HASH_SIZE; i++ )
+	{
+		for ( script = scrCompileCacheGlob.hashTable[i]; script; script = next )
+		{
+			next = script->next;
+			Z_FreeInternal(script);
+		}
+
+		scrCompileCacheGlob.hashTable[i] = NULL;
+	}
+
+	scrCompileCacheGlob.scriptCount = 0;
+}
+
+static void BeginCompiledScript(unsigned int filePosId)
+{
+	unsigned int id;
+
+	scrCompileCacheGlob.recording = scrCompileCacheGlob.filename != NULL;
+
+	if ( !scrCompileCacheGlob.recording )
+		return;
+
+	scrCompileCacheGlob.fixups.len = 0;
+	scrCompileCacheGlob.names.len = 0;
+	scrCompileCacheGlob.fileThreads.len = 0;
+
+	for ( id = FindNextSibling(filePosId); id; id = FindNextSibling(id) )
+		*(unsigned int *)AllocCompiledScriptBuffer(&scrCompileCacheGlob.fileThreads, sizeof(unsigned int)) = GetVariableName(id);
+
+	scrCompileCacheGlob.codeStart = (char *)TempMalloc(0);
+	scrCompileCacheGlob.checksumStart = scrVarPub.checksum;
+	scrCompileCacheGlob.checksumScale = 1;
+}
+
+static void EndCompiledScript()
+{
+	CompiledScript **prev;
+	CompiledScript *script;
+	char *data;
+	int codeLen;
+	int filenameLen;
+
+	if ( !scrCompileCacheGlob.recording )
+		return;
+
+	scrCompileCacheGlob.recording = 0;
+	prev = FindCompiledScript(scrCompileCacheGlob.filename);
+
+	if ( *prev )
+	{
+		script = *prev;
+		*prev = script->next;
+		Z_FreeInternal(script);
+		--scrCompileCacheGlob.scriptCount;
+	}
+
+	codeLen = (char *)TempMalloc(0) - scrCompileCacheGlob.codeStart;
+	filenameLen = strlen(scrCompileCacheGlob.filename) + 1;
+	script = (CompiledScript *)Z_MallocInternal(sizeof(CompiledScript) + scrCompileCacheGlob.fixups.len + codeLen
+	         + scrCompileCacheGlob.names.len + scrCompileCacheGlob.sourceLen + filenameLen);
+	data = (char *)(script + 1);
+
+	script->fixups = (CompiledScriptFixup *)data;
+	script->fixupCount = scrCompileCacheGlob.fixups.len / sizeof(CompiledScriptFixup);
+	memcpy(data, scrCompileCacheGlob.fixups.data, scrCompileCacheGlob.fixups.len);
+	data += scrCompileCacheGlob.fixups.len;
+
+	script->code = data;
+	script->codeLen = codeLen;
+	script->codeStart = (intptr_t)scrCompileCacheGlob.codeStart;
+	memcpy(data, scrCompileCacheGlob.codeStart, codeLen);
+	data += codeLen;
+
+	script->names = data;
+	memcpy(data, scrCompileCacheGlob.names.data, scrCompileCacheGlob.names.len);
+	data += scrCompileCacheGlob.names.len;
+
+	script->source = data;
+	script->sourceLen = scrCompileCacheGlob.sourceLen;
+	script->sourceChecksum = scrCompileCacheGlob.sourceChecksum;
+	memcpy(data, scrCompileCacheGlob.source, scrCompileCacheGlob.sourceLen);
+	data += scrCompileCacheGlob.sourceLen;
+
+	script->filename = data;
+	memcpy(data, scrCompileCacheGlob.filename, filenameLen);
+
+	script->developer_script = scrVarPub.developer_script;
+	script->checksumScale = scrCompileCacheGlob.checksumScale;
+	script->checksumOffset = scrVarPub.checksum - scrCompileCacheGlob.checksumScale * scrCompileCacheGlob.checksumStart;
+	script->next = NULL;
+	*prev = script;
+	++scrCompileCacheGlob.scriptCount;
+
+	scrCompileCacheGlob.filename = NULL;
+}
+
+static bool CheckCompiledScriptBuiltins(const CompiledScript *script, unsigned int filePosId)
+{
+	const CompiledScriptFixup *fixup;
+	unsigned int name;
+	bool exists;
+	int i;
+
+	for ( i = 0; i < script->fixupCount; ++i )
+	{
+		fixup = &script->fixups[i];
+
+		if ( fixup->type != FIXUP_BUILTIN_CHECK )
+			continue;
+
+		name = SL_FindStringOfLen(&script->names[fixup->name], fixup->nameLen);
+		exists = name && FindVariable(filePosId, name);
+
+		if ( exists != (fixup->value != 0) )
+			return false;
+	}
+
+	return true;
+}
+
+static int CopyCompiledScriptCode(const CompiledScript *script, int copied, int end)
+{
+	if ( end <= copied )
+		return copied;
+
+	memcpy(TempMalloc(end - copied), &script->code[copied], end - copied);
+	return end;
+}
+
+static void RestoreCompiledScript(const CompiledScript *script, unsigned int filePosId, unsigned int scriptId)
+{
+	PrecacheEntry *precachescriptList;
+	const CompiledScriptFixup *fixup;
+	const char *name;
+	unsigned int stringValue;
+	intptr_t *caseInfo;
+	char *codeStart;
+	char *pos;
+	int copied;
+	int count;
+	int i;
+	int j;
+
+	count = 0;
+
+	for ( i = 0; i < script->fixupCount; ++i )
+	{
+		if ( script->fixups[i].type == FIXUP_INCLUDE || script->fixups[i].farFunction )
+			++count;
+	}
+
+	scrCompilePub.far_function_count = count;
+	precachescriptList = InitScriptCompile(filePosId);
+	scrVarPub.checksum = script->checksumScale * scrVarPub.checksum + script->checksumOffset;
+	codeStart = (char *)TempMalloc(0);
+	copied = 0;
+
+	for ( i = 0; i < script->fixupCount; ++i )
+	{
+		fixup = &script->fixups[i];
+		name = &script->names[fixup->name];
+		pos = &codeStart[fixup->offset];
+
+		switch ( fixup->type )
+		{
+		case FIXUP_INCLUDE:
+			AddFilePrecache(Scr_CreateCanonicalFilename(name), fixup->sourcePos, 1);
+			break;
+
+		case FIXUP_USINGTREE:
+			Scr_UsingTree(name, fixup->sourcePos);
+			break;
+
+		case FIXUP_SPECIFY_THREAD:
+			stringValue = SL_GetStringOfLen(name, 2, fixup->nameLen);
+			SpecifyThreadPosition(GetObjectA(GetVariable(filePosId, stringValue)), stringValue, fixup->sourcePos, fixup->value);
+			break;
+
+		case FIXUP_THREAD:
+			copied = CopyCompiledScriptCode(script, copied, fixup->offset);
+			stringValue = SL_GetStringOfLen(name, 2, fixup->nameLen);
+			SetThreadPosition(FindObject(FindVariable(filePosId, stringValue)));
+			break;
+
+		case FIXUP_CANONICAL_STRING:
+			copied = CopyCompiledScriptCode(script, copied, fixup->offset + sizeof(uint16_t));
+			*(uint16_t *)pos = Scr_GetCanonicalStringIndex(SL_GetStringOfLen(name, 0, fixup->nameLen));
+			break;
+
+		case FIXUP_STRING:
+			copied = CopyCompiledScriptCode(script, copied, fixup->offset + sizeof(short));
+			*(short *)pos = SL_GetStringOfLen(name, 1, fixup->nameLen);
+			break;
+
+		case FIXUP_BUILTIN:
+			copied = CopyCompiledScriptCode(script, copied, fixup->offset + sizeof(short));
+			*(short *)pos = AddFunction(fixup->value);
+			break;
+
+		case FIXUP_FUNCTION:
+			copied = CopyCompiledScriptCode(script, copied, fixup->offset);
+			scrCompilePub.developer_statement = fixup->developer;
+			stringValue = SL_GetStringOfLen(name, 0, fixup->nameLen);
+
+			if ( fixup->farFunction )
+				EmitFunctionPos(Scr_CreateCanonicalFilename(&script->names[fixup->fileName]), stringValue, fixup->sourcePos);
+			else
+				EmitFunctionPos(0, stringValue, fixup->sourcePos);
+
+			scrCompilePub.developer_statement = 0;
+			copied = fixup->offset + sizeof(intptr_t);
+			break;
+
+		case FIXUP_ANIMATION:
+			copied = CopyCompiledScriptCode(script, copied, fixup->offset + sizeof(intptr_t));
+			stringValue = SL_GetStringOfLen(name, 0, fixup->nameLen);
+			Scr_EmitAnimation(pos, stringValue, fixup->sourcePos);
+			SL_RemoveRefToString(stringValue);
+			break;
+
+		case FIXUP_ANIMTREE:
+			copied = CopyCompiledScriptCode(script, copied, fixup->offset + sizeof(byte));
+			*(byte *)pos = scrAnimPub.animTreeIndex;
+			break;
+
+		case FIXUP_CASE_STRING:
+			copied = CopyCompiledScriptCode(script, copied, fixup->offset + sizeof(intptr_t));
+			*(intptr_t *)pos = SL_GetStringOfLen(name, 1, fixup->nameLen);
+			break;
+
+		case FIXUP_SWITCH:
+			copied = CopyCompiledScriptCode(script, copied, fixup->offset + fixup->value * sizeof(intptr_t) * 2);
+			caseInfo = (intptr_t *)pos;
+
+			for ( j = 0; j < fixup->value; ++j )
+				caseInfo[j * 2 + 1] += (intptr_t)codeStart - script->codeStart;
+
+			qsort(pos, fixup->value, sizeof(intptr_t) * 2, CompareCaseInfo);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	CopyCompiledScriptCode(script, copied, script->codeLen);
+	scrCompilePub.programLen = (char *)TempMalloc(0) - scrVarPub.programBuffer;
+	Hunk_ClearTempMemoryHighInternal();
+	LinkScript(filePosId, scriptId, precachescriptList);
+}
+
+/*
+ * Restores filename from the compiled script cache if its source is unchanged.
+ * Otherwise the following ScriptCompile records it
+ */
+bool Scr_LoadCompiledScript(const char *filename, const char *sourceBuffer, unsigned int filePosId, unsigned int scriptId)
+{
+	CompiledScript *script;
+	unsigned int sourceChecksum;
+	int sourceLen;
+
+	scrCompileCacheGlob.filename = NULL;
+	scrCompileCacheGlob.recording = 0;
+
+	if ( !com_scriptCompileCache->current.boolean )
+	{
+		if ( scrCompileCacheGlob.scriptCount )
+			Scr_ClearCompiledScripts();
+
+		return false;
+	}
+
+	// the debugger needs the opcode lookup the parser builds
+	if ( scrVarPub.developer )
+		return false;
+
+	sourceLen = strlen(sourceBuffer);
+	sourceChecksum = Com_BlockChecksum((void *)sourceBuffer, sourceLen);
+	script = *FindCompiledScript(filename);
+
+	if ( script
+	        && script->developer_script == scrVarPub.developer_script
+	        && script->sourceLen == sourceLen
+	        && script->sourceChecksum == sourceChecksum
+	        && !memcmp(script->source, sourceBuffer, sourceLen)
+	        && CheckCompiledScriptBuiltins(script, filePosId) )
+	{
+		RestoreCompiledScript(script, filePosId, scriptId);
+		return true;
+	}
+
+	scrCompileCacheGlob.filename = filename;
+	scrCompileCacheGlob.source = sourceBuffer;
+	scrCompileCacheGlob.sourceLen = sourceLen;
+	scrCompileCacheGlob.sourceChecksum = sourceChecksum;
+
+	return false;
+}
+
+void ScriptCompile(sval_u val, unsigned int filePosId, unsigned int scriptId)
+{
+	PrecacheEntry *precachescriptList;
+
+	precachescriptList = InitScriptCompile(filePosId);
+	BeginCompiledScript(filePosId);
+	EmitIncludeList(val.node[0]);
+	EmitThreadList(val.node[1]);
+	scrCompilePub.programLen = (char *)TempMalloc(0) - scrVarPub.programBuffer;
+	EndCompiledScript();
+	Hunk_ClearTempMemoryHighInternal();
+	LinkScript(filePosId, scriptId, precachescriptList);
+}
+
 void Scr_CompileShutdown()
 {
 	PrecacheEntry *precachescriptList;
@@ -4242,6 +4845,9 @@ void Scr_CompileShutdown()
 		scrCompileGlob.precachescriptListHead = scrCompileGlob.precachescriptListHead->next;
 		Z_FreeInternal(precachescriptList);
 	}
+
+	scrCompileCacheGlob.filename = NULL;
+	scrCompileCacheGlob.recording = 0;
 }
 
 #pragma GCC pop_options
\ No newline at end of file
@@ -245,11 +245,16 @@ unsigned int Scr_LoadScript(const char *filename)
 			scrCompilePub.far_function_count = 0;
 			scriptfilename = scrParserPub.scriptfilename;
 			scrParserPub.scriptfilename = scriptName;
-			scrCompilePub.in_ptr = "+";
-			scrCompilePub.parseBuf = sourceBuffer;
-			ScriptParse(&parseData, 0);
 			scriptPosIdIndex = GetObjectA(GetVariable(scrCompilePub.scriptsPos, index));
-			ScriptCompile(parseData, scriptPosIdIndex, loadedScriptsIdIndex);
+
+			if ( !Scr_LoadCompiledScript(fileName, sourceBuffer, scriptPosIdIndex, loadedScriptsIdIndex) )
+			{
+				scrCompilePub.in_ptr = "+";
+				scrCompilePub.parseBuf = sourceBuffer;
+				ScriptParse(&parseData, 0);
+				ScriptCompile(parseData, scriptPosIdIndex, loadedScriptsIdIndex);
+			}
+
 			scrParserPub.scriptfilename = scriptfilename;
 			scrParserPub.sourceBuf = sourceBuf;
 
@@ -98,6 +98,13 @@ unsigned int FindLastSibling(unsigned int id)
 		return scrVarGlob.variableList[scrVarGlob.variableList[scrVarGlob.variableList[scrVarGlob.variableList[id].nextSibling].hash.u.prev].hash.u.prev].hash.id;
 }
 
+// Scramble the name term so array elements and sibling objects with nearby ids
+// spread out; for a fixed name the bucket is still unique per parent.
+static inline unsigned int Scr_VariableHash(unsigned int parentId, unsigned int name)
+{
+	return (parentId + ((name * 0x9E3779B1u) >> 16)) % (VARIABLELIST_SIZE - 1) + 1;
+}
+
 unsigned int FindVariableIndexInternal(unsigned int name, unsigned short index)
 {
 	unsigned int newIndex;
@@ -139,7 +146,7 @@ unsigned int FindVariable(unsigned int parentId, unsigned int name)
 
 unsigned int FindVariableIndex(unsigned int parentId, unsigned int name)
 {
-	return FindVariableIndexInternal(name, (parentId + name) % (VARIABLELIST_SIZE - 1) + 1);
+	return FindVariableIndexInternal(name, Scr_VariableHash(parentId, name));
 }
 
 unsigned int FindObjectVariable(unsigned int parentId, unsigned int id)
@@ -444,10 +451,10 @@ unsigned int GetVariableIndexInternal(unsigned int parentId, unsigned int name)
 {
 	unsigned int index;
 
-	index = FindVariableIndexInternal(name, (parentId + name) % (VARIABLELIST_SIZE - 1) + 1);
+	index = FindVariableIndexInternal(name, Scr_VariableHash(parentId, name));
 
 	if ( !index )
-		return GetNewVariableIndexInternal2(parentId, name, (parentId + name) % (VARIABLELIST_SIZE - 1) + 1);
+		return GetNewVariableIndexInternal2(parentId, name, Scr_VariableHash(parentId, name));
 
 	return index;
 }
@@ -464,7 +471,7 @@ unsigned int GetArrayVariable(unsigned int parentId, unsigned int index)
 
 unsigned int GetNewVariableIndexInternal(unsigned int parentId, unsigned int name)
 {
-	return GetNewVariableIndexInternal2(parentId, name, (parentId + name) % (VARIABLELIST_SIZE - 1) + 1);
+	return GetNewVariableIndexInternal2(parentId, name, Scr_VariableHash(parentId, name));
 }
 
 unsigned int GetNewVariableIndexReverseInternal2(unsigned int parentId, unsigned int name, unsigned int index)
@@ -488,7 +495,7 @@ unsigned int GetNewVariableIndexReverseInternal2(unsigned int parentId, unsigned
 
 unsigned int GetNewVariableIndexReverseInternal(unsigned int parentId, unsigned int name)
 {
-	return GetNewVariableIndexReverseInternal2(parentId, name, (parentId + name) % (VARIABLELIST_SIZE - 1) + 1);
+	return GetNewVariableIndexReverseInternal2(parentId, name, Scr_VariableHash(parentId, name));
 }
 
 unsigned int GetNewObjectVariableReverse(unsigned int parentId, unsigned int id)
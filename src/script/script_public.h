@@ -1027,3 +1027,4 @@ void EmitMethod(sval_u expr, sval_u func_name, sval_u params, sval_u methodSourc
 void EmitThread(sval_u val);
 
 void ScriptCompile(sval_u val, unsigned int filePosId, unsigned int scriptId);
+bool Scr_LoadCompiledScript(const char *filename, const char *sourceBuffer, unsigned int filePosId, unsigned int scriptId);
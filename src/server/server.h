@@ -14,6 +14,7 @@
 #define AUTHORIZE_TIMEOUT 5000
 
 #define BAN_LIST_NAME "ban.txt"
+#define BAN_LIST_CHECK_MSEC 1000
 
 // Snapshot limits. Possibly calculated from max clients/ents somehow?
 #define ARCHIVED_SNAPSHOT_BUFFER_SIZE  33554432
@@ -55,6 +56,11 @@ extern dvar_t *sv_debugReliableCmds;
 extern dvar_t *sv_showAverageBPS;
 extern dvar_t *sv_padPackets;
 extern dvar_t *sv_debugRate;
+extern dvar_t *sv_snapshotThreads;
+extern dvar_t *sv_mapLoadThreads;
+extern dvar_t *sv_deltaCache;
+extern dvar_t *sv_queryCache;
+extern dvar_t *sv_mapPrefetchTime;
 
 extern dvar_t *sv_wwwDownload;
 extern dvar_t *sv_wwwBaseURL;
@@ -298,6 +304,24 @@ typedef struct svEntity_s
 static_assert((sizeof(svEntity_t) == 0x174), "ERROR: svEntity_t size is invalid!");
 #endif
 
+// an entity's PVS clusters folded into 32 bit words of a cluster PVS row, so
+// the snapshot visibility test is one AND per word instead of one per cluster
+typedef struct
+{
+	int word;
+	unsigned int mask;
+} svClusterWord_t;
+
+typedef struct
+{
+	int numWords;    // -1 when an overflowed lastCluster needs the scalar test
+	svClusterWord_t words[MAX_ENT_CLUSTERS];
+} svEntityClusters_t;
+
+extern svEntityClusters_t sv_entityClusters[];
+extern int sv_entityClusterSequence;
+extern qboolean sv_entityClustersEnabled;
+
 typedef struct
 {
 	serverState_t state;
@@ -347,9 +371,29 @@ struct leakyBucket_s
 	int type;
 	unsigned char adr[4];
 	uint64_t lastTime;
-	signed char	burst;
+	int burst;
 	long hash;
 	leakyBucket_t *prev, *next;
+	leakyBucket_t *older, *newer;
+};
+
+// on-disk ban list kept in sync with an in-memory index
+typedef struct
+{
+	const char *filename;
+	qboolean loaded;
+	qboolean stale;
+	int checkTime;
+	unsigned int stamp;
+	int parsedLength;
+	unsigned int parsedHash;
+} banListFile_t;
+
+enum banListChange_t
+{
+	BANLIST_UNCHANGED,
+	BANLIST_APPENDED,
+	BANLIST_RELOADED
 };
 
 extern int sv_serverId_value;
@@ -360,6 +404,8 @@ extern dvar_t *sv_maxclients;
 void SV_Init();
 void SV_PacketEvent( netadr_t from, msg_t *msg );
 void SV_Frame(int msec);
+void SV_CheckNextMapPrefetch( void );
+int SV_FrameMsecRemaining();
 void SV_Shutdown( const char* finalmsg );
 void SV_ShutdownGameProgs();
 void SV_Netchan_AddOOBProfilePacket(int iLength);
@@ -382,6 +428,9 @@ void SV_SetUserinfo( int index, const char *val );
 void SV_FreeClients();
 
 void SV_AuthorizeIpPacket( netadr_t from );
+void SV_LinkClientAddress( client_t *cl );
+void SV_UnlinkClientAddress( client_t *cl );
+void SV_ClearClientAddresses();
 void SV_Heartbeat_f(void);
 bool SV_Loaded();
 void SV_FreeClientScriptId(client_s *cl);
@@ -391,6 +440,7 @@ void SV_GetUsercmd(int clientNum, usercmd_s *cmd);
 int SV_GetGuid(int clientNum);
 void SV_BanGuidBriefly(int guid);
 void SV_BanClient(client_t *cl);
+banListChange_t SV_ReadBanListFile(banListFile_t *list, char **file, const char **text);
 void SV_UnbanClient(const char *name);
 
 void SV_UserMove( client_t *cl, msg_t *msg, qboolean delta );
@@ -444,6 +494,7 @@ qboolean SV_GetEntityToken( char *buffer, int bufferSize );
 #include "../qcommon/cm_public.h"
 void SV_LinkEntity( gentity_t *gEnt );
 void SV_UnlinkEntity( gentity_t *gEnt );
+void SV_ResetEntityClusters();
 void SV_ClipMoveToEntity(moveclip_t *clip, svEntity_t *entity, trace_t *trace);
 void SV_PointTraceToEntity(pointtrace_t *clip, svEntity_t *check, trace_t *trace);
 int SV_PointSightTraceToEntity(sightpointtrace_t *clip, svEntity_t *check);
@@ -465,6 +516,9 @@ void SV_BuildClientSnapshot( client_t *client );
 void SV_WriteSnapshotToClient(client_s *client, msg_t *msg);
 void SV_InitArchivedSnapshot();
 void SV_FreeArchivedSnapshot();
+void SV_ClearCachedEntityClusters();
+void SV_ClearClientPositionHistory();
+void SV_FreeCachedEntityClusters();
 char* SV_AllocSkelMemory(unsigned int size);
 void SV_ResetSkeletonCache();
 int SV_DObjCreateSkelForBone(gentity_s *ent, int boneIndex);
@@ -502,6 +556,8 @@ void SV_SpawnServer(char *server);
 void SV_MasterShutdown();
 
 void SV_SendClientMessages( void );
+void SV_DeltaCacheStats_f( void );
+void SV_QueryCacheStats_f( void );
 void SV_ClientThink(client_t *cl, usercmd_t *cmd);
 
 void SV_ChangeMaxClients( void );
@@ -892,6 +892,138 @@ retry:
 	}
 }
 
+/*
+================
+SV_NextRotationToken
+================
+*/
+static const char *SV_NextRotationToken( const char **value )
+{
+	const char *token;
+
+	token = Com_Parse(value);
+
+	return *value ? token : NULL;
+}
+
+/*
+================
+SV_GetNextRotationMap
+
+Works out which map map_rotate would load next, without touching
+sv_mapRotationCurrent
+================
+*/
+static qboolean SV_GetNextRotationMap( char *map, int size )
+{
+	const char *token;
+	const char *value;
+
+	value = sv_mapRotationCurrent->current.string;
+
+	if ( !value[0] )
+		value = sv_mapRotation->current.string;
+
+	token = SV_NextRotationToken(&value);
+
+	if ( !token )
+	{
+		value = sv_mapRotation->current.string;
+		token = SV_NextRotationToken(&value);
+	}
+
+	while ( token )
+	{
+		if ( !strcasecmp(token, "gametype") )
+		{
+			if ( !SV_NextRotationToken(&value) )
+				return qfalse;
+		}
+		else if ( !strcasecmp(token, "map") )
+		{
+			token = SV_NextRotationToken(&value);
+
+			if ( !token )
+				return qfalse;
+
+			I_strncpyz(map, token, size);
+			return qtrue;
+		}
+
+		token = SV_NextRotationToken(&value);
+	}
+
+	return qfalse;
+}
+
+/*
+================
+SV_PrefetchNextMap_f
+
+Starts reading the next rotation map's bsp in the background, so the
+map change doesn't have to wait for the disk and the inflate
+================
+*/
+static void SV_PrefetchNextMap_f( void )
+{
+	char map[MAX_QPATH];
+	char filename[MAX_QPATH];
+	char iwdPath[MAX_OSPATH];
+	unsigned long pos;
+
+	if ( !com_sv_running->current.boolean )
+	{
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	if ( !SV_GetNextRotationMap(map, sizeof(map)) )
+	{
+		Com_Printf("No next map in sv_mapRotation to prefetch\n");
+		return;
+	}
+
+	Com_sprintf(filename, sizeof(filename), "maps/mp/%s.%s", map, GetBspExtension());
+
+	if ( FS_FindIwdForFile(filename, iwdPath, sizeof(iwdPath), &pos) )
+	{
+		Com_PrefetchBsp(filename, iwdPath, pos);
+		return;
+	}
+
+#ifdef LIBCOD
+	// library maps only get linked into fs_game on the map change itself
+	if ( manymaps_getLibraryIwd(map, iwdPath, sizeof(iwdPath)) )
+	{
+		Com_PrefetchBsp(filename, iwdPath, -1);
+		return;
+	}
+#endif
+
+	Com_Printf("%s is not in an iwd, not prefetching\n", filename);
+}
+
+/*
+================
+SV_CheckNextMapPrefetch
+
+Prefetches the next map once the current one has run sv_mapPrefetchTime seconds
+================
+*/
+void SV_CheckNextMapPrefetch( void )
+{
+	static int prefetchServerId = -1;
+
+	if ( !sv_mapPrefetchTime->current.integer || sv.state != SS_GAME || prefetchServerId == sv_serverId_value )
+		return;
+
+	if ( com_frameTime - sv.start_frameTime < sv_mapPrefetchTime->current.integer * 1000 )
+		return;
+
+	prefetchServerId = sv_serverId_value;
+	SV_PrefetchNextMap_f();
+}
+
 /*
 =================
 SV_GameCompleteStatus_f
@@ -976,6 +1108,7 @@ void SV_AddOperatorCommands( void )
 	Cmd_AddCommand("map", SV_Map_f);
 	Cmd_SetAutoComplete("map", "maps/mp", "d3dbsp");
 	Cmd_AddCommand("map_rotate", SV_MapRotate_f);
+	Cmd_AddCommand("prefetchNextMap", SV_PrefetchNextMap_f);
 	Cmd_AddCommand("gameCompleteStatus", SV_GameCompleteStatus_f);  // NERVE - SMF
 	Cmd_AddCommand("devmap", SV_Map_f);
 	Cmd_SetAutoComplete("devmap", "maps/mp", "d3dbsp");
@@ -991,6 +1124,8 @@ void SV_AddOperatorCommands( void )
 
 	Cmd_AddCommand("scriptUsage", SV_ScriptUsage_f);
 	Cmd_AddCommand("stringUsage", SV_StringUsage_f);
+	Cmd_AddCommand("deltaCacheStats", SV_DeltaCacheStats_f);
+	Cmd_AddCommand("queryCacheStats", SV_QueryCacheStats_f);
 }
 
 /*
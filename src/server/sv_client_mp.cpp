@@ -64,24 +64,164 @@ void SV_BanGuidBriefly( int guid )
 
 /*
 =================
-SV_IsBannedGuid
+SV_HashBanListText
 =================
 */
-bool SV_IsBannedGuid( int guid )
+static unsigned int SV_HashBanListText( unsigned int hash, const char *text, int length )
+{
+	int i;
+
+	for ( i = 0; i < length; i++ )
+		hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+
+	return hash;
+}
+
+/*
+=================
+SV_ReadBanListFile
+
+Checks whether a ban list changed on disk since it was last parsed, at most
+once every BAN_LIST_CHECK_MSEC unless marked stale. When the old contents
+are still an intact prefix of the file (bans are only ever appended), *text
+points just past them so only the new lines need parsing. Otherwise the
+caller must clear its index and parse from the start. *file is NULL if the
+list no longer exists, else it must be freed with FS_FreeFile.
+=================
+*/
+banListChange_t SV_ReadBanListFile( banListFile_t *list, char **file, const char **text )
+{
+	int now;
+	int length;
+	unsigned int stamp;
+	unsigned int hash;
+
+	*file = NULL;
+	*text = NULL;
+
+	now = Sys_Milliseconds();
+
+	if ( list->loaded && !list->stale && now - list->checkTime < BAN_LIST_CHECK_MSEC )
+		return BANLIST_UNCHANGED;
+
+	list->checkTime = now;
+	stamp = FS_GetFileStamp(list->filename);
+
+	if ( list->loaded && !list->stale && stamp == list->stamp )
+		return BANLIST_UNCHANGED;
+
+	list->loaded = qtrue;
+	list->stale = qfalse;
+	list->stamp = stamp;
+
+	length = stamp ? FS_ReadFile(list->filename, (void **)file) : -1;
+
+	if ( length < 0 )
+	{
+		*file = NULL;
+		list->parsedLength = 0;
+		list->parsedHash = 0;
+		return BANLIST_RELOADED;
+	}
+
+	*text = *file;
+
+	if ( list->parsedLength && length >= list->parsedLength && (*file)[list->parsedLength - 1] == '\n' )
+	{
+		hash = SV_HashBanListText(2166136261u, *file, list->parsedLength);
+
+		if ( hash == list->parsedHash )
+		{
+			*text = *file + list->parsedLength;
+			list->parsedHash = SV_HashBanListText(hash, *text, length - list->parsedLength);
+			list->parsedLength = length;
+			return BANLIST_APPENDED;
+		}
+	}
+
+	list->parsedHash = SV_HashBanListText(2166136261u, *file, length);
+	list->parsedLength = length;
+	return BANLIST_RELOADED;
+}
+
+static banListFile_t banGuidFile = { BAN_LIST_NAME };
+
+// open addressed set of banned guids, 0 marks an empty slot
+static int *banGuids;
+static int banGuidCount;
+static int banGuidMask;
+
+/*
+=================
+SV_AddBannedGuid
+=================
+*/
+static void SV_AddBannedGuid( int guid )
+{
+	int *oldGuids;
+	int oldMask;
+	int i;
+	int slot;
+
+	if ( !guid )
+		return;
+
+	if ( (banGuidCount + 1) * 2 > banGuidMask + 1 )
+	{
+		oldGuids = banGuids;
+		oldMask = banGuidMask;
+
+		banGuidMask = banGuidMask ? banGuidMask * 2 + 1 : 1023;
+		banGuids = (int *)Z_Malloc(sizeof(int) * (banGuidMask + 1));
+		banGuidCount = 0;
+
+		if ( oldGuids )
+		{
+			for ( i = 0; i <= oldMask; i++ )
+				SV_AddBannedGuid(oldGuids[i]);
+
+			Z_Free(oldGuids);
+		}
+	}
+
+	for ( slot = ((unsigned int)guid * 2654435761u) & banGuidMask; banGuids[slot]; slot = (slot + 1) & banGuidMask )
+	{
+		if ( banGuids[slot] == guid )
+			return;
+	}
+
+	banGuids[slot] = guid;
+	banGuidCount++;
+}
+
+/*
+=================
+SV_UpdateBannedGuids
+=================
+*/
+static void SV_UpdateBannedGuids()
 {
-	bool banned;
 	char *file;
 	const char *token;
 	const char *text;
 
-	if ( !guid )
-		return false;
+	switch ( SV_ReadBanListFile(&banGuidFile, &file, &text) )
+	{
+	case BANLIST_UNCHANGED:
+		return;
 
-	if ( FS_ReadFile(BAN_LIST_NAME, (void **)&file) < 0 )
-		return false;
+	case BANLIST_RELOADED:
+		if ( banGuids )
+			Com_Memset(banGuids, 0, sizeof(int) * (banGuidMask + 1));
+		banGuidCount = 0;
+		break;
 
-	text = file;
-	banned = false;
+	case BANLIST_APPENDED:
+		break;
+	}
+
+	if ( !file )
+		return;
 
 	while ( 1 )
 	{
@@ -90,18 +230,37 @@ bool SV_IsBannedGuid( int guid )
 		if ( !token[0] )
 			break;
 
-		if ( atoi(token) == guid )
-		{
-			banned = true;
-			break;
-		}
-
+		SV_AddBannedGuid(atoi(token));
 		Com_SkipRestOfLine(&text);
 	}
 
 	FS_FreeFile(file);
+}
 
-	return banned;
+/*
+=================
+SV_IsBannedGuid
+=================
+*/
+bool SV_IsBannedGuid( int guid )
+{
+	int slot;
+
+	if ( !guid )
+		return false;
+
+	SV_UpdateBannedGuids();
+
+	if ( !banGuidCount )
+		return false;
+
+	for ( slot = ((unsigned int)guid * 2654435761u) & banGuidMask; banGuids[slot]; slot = (slot + 1) & banGuidMask )
+	{
+		if ( banGuids[slot] == guid )
+			return true;
+	}
+
+	return false;
 }
 
 /*
@@ -199,6 +358,9 @@ void SV_BanClient( client_t *cl )
 	FS_Printf(file, "%i %s\r\n", cl->guid, cleanName);
 	FS_FCloseFile(file);
 
+	// the next file check only has to parse the line we just appended
+	SV_AddBannedGuid(cl->guid);
+
 	SV_DropClient(cl, "EXE_PLAYERKICKED");
 	cl->lastPacketTime = svs.time;
 }
@@ -257,6 +419,8 @@ void SV_UnbanClient( const char *name )
 	FS_WriteFile(BAN_LIST_NAME, file, fileSize);
 	FS_FreeFile(file);
 
+	banGuidFile.stale = qtrue;
+
 	if ( found )
 		Com_Printf("unbanned %i user(s) named %s\n", found, cleanName);
 	else
@@ -799,6 +963,7 @@ gotnewcl:
 
 	// save the address
 	Netchan_Setup(NS_SERVER, &newcl->netchan, from, qport);
+	SV_LinkClientAddress(newcl);
 #ifdef LIBCOD
 	newcl->netchan.protocol = version;
 #endif
@@ -44,6 +44,11 @@ dvar_t *sv_mapRotation;
 dvar_t *sv_mapRotationCurrent;
 dvar_t *sv_debugRate;
 dvar_t *sv_debugReliableCmds;
+dvar_t *sv_snapshotThreads;
+dvar_t *sv_mapLoadThreads;
+dvar_t *sv_deltaCache;
+dvar_t *sv_queryCache;
+dvar_t *sv_mapPrefetchTime;
 dvar_t *nextmap;
 dvar_t *com_expectedHunkUsage;
 
@@ -122,9 +127,14 @@ void SV_InitDvar()
 	sv_mapRotation = Dvar_RegisterString("sv_mapRotation", "", DVAR_CHANGEABLE_RESET);
 
 	sv_mapRotationCurrent = Dvar_RegisterString("sv_mapRotationCurrent", "", DVAR_CHANGEABLE_RESET);
+	sv_mapPrefetchTime = Dvar_RegisterInt("sv_mapPrefetchTime", 0, 0, 86400, DVAR_ARCHIVE | DVAR_CHANGEABLE_RESET);
 
 	sv_debugRate = Dvar_RegisterBool("sv_debugRate", false, DVAR_CHANGEABLE_RESET);
 	sv_debugReliableCmds = Dvar_RegisterBool("sv_debugReliableCmds", false, DVAR_CHANGEABLE_RESET);
+	sv_snapshotThreads = Dvar_RegisterInt("sv_snapshotThreads", 0, 0, MAX_WORKER_THREADS + 1, DVAR_ARCHIVE | DVAR_CHANGEABLE_RESET);
+	sv_mapLoadThreads = Dvar_RegisterInt("sv_mapLoadThreads", 0, 0, MAX_WORKER_THREADS + 1, DVAR_ARCHIVE | DVAR_CHANGEABLE_RESET);
+	sv_deltaCache = Dvar_RegisterBool("sv_deltaCache", false, DVAR_ARCHIVE | DVAR_CHANGEABLE_RESET);
+	sv_queryCache = Dvar_RegisterBool("sv_queryCache", false, DVAR_ARCHIVE | DVAR_CHANGEABLE_RESET);
 
 	nextmap = Dvar_RegisterString("nextmap", "", DVAR_CHANGEABLE_RESET);
 	com_expectedHunkUsage = Dvar_RegisterInt("com_expectedHunkUsage", 0, 0, INT_MAX, DVAR_ROM | DVAR_CHANGEABLE_RESET);
@@ -147,6 +157,9 @@ void SV_InitArchivedSnapshot()
 	svs.nextCachedSnapshotEntities = 0;
 	svs.nextCachedSnapshotClients = 0;
 	svs.nextCachedSnapshotFrames = 0;
+
+	SV_ClearCachedEntityClusters();
+	SV_ClearClientPositionHistory();
 }
 
 /*
@@ -565,6 +578,8 @@ void SV_Startup( void )
 		Com_Error( ERR_FATAL, "SV_Startup: unable to allocate svs.clients" );
 	}
 
+	SV_ClearClientAddresses();
+
 	if ( com_dedicated->current.integer )
 	{
 		svs.numSnapshotEntities = sv_maxclients->current.integer * PACKET_BACKUP * 64;
@@ -643,6 +658,8 @@ SV_FreeArchivedSnapshot
 */
 void SV_FreeArchivedSnapshot()
 {
+	SV_FreeCachedEntityClusters();
+
 	if ( svs.cachedSnapshotEntities )
 	{
 		Z_Free(svs.cachedSnapshotEntities);
@@ -725,6 +742,9 @@ void SV_Shutdown( const char *finalmsg )
 	SV_FreeArchivedSnapshot();
 	memset(&svs, 0, sizeof(svs));
 
+	// a prefetch of the next map is of no use any more
+	Com_ShutdownBspPrefetch();
+
 #ifndef DEDICATED
 	if ( com_dedicated->current.integer )
 		FX_FreeSystem();
@@ -831,6 +851,9 @@ void SV_SpawnServer( char *server )
 	client_t *cl;
 	int checksum;
 	int i;
+	int startTime;
+
+	startTime = Sys_Milliseconds();
 
 #if LIBCOD_COMPILE_SQLITE == 1
 	free_sqlite_db_stores_and_tasks();
@@ -932,10 +955,12 @@ void SV_SpawnServer( char *server )
 	Com_sprintf(mapname, sizeof(mapname), "maps/mp/%s.%s", server, GetBspExtension());
 
 	Com_LoadBsp(mapname);
+	CM_SetLoadThreads(sv_mapLoadThreads->current.integer);
 	CM_LoadMap(mapname, &checksum);
 
 	Com_UnloadBsp();
 	CM_LinkWorld();
+	SV_ResetEntityClusters();
 
 	// serverid should be different each time
 	sv_serverId_value = (byte)(sv_serverId_value + 16);
@@ -1036,6 +1061,7 @@ void SV_SpawnServer( char *server )
 	// send a heartbeat now so the master will get up to date info
 	SV_Heartbeat_f();
 
+	Com_Printf("Map change took %i msec\n", Sys_Milliseconds() - startTime);
 	Com_Printf("-----------------------------------\n");
 }
 
@@ -143,6 +143,7 @@ void SV_CheckTimeouts( void )
 			// using the client id cause the cl->name is empty at this point
 			Com_DPrintf( "Going from CS_ZOMBIE to CS_FREE for %s\n", cl->name );
 			cl->state = CS_FREE;    // can now be reused
+			SV_UnlinkClientAddress(cl);
 			continue;
 		}
 
@@ -154,6 +155,7 @@ void SV_CheckTimeouts( void )
 			{
 				SV_DropClient( cl, "EXE_TIMEDOUT" );
 				cl->state = CS_FREE;    // don't bother with zombie state
+				SV_UnlinkClientAddress(cl);
 			}
 		}
 		else
@@ -454,36 +456,337 @@ void SV_VoicePacket( netadr_t from, msg_t *msg )
 	}
 }
 
+/*
+=============================================================================
+
+Query response cache
+
+getinfo and getstatus replies are built with a placeholder challenge and
+kept until a dvar changes or the client list, a score, a ping or a name
+does; clients are compared at most once per server frame. A query only
+copies the cached reply with its own challenge spliced in. Replies that
+would not come out identical that way (a long challenge, an info string
+close to MAX_INFO_STRING) are still built from scratch.
+
+=============================================================================
+*/
+
+#define QUERY_CHALLENGE_PLACEHOLDER "00000000000000000000000000000000"
+#define MAX_QUERY_CHALLENGE         ( sizeof(QUERY_CHALLENGE_PLACEHOLDER) - 1 )
+#define MAX_STATUS_STRING           8192
+
+typedef struct
+{
+	qboolean valid;
+	qboolean usable;            // the placeholder landed where a challenge would
+	int dvarCount;              // dvar_modifiedCount it was built for
+	int maxLength;              // the uncached reply is cut to this many chars
+	int length;
+	int challengeStart;         // the \challenge\ pair inside response
+	int challengeEnd;
+	char response[MAX_STATUS_STRING + MAX_MSGLEN];
+} svQueryCache_t;
+
+typedef struct
+{
+	int state;
+	int ping;
+	int score;
+	char name[MAX_NAME_LENGTH];
+} svQueryClient_t;
+
+static svQueryCache_t svInfoCache;
+static svQueryCache_t svStatusCache;
+static svQueryClient_t svQueryClients[MAX_CLIENTS];
+static int svQueryNumClients;
+static qboolean svQueryGameInitialized;
+static int svQueryCheckTime = -1;
+
+static int svQueryHits;
+static int svQueryMisses;
+static int svQueryBypass;
+static unsigned int svQueryBytesServed;
+
 /*
 ================
-SVC_Info
-Responds with a short info message that should be enough to determine
-if a user is interested in a server to do a full status
+SV_SetQueryInfoValue
+
+Info_SetValueForKey that notes when the pair could not be stored as given
 ================
 */
-void SVC_Info( netadr_t from )
+static void SV_SetQueryInfoValue( char *s, const char *key, const char *value, qboolean *complete )
 {
-	int i, count;
-	char infostring[MAX_INFO_STRING];
-	char infosend[MAX_INFO_STRING];
+	char cleanValue[MAX_INFO_STRING];
+	int i, j;
 
-#if LIBCOD_COMPILE_RATELIMITER == 1
-	extern leakyBucket_t outboundLeakyBucket;
-	// Prevent using getinfo as an amplifier
-	if ( SVC_RateLimitAddress( from, 10, 1000 ) )
+	Info_SetValueForKey(s, key, value);
+
+	for ( i = 0, j = 0; value[i] && i < MAX_INFO_STRING - 1; i++ )
+	{
+		if ( value[i] != '\\' && value[i] != ';' && value[i] != '\"' )
+		{
+			cleanValue[j++] = value[i];
+		}
+	}
+
+	cleanValue[j] = 0;
+
+	if ( strcmp(Info_ValueForKey(s, key), cleanValue) )
+	{
+		*complete = qfalse;
+	}
+}
+
+/*
+================
+SV_FindInfoPair
+================
+*/
+static qboolean SV_FindInfoPair( const char *info, const char *key, int *start, int *end )
+{
+	const char *pair;
+	const char *value;
+	const char *s;
+	int keyLength;
+
+	keyLength = strlen(key);
+	s = info;
+
+	while ( *s == '\\' )
+	{
+		pair = s++;
+
+		while ( *s && *s != '\\' )
+		{
+			s++;
+		}
+
+		if ( !*s )
+		{
+			return qfalse;
+		}
+
+		value = s++;
+
+		while ( *s && *s != '\\' )
+		{
+			s++;
+		}
+
+		if ( value - pair - 1 == keyLength && !strncmp(pair + 1, key, keyLength) )
+		{
+			*start = pair - info;
+			*end = s - info;
+			return qtrue;
+		}
+	}
+
+	return qfalse;
+}
+
+/*
+================
+SV_CheckQueryClients
+
+Forgets both cached replies when anything they list about the players
+changed, looked at once per server frame
+================
+*/
+static void SV_CheckQueryClients()
+{
+	svQueryClient_t *query;
+	client_t *cl;
+	qboolean changed;
+	int score;
+	int i;
+
+	if ( svQueryCheckTime == svs.time )
 	{
-		Com_DPrintf( "SVC_Info: rate limit from %s exceeded, dropping request\n", NET_AdrToString( from ) );
 		return;
 	}
 
-	// Allow getinfo to be DoSed relatively easily, but prevent
-	// excess outbound bandwidth usage when being flooded inbound
-	if ( SVC_RateLimit( &outboundLeakyBucket, 10, 100 ) )
+	svQueryCheckTime = svs.time;
+	changed = svQueryNumClients != sv_maxclients->current.integer || svQueryGameInitialized != gameInitialized;
+
+	svQueryNumClients = sv_maxclients->current.integer;
+	svQueryGameInitialized = gameInitialized;
+
+	for ( i = 0; i < svQueryNumClients; i++ )
+	{
+		cl = &svs.clients[i];
+		query = &svQueryClients[i];
+
+		if ( query->state != cl->state )
+		{
+			query->state = cl->state;
+			changed = qtrue;
+		}
+
+		if ( cl->state < CS_CONNECTED )
+		{
+			continue;
+		}
+
+		score = gameInitialized ? G_GetClientScore(i) : 0;
+
+		if ( query->ping != cl->ping || query->score != score || strcmp(query->name, cl->name) )
+		{
+			query->ping = cl->ping;
+			query->score = score;
+			I_strncpyz(query->name, cl->name, sizeof(query->name));
+			changed = qtrue;
+		}
+	}
+
+	if ( changed )
+	{
+		svInfoCache.valid = qfalse;
+		svStatusCache.valid = qfalse;
+	}
+}
+
+/*
+================
+SV_StoreQueryResponse
+================
+*/
+static void SV_StoreQueryResponse( svQueryCache_t *cache, const char *header, const char *infostring, const char *status, qboolean complete, int maxLength )
+{
+	int headerLength;
+
+	cache->valid = qtrue;
+	cache->usable = qfalse;
+	cache->dvarCount = dvar_modifiedCount;
+	cache->maxLength = maxLength;
+
+	if ( !complete || !SV_FindInfoPair(infostring, "challenge", &cache->challengeStart, &cache->challengeEnd) )
 	{
-		Com_DPrintf( "SVC_Info: rate limit exceeded, dropping request\n" );
 		return;
 	}
-#endif
+
+	headerLength = strlen(header);
+
+	if ( status )
+		Com_sprintf(cache->response, sizeof(cache->response), "%s%s\n%s", header, infostring, status);
+	else
+		Com_sprintf(cache->response, sizeof(cache->response), "%s%s", header, infostring);
+
+	cache->length = strlen(cache->response);
+
+	if ( cache->length >= (int)sizeof(cache->response) - 1 )
+	{
+		return;
+	}
+
+	cache->challengeStart += headerLength;
+	cache->challengeEnd += headerLength;
+	cache->usable = qtrue;
+}
+
+/*
+================
+SV_SendQueryResponse
+
+Sends the cached reply with the challenge of this query, returns qfalse if
+it has to be built from scratch instead
+================
+*/
+static qboolean SV_SendQueryResponse( svQueryCache_t *cache, netadr_t from, const char *challenge )
+{
+	char msg[MAX_STATUS_STRING];
+	char pair[MAX_QUERY_CHALLENGE + 16];
+	int pairLength;
+	int length;
+	int n;
+
+	if ( !cache->usable )
+	{
+		return qfalse;
+	}
+
+	// same cleanup Info_SetValueForKey does, an empty value adds no pair
+	strcpy(pair, "\\challenge\\");
+	pairLength = strlen(pair);
+
+	for ( n = 0; challenge[n]; n++ )
+	{
+		if ( challenge[n] == '\\' || challenge[n] == ';' || challenge[n] == '\"' )
+		{
+			continue;
+		}
+
+		if ( pairLength == (int)strlen("\\challenge\\") + (int)MAX_QUERY_CHALLENGE )
+		{
+			return qfalse;
+		}
+
+		pair[pairLength++] = challenge[n];
+	}
+
+	if ( pairLength == (int)strlen("\\challenge\\") )
+	{
+		pairLength = 0;
+	}
+
+	length = 0;
+
+	n = I_min(cache->challengeStart, cache->maxLength - 1);
+	memcpy(msg, cache->response, n);
+	length = n;
+
+	n = I_min(pairLength, cache->maxLength - 1 - length);
+	memcpy(msg + length, pair, n);
+	length += n;
+
+	n = I_min(cache->length - cache->challengeEnd, cache->maxLength - 1 - length);
+	memcpy(msg + length, cache->response + cache->challengeEnd, n);
+	length += n;
+
+	msg[length] = 0;
+
+	NET_OutOfBandPrint(NS_SERVER, from, msg);
+	svQueryBytesServed += length;
+
+	return qtrue;
+}
+
+/*
+================
+SV_QueryCacheStats_f
+================
+*/
+void SV_QueryCacheStats_f( void )
+{
+	int lookups;
+
+	if ( Cmd_Argc() > 1 && !I_stricmp(Cmd_Argv(1), "reset") )
+	{
+		svQueryHits = 0;
+		svQueryMisses = 0;
+		svQueryBypass = 0;
+		svQueryBytesServed = 0;
+		Com_Printf("query cache stats reset\n");
+		return;
+	}
+
+	lookups = svQueryHits + svQueryMisses;
+
+	Com_Printf("query cache: %s\n", sv_queryCache->current.boolean ? "on" : "off");
+	Com_Printf("hits       : %i\n", svQueryHits);
+	Com_Printf("misses     : %i\n", svQueryMisses);
+	Com_Printf("bypassed   : %i\n", svQueryBypass);
+	Com_Printf("hit rate   : %.1f%%\n", lookups ? 100.0 * svQueryHits / lookups : 0.0);
+	Com_Printf("served     : %u bytes\n", svQueryBytesServed);
+}
+
+/*
+================
+SV_BuildInfoString
+================
+*/
+static void SV_BuildInfoString( char *infostring, const char *challenge, qboolean *complete )
+{
+	int i, count;
 
 	qboolean serverModded = qfalse;
 
@@ -505,82 +808,83 @@ void SVC_Info( netadr_t from )
 	}
 
 	infostring[0] = 0;
+	*complete = qtrue;
 
 	// echo back the parameter to status. so servers can use it as a challenge
 	// to prevent timed spoofed reply packets that add ghost servers
-	Info_SetValueForKey( infostring, "challenge", Cmd_Argv( 1 ) );
-	Info_SetValueForKey( infostring, "protocol", va( "%i", PROTOCOL_VERSION ) );
-	Info_SetValueForKey( infostring, "hostname", sv_hostname->current.string );
-	Info_SetValueForKey( infostring, "mapname", sv_mapname->current.string );
+	SV_SetQueryInfoValue( infostring, "challenge", challenge, complete );
+	SV_SetQueryInfoValue( infostring, "protocol", va( "%i", PROTOCOL_VERSION ), complete );
+	SV_SetQueryInfoValue( infostring, "hostname", sv_hostname->current.string, complete );
+	SV_SetQueryInfoValue( infostring, "mapname", sv_mapname->current.string, complete );
 
 	if ( clientCount )
 	{
-		Info_SetValueForKey( infostring, "clients", va( "%i", clientCount ) );
+		SV_SetQueryInfoValue( infostring, "clients", va( "%i", clientCount ), complete );
 	}
 
 	int maxclients = sv_maxclients->current.integer - (sv_privateClients->current.integer - privateClientCount);
 
 	if ( maxclients > 0 )
 	{
-		Info_SetValueForKey( infostring, "sv_maxclients", va( "%i", maxclients ) );
+		SV_SetQueryInfoValue( infostring, "sv_maxclients", va( "%i", maxclients ), complete );
 	}
 
-	Info_SetValueForKey( infostring, "gametype", sv_gametype->current.string );
+	SV_SetQueryInfoValue( infostring, "gametype", sv_gametype->current.string, complete );
 
 	if ( sv_pure->current.boolean || fs_numServerIwds )
 	{
-		Info_SetValueForKey( infostring, "pure", "1" );
+		SV_SetQueryInfoValue( infostring, "pure", "1", complete );
 	}
 
 	if ( sv_minPing->current.integer )
 	{
-		Info_SetValueForKey( infostring, "minPing", va( "%i", sv_minPing->current.integer ) );
+		SV_SetQueryInfoValue( infostring, "minPing", va( "%i", sv_minPing->current.integer ), complete );
 	}
 
 	if ( sv_maxPing->current.integer )
 	{
-		Info_SetValueForKey( infostring, "maxPing", va( "%i", sv_maxPing->current.integer ) );
+		SV_SetQueryInfoValue( infostring, "maxPing", va( "%i", sv_maxPing->current.integer ), complete );
 	}
 
 	const char *gamedir = Dvar_GetString( "fs_game" );
 
 	if ( *gamedir )
 	{
-		Info_SetValueForKey( infostring, "game", gamedir );
+		SV_SetQueryInfoValue( infostring, "game", gamedir, complete );
 	}
 
 	if ( sv_allowAnonymous->current.boolean )
 	{
-		Info_SetValueForKey( infostring, "sv_allowAnonymous", va( "%i", sv_allowAnonymous->current.boolean ) );
+		SV_SetQueryInfoValue( infostring, "sv_allowAnonymous", va( "%i", sv_allowAnonymous->current.boolean ), complete );
 	}
 
 	if ( sv_disableClientConsole->current.boolean )
 	{
-		Info_SetValueForKey( infostring, "con_disabled", va("%i", sv_disableClientConsole->current.boolean) );
+		SV_SetQueryInfoValue( infostring, "con_disabled", va("%i", sv_disableClientConsole->current.boolean), complete );
 	}
 
 	const char *password = Dvar_GetString("g_password");
 
 	if ( password && *password )
 	{
-		Info_SetValueForKey(infostring, "pswrd", "1");
+		SV_SetQueryInfoValue(infostring, "pswrd", "1", complete);
 	}
 
 	int friendlyfire = Dvar_GetInt("scr_friendlyfire");
 
 	if ( friendlyfire )
 	{
-		Info_SetValueForKey(infostring, "ff", va("%i", friendlyfire));
+		SV_SetQueryInfoValue(infostring, "ff", va("%i", friendlyfire), complete);
 	}
 
 	int killcam = Dvar_GetInt("scr_killcam");
 
 	if ( killcam )
 	{
-		Info_SetValueForKey(infostring, "kc", va("%i", killcam));
+		SV_SetQueryInfoValue(infostring, "kc", va("%i", killcam), complete);
 	}
 
-	Info_SetValueForKey(infostring, "hw", va("%i", 1));
+	SV_SetQueryInfoValue(infostring, "hw", va("%i", 1), complete);
 
 	if ( !sv_pure->current.boolean || gamedir && *gamedir )
 	{
@@ -608,66 +912,106 @@ void SVC_Info( netadr_t from )
 		}
 	}
 
-	Info_SetValueForKey(infostring, "mod", va("%i", serverModded));
-	Info_SetValueForKey(infostring, "voice", va("%i", sv_voice->current.boolean));
-
-	I_strncpyz(infosend, "infoResponse\n", MAX_INFO_STRING);
-	I_strncat(infosend, MAX_INFO_STRING, infostring);
-
-	NET_OutOfBandPrint(NS_SERVER, from, infosend);
+	SV_SetQueryInfoValue(infostring, "mod", va("%i", serverModded), complete);
+	SV_SetQueryInfoValue(infostring, "voice", va("%i", sv_voice->current.boolean), complete);
 }
 
 /*
 ================
-SVC_Status
-Responds with all the info that qplug or qspy can see about the server
-and all connected players.  Used for getting detailed information after
-the simple info query.
+SVC_Info
+Responds with a short info message that should be enough to determine
+if a user is interested in a server to do a full status
 ================
 */
-void SVC_Status( netadr_t from )
+void SVC_Info( netadr_t from )
 {
-	int i;
-	char infostring[8192];
-	char msg[8192];
-	char keywords[MAX_INFO_STRING];
-	char status[MAX_MSGLEN];
-	client_t    *cl;
-	int statusLength;
-	int playerLength;
-	char player[MAX_INFO_STRING];
-	int count;
+	char infostring[MAX_INFO_STRING];
+	char infosend[MAX_INFO_STRING];
+	qboolean complete;
 
 #if LIBCOD_COMPILE_RATELIMITER == 1
 	extern leakyBucket_t outboundLeakyBucket;
-	// Prevent using getstatus as an amplifier
+	// Prevent using getinfo as an amplifier
 	if ( SVC_RateLimitAddress( from, 10, 1000 ) )
 	{
-		Com_DPrintf( "SVC_Status: rate limit from %s exceeded, dropping request\n", NET_AdrToString( from ) );
+		Com_DPrintf( "SVC_Info: rate limit from %s exceeded, dropping request\n", NET_AdrToString( from ) );
 		return;
 	}
 
-	// Allow getstatus to be DoSed relatively easily, but prevent
+	// Allow getinfo to be DoSed relatively easily, but prevent
 	// excess outbound bandwidth usage when being flooded inbound
 	if ( SVC_RateLimit( &outboundLeakyBucket, 10, 100 ) )
 	{
-		Com_DPrintf( "SVC_Status: rate limit exceeded, dropping request\n" );
+		Com_DPrintf( "SVC_Info: rate limit exceeded, dropping request\n" );
 		return;
 	}
 #endif
 
+	if ( sv_queryCache->current.boolean )
+	{
+		SV_CheckQueryClients();
+
+		if ( svInfoCache.valid && svInfoCache.dvarCount == dvar_modifiedCount )
+		{
+			if ( SV_SendQueryResponse(&svInfoCache, from, Cmd_Argv(1)) )
+			{
+				svQueryHits++;
+				return;
+			}
+
+			svQueryBypass++;
+		}
+		else
+		{
+			svQueryMisses++;
+
+			SV_BuildInfoString(infostring, QUERY_CHALLENGE_PLACEHOLDER, &complete);
+			SV_StoreQueryResponse(&svInfoCache, "infoResponse\n", infostring, NULL, complete, MAX_INFO_STRING);
+
+			if ( SV_SendQueryResponse(&svInfoCache, from, Cmd_Argv(1)) )
+			{
+				return;
+			}
+		}
+	}
+
+	SV_BuildInfoString(infostring, Cmd_Argv(1), &complete);
+
+	I_strncpyz(infosend, "infoResponse\n", MAX_INFO_STRING);
+	I_strncat(infosend, MAX_INFO_STRING, infostring);
+
+	NET_OutOfBandPrint(NS_SERVER, from, infosend);
+}
+
+/*
+================
+SV_BuildStatusString
+================
+*/
+static void SV_BuildStatusString( char *infostring, char *status, const char *challenge, qboolean *complete )
+{
+	int i;
+	char keywords[MAX_INFO_STRING];
+	client_t    *cl;
+	int statusLength;
+	int playerLength;
+	char player[MAX_INFO_STRING];
+	int count;
+
+	*complete = qtrue;
+
 	qboolean serverModded = qfalse;
 	strcpy( infostring, Dvar_InfoString(DVAR_SERVERINFO | DVAR_SERVERINFO_NOUPDATE) );
 
 	// echo back the parameter to status. so master servers can use it as a challenge
 	// to prevent timed spoofed reply packets that add ghost servers
-	Info_SetValueForKey( infostring, "challenge", Cmd_Argv( 1 ) );
+	SV_SetQueryInfoValue( infostring, "challenge", challenge, complete );
 
 	// add "demo" to the sv_keywords if restricted
 	if ( Dvar_GetBool( "fs_restrict" ) )
 	{
 		Com_sprintf(keywords, sizeof( keywords ), "demo %s", Info_ValueForKey(infostring, "sv_keywords"));
-		Info_SetValueForKey(infostring, "sv_keywords", keywords);
+		SV_SetQueryInfoValue(infostring, "sv_keywords", keywords, complete);
 	}
 
 	status[0] = 0;
@@ -684,7 +1028,7 @@ void SVC_Status( netadr_t from )
 				Com_sprintf( player, sizeof( player ), "%i %i \"%s\"\n", 0, cl->ping, cl->name );
 
 			playerLength = strlen( player );
-			if ( statusLength + playerLength >= sizeof( status ) )
+			if ( statusLength + playerLength >= MAX_MSGLEN )
 			{
 				break;      // can't hold any more
 			}
@@ -696,9 +1040,9 @@ void SVC_Status( netadr_t from )
 	const char *password = Dvar_GetString("g_password");
 
 	if ( password && *password )
-		Info_SetValueForKey(infostring, "pswrd", "1");
+		SV_SetQueryInfoValue(infostring, "pswrd", "1", complete);
 	else
-		Info_SetValueForKey(infostring, "pswrd", "0");
+		SV_SetQueryInfoValue(infostring, "pswrd", "0", complete);
 
 	const char *gamedir = Dvar_GetString("fs_game");
 
@@ -728,7 +1072,71 @@ void SVC_Status( netadr_t from )
 		}
 	}
 
-	Info_SetValueForKey(infostring, "mod", va("%i", serverModded));
+	SV_SetQueryInfoValue(infostring, "mod", va("%i", serverModded), complete);
+}
+
+/*
+================
+SVC_Status
+Responds with all the info that qplug or qspy can see about the server
+and all connected players.  Used for getting detailed information after
+the simple info query.
+================
+*/
+void SVC_Status( netadr_t from )
+{
+	char infostring[MAX_STATUS_STRING];
+	char msg[MAX_STATUS_STRING];
+	char status[MAX_MSGLEN];
+	qboolean complete;
+
+#if LIBCOD_COMPILE_RATELIMITER == 1
+	extern leakyBucket_t outboundLeakyBucket;
+	// Prevent using getstatus as an amplifier
+	if ( SVC_RateLimitAddress( from, 10, 1000 ) )
+	{
+		Com_DPrintf( "SVC_Status: rate limit from %s exceeded, dropping request\n", NET_AdrToString( from ) );
+		return;
+	}
+
+	// Allow getstatus to be DoSed relatively easily, but prevent
+	// excess outbound bandwidth usage when being flooded inbound
+	if ( SVC_RateLimit( &outboundLeakyBucket, 10, 100 ) )
+	{
+		Com_DPrintf( "SVC_Status: rate limit exceeded, dropping request\n" );
+		return;
+	}
+#endif
+
+	if ( sv_queryCache->current.boolean )
+	{
+		SV_CheckQueryClients();
+
+		if ( svStatusCache.valid && svStatusCache.dvarCount == dvar_modifiedCount )
+		{
+			if ( SV_SendQueryResponse(&svStatusCache, from, Cmd_Argv(1)) )
+			{
+				svQueryHits++;
+				return;
+			}
+
+			svQueryBypass++;
+		}
+		else
+		{
+			svQueryMisses++;
+
+			SV_BuildStatusString(infostring, status, QUERY_CHALLENGE_PLACEHOLDER, &complete);
+			SV_StoreQueryResponse(&svStatusCache, "statusResponse\n", infostring, status, complete, MAX_STATUS_STRING);
+
+			if ( SV_SendQueryResponse(&svStatusCache, from, Cmd_Argv(1)) )
+			{
+				return;
+			}
+		}
+	}
+
+	SV_BuildStatusString(infostring, status, Cmd_Argv(1), &complete);
 
 	Com_sprintf(msg, sizeof(infostring), "statusResponse\n%s\n%s", infostring, status);
 	NET_OutOfBandPrint(NS_SERVER, from, msg);
@@ -853,6 +1261,182 @@ void SV_ConnectionlessPacket( netadr_t from, msg_t *msg )
 	}
 }
 
+/*
+=============================================================================
+
+Client address hash
+
+Sequenced packets are matched to their client through a hash of the base
+address and qport instead of comparing every slot. The UDP port of an IP
+address is not part of the key, so a translated port being fixed up
+doesn't move the client. Chains are only a hint: every candidate is still
+checked against the slot, and a miss falls back to the full scan.
+
+=============================================================================
+*/
+
+#define CLIENT_ADDRESS_HASH_SIZE 256
+
+static int svClientAddressHash[CLIENT_ADDRESS_HASH_SIZE];	// slot + 1, 0 ends the chain
+static int svClientAddressNext[MAX_CLIENTS];
+static int svClientAddressBucket[MAX_CLIENTS];	// bucket + 1, 0 if not linked
+
+/*
+=================
+SV_HashClientAddress
+=================
+*/
+static int SV_HashClientAddress( const netadr_t *adr, int qport )
+{
+	unsigned int hash;
+	int i;
+
+	hash = (2166136261u ^ adr->type) * 16777619u;
+	hash = (hash ^ (unsigned short)qport) * 16777619u;
+
+	if ( adr->type == NA_IP )
+	{
+		for ( i = 0; i < 4; i++ )
+			hash = (hash ^ adr->ip[i]) * 16777619u;
+	}
+	else if ( adr->type == NA_IPX )
+	{
+		for ( i = 0; i < 10; i++ )
+			hash = (hash ^ adr->ipx[i]) * 16777619u;
+	}
+	else
+	{
+		// loopback and bot addresses are told apart by port
+		hash = (hash ^ adr->port) * 16777619u;
+	}
+
+	return (hash ^ (hash >> 16)) & (CLIENT_ADDRESS_HASH_SIZE - 1);
+}
+
+/*
+=================
+SV_UnlinkClientAddress
+=================
+*/
+void SV_UnlinkClientAddress( client_t *cl )
+{
+	int clientNum;
+	int *link;
+
+	clientNum = cl - svs.clients;
+	assert(clientNum >= 0 && clientNum < MAX_CLIENTS);
+
+	if ( !svClientAddressBucket[clientNum] )
+		return;
+
+	for ( link = &svClientAddressHash[svClientAddressBucket[clientNum] - 1]; *link; link = &svClientAddressNext[*link - 1] )
+	{
+		if ( *link - 1 == clientNum )
+		{
+			*link = svClientAddressNext[clientNum];
+			break;
+		}
+	}
+
+	svClientAddressBucket[clientNum] = 0;
+}
+
+/*
+=================
+SV_LinkClientAddress
+=================
+*/
+void SV_LinkClientAddress( client_t *cl )
+{
+	int clientNum;
+	int bucket;
+
+	clientNum = cl - svs.clients;
+	assert(clientNum >= 0 && clientNum < MAX_CLIENTS);
+
+	SV_UnlinkClientAddress(cl);
+
+	bucket = SV_HashClientAddress(&cl->netchan.remoteAddress, cl->netchan.qport);
+	svClientAddressNext[clientNum] = svClientAddressHash[bucket];
+	svClientAddressHash[bucket] = clientNum + 1;
+	svClientAddressBucket[clientNum] = bucket + 1;
+}
+
+/*
+=================
+SV_ClearClientAddresses
+=================
+*/
+void SV_ClearClientAddresses()
+{
+	Com_Memset(svClientAddressHash, 0, sizeof(svClientAddressHash));
+	Com_Memset(svClientAddressBucket, 0, sizeof(svClientAddressBucket));
+}
+
+/*
+=================
+SV_IsPacketFromClient
+=================
+*/
+static bool SV_IsPacketFromClient( client_t *cl, netadr_t from, int qport )
+{
+	if ( cl->state == CS_FREE )
+	{
+		return false;
+	}
+
+	if ( !NET_CompareBaseAdr( from, cl->netchan.remoteAddress ) )
+	{
+		return false;
+	}
+
+	// it is possible to have multiple clients from a single IP
+	// address, so they are differentiated by the qport variable
+	return cl->netchan.qport == qport;
+}
+
+/*
+=================
+SV_ClientForPacket
+
+Returns the lowest numbered client the packet matches, like a scan of all
+slots would
+=================
+*/
+static client_t *SV_ClientForPacket( netadr_t from, int qport )
+{
+	int i;
+	int slot;
+	int best;
+	client_t *cl;
+
+	best = sv_maxclients->current.integer;
+
+	for ( slot = svClientAddressHash[SV_HashClientAddress(&from, qport)]; slot; slot = svClientAddressNext[slot - 1] )
+	{
+		if ( slot - 1 < best && SV_IsPacketFromClient(&svs.clients[slot - 1], from, qport) )
+		{
+			best = slot - 1;
+		}
+	}
+
+	if ( best < sv_maxclients->current.integer )
+	{
+		return &svs.clients[best];
+	}
+
+	for ( i = 0, cl = svs.clients ; i < sv_maxclients->current.integer ; i++,cl++ )
+	{
+		if ( SV_IsPacketFromClient(cl, from, qport) )
+		{
+			SV_LinkClientAddress(cl);
+			return cl;
+		}
+	}
+
+	return NULL;
+}
+
 /*
 =================
 SV_PacketEvent
@@ -860,7 +1444,6 @@ SV_PacketEvent
 */
 void SV_PacketEvent( netadr_t from, msg_t *msg )
 {
-	int i;
 	client_t    *cl;
 	int qport;
 
@@ -880,25 +1463,10 @@ void SV_PacketEvent( netadr_t from, msg_t *msg )
 	qport = (unsigned short)MSG_ReadShort(msg);
 
 	// find which client the message is from
-	for ( i = 0, cl = svs.clients ; i < sv_maxclients->current.integer ; i++,cl++ )
-	{
-		if ( cl->state == CS_FREE )
-		{
-			continue;
-		}
-
-		if ( !NET_CompareBaseAdr( from, cl->netchan.remoteAddress ) )
-		{
-			continue;
-		}
-
-		// it is possible to have multiple clients from a single IP
-		// address, so they are differentiated by the qport variable
-		if ( cl->netchan.qport != qport )
-		{
-			continue;
-		}
+	cl = SV_ClientForPacket( from, qport );
 
+	if ( cl )
+	{
 		// the IP port can't be used to differentiate them, because
 		// some address translating routers periodically change UDP
 		// port assignments
@@ -1026,6 +1594,24 @@ void SV_RunFrame()
 	G_RunFrame(svs.time);
 }
 
+/*
+==================
+SV_FrameMsecRemaining
+
+Returns how many msec SV_Frame has to accumulate before it runs
+the next game frame, or -1 if there is no server running
+==================
+*/
+int SV_FrameMsecRemaining()
+{
+	if ( !com_sv_running->current.boolean )
+	{
+		return -1;
+	}
+
+	return 1000 / sv_fps->current.integer - sv.timeResidual;
+}
+
 /*
 ==================
 SV_Frame
@@ -1150,6 +1736,9 @@ void SV_Frame( int msec )
 		return;
 	}
 
+	// everything sent from here on goes out in one batch at the end of the frame
+	NET_BeginSendBatch();
+
 	// update infostrings if anything has been changed
 	if ( (dvar_modifiedFlags & (DVAR_SERVERINFO | DVAR_SERVERINFO_NOUPDATE)) )
 	{
@@ -1214,4 +1803,9 @@ void SV_Frame( int msec )
 #else
 	SV_MasterHeartbeat( HEARTBEAT_GAME );
 #endif
+
+	// read the next map ahead if it is time to
+	SV_CheckNextMapPrefetch();
+
+	NET_FlushSendBatch();
 }
\ No newline at end of file
@@ -1,4 +1,7 @@
 #include "../qcommon/qcommon.h"
+#include "../qcommon/sys_thread.h"
+
+static void SV_DeltaCacheBeginFrame( void );
 
 /*
 ===============
@@ -75,6 +78,50 @@ void SV_UpdateServerCommandsToClient( client_t *client, msg_t *msg )
 	client->reliableSent = client->reliableSequence;
 }
 
+// origin of every client in the most recent archived frames, so antilag
+// doesn't have to pull whole playerstates out of the cached snapshots
+#define CLIENT_POSITION_HISTORY     128
+
+typedef struct
+{
+	int archivedFrame;      // -1 if the client had no playerstate in it
+	vec3_t origin;
+} clientPositionSample_t;
+
+static clientPositionSample_t clientPositionHistory[MAX_CLIENTS][CLIENT_POSITION_HISTORY];
+
+/*
+===============
+SV_ClearClientPositionHistory
+===============
+*/
+void SV_ClearClientPositionHistory()
+{
+	int i, j;
+
+	for ( i = 0; i < MAX_CLIENTS; i++ )
+	{
+		for ( j = 0; j < CLIENT_POSITION_HISTORY; j++ )
+		{
+			clientPositionHistory[i][j].archivedFrame = -1;
+		}
+	}
+}
+
+/*
+===============
+SV_RecordClientPosition
+===============
+*/
+static void SV_RecordClientPosition( int clientNum, const playerState_t *ps )
+{
+	clientPositionSample_t *sample;
+
+	sample = &clientPositionHistory[clientNum][svs.nextArchivedSnapshotFrames % CLIENT_POSITION_HISTORY];
+	sample->archivedFrame = svs.nextArchivedSnapshotFrames;
+	VectorCopy(ps->origin, sample->origin);
+}
+
 /*
 ==================
 SV_ArchiveSnapshot
@@ -114,6 +161,11 @@ void SV_ArchiveSnapshot()
 
 	MSG_Init(&msg, msg_buf, sizeof(msg_buf));
 
+	for ( i = 0; i < MAX_CLIENTS; i++ )
+	{
+		clientPositionHistory[i][svs.nextArchivedSnapshotFrames % CLIENT_POSITION_HISTORY].archivedFrame = -1;
+	}
+
 	int n = svs.nextCachedSnapshotFrames - NUM_CACHED_FRAMES;
 
 	if ( svs.nextCachedSnapshotFrames - NUM_CACHED_FRAMES < 0 )
@@ -186,6 +238,7 @@ void SV_ArchiveSnapshot()
 
 				if ( GetFollowPlayerState(clientNum, &ps) )
 				{
+					SV_RecordClientPosition(clientNum, &ps);
 					MSG_WriteBit1(&msg);
 					MSG_WriteDeltaPlayerstate(&msg, &cachedClient2->ps, &ps, clientNum);
 				}
@@ -215,6 +268,7 @@ void SV_ArchiveSnapshot()
 
 				if ( GetFollowPlayerState(clientNum, &ps) )
 				{
+					SV_RecordClientPosition(clientNum, &ps);
 					MSG_WriteBit1(&msg);
 					MSG_WriteDeltaPlayerstate(&msg, NULL, &ps, clientNum);
 				}
@@ -360,6 +414,8 @@ void SV_ArchiveSnapshot()
 
 		if ( cachedClient2->playerStateExists )
 		{
+			SV_RecordClientPosition(i, &cachedClient2->ps);
+
 			MSG_WriteBit1(&msg);
 			MSG_WriteDeltaPlayerstate(&msg, NULL, &cachedClient2->ps, i);
 		}
@@ -612,6 +668,49 @@ qboolean SV_GetArchivedClientInfo( int clientNum, int *pArchiveTime, playerState
 	return qtrue;
 }
 
+/*
+===============
+SV_GetArchivedClientPosition
+
+Same lookup as SV_GetArchivedClientInfo, but only the origin is needed,
+which the position history has for the recent frames
+===============
+*/
+static qboolean SV_GetArchivedClientPosition( int clientNum, int *pArchiveTime, vec3_t origin )
+{
+	const clientPositionSample_t *sample;
+	int archivedFrame;
+	playerState_t ps;
+	clientState_t cs;
+
+	if ( svs.archiveEnabled && *pArchiveTime > 0 )
+	{
+		archivedFrame = svs.nextArchivedSnapshotFrames - sv_fps->current.integer * *pArchiveTime / 1000;
+
+		if ( archivedFrame >= 0 && archivedFrame < svs.nextArchivedSnapshotFrames
+		        && archivedFrame >= svs.nextArchivedSnapshotFrames - CLIENT_POSITION_HISTORY )
+		{
+			sample = &clientPositionHistory[clientNum][archivedFrame % CLIENT_POSITION_HISTORY];
+
+			if ( sample->archivedFrame != archivedFrame )
+			{
+				return qfalse;
+			}
+
+			VectorCopy(sample->origin, origin);
+			return qtrue;
+		}
+	}
+
+	if ( !SV_GetArchivedClientInfo(clientNum, pArchiveTime, &ps, &cs) )
+	{
+		return qfalse;
+	}
+
+	VectorCopy(ps.origin, origin);
+	return qtrue;
+}
+
 /*
 ===============
 SV_GetClientPositionsAtTime
@@ -623,8 +722,6 @@ bool SV_GetClientPositionsAtTime( int clientNum, int gametime, vec3_t pos )
 	int frameHistCount;
 	int frameTime;
 	int i;
-	clientState_t cs;
-	playerState_t ps;
 	bool foundEnd;
 	bool foundStart;
 	vec3_t endPos;
@@ -646,11 +743,10 @@ bool SV_GetClientPositionsAtTime( int clientNum, int gametime, vec3_t pos )
 
 	for ( i = 0; i < 10; ++i )
 	{
-		if ( SV_GetArchivedClientInfo(clientNum, &pArchiveTime, &ps, &cs) )
+		if ( SV_GetArchivedClientPosition(clientNum, &pArchiveTime, startPos) )
 		{
 			foundStart = true;
 			startOffset = pArchiveTime;
-			memcpy(startPos, ps.origin, sizeof(startPos));
 			break;
 		}
 
@@ -661,11 +757,10 @@ bool SV_GetClientPositionsAtTime( int clientNum, int gametime, vec3_t pos )
 
 	for ( i = 0; i < 10; ++i )
 	{
-		if ( SV_GetArchivedClientInfo(clientNum, &pArchiveTime, &ps, &cs) )
+		if ( SV_GetArchivedClientPosition(clientNum, &pArchiveTime, endPos) )
 		{
 			foundEnd = true;
 			endOffset = pArchiveTime;
-			memcpy(endPos, ps.origin, sizeof(endPos));
 			break;
 		}
 
@@ -748,21 +843,25 @@ static int SV_RateMsec( client_t *client, int messageSize )
 
 /*
 =======================
-SV_SendMessageToClient
-Called by SV_SendClientSnapshot and SV_SendClientGameState
+SV_CompressClientMessage
 =======================
 */
-void SV_SendMessageToClient( msg_t *msg, client_t *client )
+static int SV_CompressClientMessage( msg_t *msg, byte *svCompressBuf )
 {
-	byte svCompressBuf[MAX_MSGLEN];
-	int compressedSize;
-	int rateMsec;
-
-	assert(client - svs.clients >= 0 && client - svs.clients < MAX_CLIENTS);
 	assert(msg->cursize >= SV_ENCODE_START);
 
 	memcpy(svCompressBuf, msg->data, SV_ENCODE_START);
-	compressedSize = MSG_WriteBitsCompress(msg->data + SV_ENCODE_START, svCompressBuf + SV_ENCODE_START, msg->cursize - SV_ENCODE_START) + SV_ENCODE_START;
+	return MSG_WriteBitsCompress(msg->data + SV_ENCODE_START, svCompressBuf + SV_ENCODE_START, msg->cursize - SV_ENCODE_START) + SV_ENCODE_START;
+}
+
+/*
+=======================
+SV_TransmitCompressedMessageToClient
+=======================
+*/
+static void SV_TransmitCompressedMessageToClient( client_t *client, byte *svCompressBuf, int compressedSize )
+{
+	int rateMsec;
 
 	if ( client->dropReason )
 	{
@@ -833,6 +932,54 @@ void SV_SendMessageToClient( msg_t *msg, client_t *client )
 	sv.bpsTotalBytes += compressedSize;
 }
 
+/*
+=======================
+SV_SendMessageToClient
+Called by SV_SendClientSnapshot and SV_SendClientGameState
+=======================
+*/
+void SV_SendMessageToClient( msg_t *msg, client_t *client )
+{
+	byte svCompressBuf[MAX_MSGLEN];
+	int compressedSize;
+
+	assert(client - svs.clients >= 0 && client - svs.clients < MAX_CLIENTS);
+
+	compressedSize = SV_CompressClientMessage(msg, svCompressBuf);
+	SV_TransmitCompressedMessageToClient(client, svCompressBuf, compressedSize);
+}
+
+/*
+=======================
+SV_RecoverClientMessageOverflow
+=======================
+*/
+static void SV_RecoverClientMessageOverflow( client_t *client, msg_t *msg, byte *msg_buf, int msg_len )
+{
+	Com_Printf("WARNING: msg overflowed for %s, trying to recover\n", client->name);
+
+	//bani
+	if ( client->state == CS_ACTIVE || client->state == CS_ZOMBIE )
+	{
+		SV_PrintServerCommandsForClient(client);
+
+		MSG_Init(msg, msg_buf, msg_len);
+		MSG_WriteLong(msg, client->lastClientCommand);
+
+		SV_UpdateServerCommandsToClient_PreventOverflow(client, msg, msg_len);
+
+		MSG_WriteByte(msg, svc_EOF);
+	}
+
+	// check for overflow
+	if ( msg->overflowed )
+	{
+		Com_Printf("WARNING: client disconnected for msg overflow: %s\n", client->name);
+		NET_OutOfBandPrint(NS_SERVER, client->netchan.remoteAddress, "disconnect");
+		SV_DropClient(client, "EXE_SERVERMESSAGEOVERFLOW");
+	}
+}
+
 /*
 =======================
 SV_SendClientSnapshot
@@ -881,33 +1028,57 @@ void SV_SendClientSnapshot( client_t *client )
 	// check for overflow
 	if ( msg.overflowed )
 	{
-		Com_Printf("WARNING: msg overflowed for %s, trying to recover\n", client->name);
-
-		//bani
-		if ( client->state == CS_ACTIVE || client->state == CS_ZOMBIE )
-		{
-			SV_PrintServerCommandsForClient(client);
-
-			MSG_Init(&msg, msg_buf, sizeof(msg_buf));
-			MSG_WriteLong(&msg, client->lastClientCommand);
+		SV_RecoverClientMessageOverflow(client, &msg, msg_buf, sizeof(msg_buf));
+	}
 
-			SV_UpdateServerCommandsToClient_PreventOverflow(client, &msg, sizeof(msg_buf));
+	SV_SendMessageToClient( &msg, client );
+}
 
-			MSG_WriteByte(&msg, svc_EOF);
+/*
+=======================
+SV_SendClientMessage
+=======================
+*/
+static void SV_SendClientMessage( client_t *c )
+{
+#ifdef LIBCOD
+	for ( int j = 0; j < MAX_DOWNLOAD_WINDOW; j++ )
+	{
+		if ( !sv_fastDownload->current.boolean || !*c->downloadName || c->downloadingWWW || c->clientDownloadingWWW )
+		{
+			j = MAX_DOWNLOAD_WINDOW;
 		}
 
-		// check for overflow
-		if ( msg.overflowed )
+		// send additional message fragments if the last message
+		// was too large to send at once
+		while ( c->netchan.unsentFragments )
 		{
-			Com_Printf("WARNING: client disconnected for msg overflow: %s\n", client->name);
-			NET_OutOfBandPrint(NS_SERVER, client->netchan.remoteAddress, "disconnect");
-			SV_DropClient(client, "EXE_SERVERMESSAGEOVERFLOW");
+			c->nextSnapshotTime = svs.time + SV_RateMsec( c, c->netchan.unsentLength - c->netchan.unsentFragmentStart );
+			SV_Netchan_TransmitNextFragment(&c->netchan);
 		}
+
+		// generate and send a new message
+		SV_SendClientSnapshot( c );
+	}
+	SV_SendClientVoiceData( c );
+#else
+	// send additional message fragments if the last message
+	// was too large to send at once
+	if ( c->netchan.unsentFragments )
+	{
+		c->nextSnapshotTime = svs.time + SV_RateMsec( c, c->netchan.unsentLength - c->netchan.unsentFragmentStart );
+		SV_Netchan_TransmitNextFragment(&c->netchan);
+		return;
 	}
 
-	SV_SendMessageToClient( &msg, client );
+	// generate and send a new message
+	SV_SendClientSnapshot( c );
+	SV_SendClientVoiceData( c );
+#endif
 }
 
+static bool SV_SendClientMessagesParallel( int *numclients );
+
 /*
 =======================
 SV_SendClientMessages
@@ -922,57 +1093,29 @@ void SV_SendClientMessages( void )
 	sv.bpsTotalBytes = 0;       // NERVE - SMF - net debugging
 	sv.ubpsTotalBytes = 0;      // NERVE - SMF - net debugging
 
-	// send a message to each connected client
-	for ( i = 0; i < sv_maxclients->current.integer; i++ )
-	{
-		c = &svs.clients[i];
-
-		if ( !c->state )
-		{
-			continue;       // not connected
-		}
+	SV_DeltaCacheBeginFrame();
 
-		if ( svs.time < c->nextSnapshotTime )
+	if ( !SV_SendClientMessagesParallel( &numclients ) )
+	{
+		// send a message to each connected client
+		for ( i = 0; i < sv_maxclients->current.integer; i++ )
 		{
-			continue;       // not time yet
-		}
-
-		numclients++;       // NERVE - SMF - net debugging
+			c = &svs.clients[i];
 
-#ifdef LIBCOD
-		for ( int j = 0; j < MAX_DOWNLOAD_WINDOW; j++ )
-		{
-			if ( !sv_fastDownload->current.boolean || !*c->downloadName || c->downloadingWWW || c->clientDownloadingWWW )
+			if ( !c->state )
 			{
-				j = MAX_DOWNLOAD_WINDOW;
+				continue;       // not connected
 			}
 
-			// send additional message fragments if the last message
-			// was too large to send at once
-			while ( c->netchan.unsentFragments )
+			if ( svs.time < c->nextSnapshotTime )
 			{
-				c->nextSnapshotTime = svs.time + SV_RateMsec( c, c->netchan.unsentLength - c->netchan.unsentFragmentStart );
-				SV_Netchan_TransmitNextFragment(&c->netchan);
+				continue;       // not time yet
 			}
 
-			// generate and send a new message
-			SV_SendClientSnapshot( c );
-		}
-		SV_SendClientVoiceData( c );
-#else
-		// send additional message fragments if the last message
-		// was too large to send at once
-		if ( c->netchan.unsentFragments )
-		{
-			c->nextSnapshotTime = svs.time + SV_RateMsec( c, c->netchan.unsentLength - c->netchan.unsentFragmentStart );
-			SV_Netchan_TransmitNextFragment(&c->netchan);
-			continue;
-		}
+			numclients++;       // NERVE - SMF - net debugging
 
-		// generate and send a new message
-		SV_SendClientSnapshot( c );
-		SV_SendClientVoiceData( c );
-#endif
+			SV_SendClientMessage( c );
+		}
 	}
 
 	// NERVE - SMF - net debugging
@@ -1085,106 +1228,387 @@ qboolean SV_GetCurrentClientInfo( int clientNum, playerState_t *ps, clientState_
 }
 
 /*
-===============
-SV_AddCachedEntitiesVisibleFromPoint
-===============
+=============================================================================
+
+PVS visibility index
+
+SV_LinkEntity folds every entity's clusters into PVS row words
+(sv_entityClusters), and the set of entities visible from a viewer cluster
+is built once and shared by every client standing in that cluster until an
+entity changes its cluster set. Archived entities only have a box, so their
+clusters are remembered per cached entity slot instead of running
+CM_BoxLeafnums for every client that views them.
+
+=============================================================================
 */
-void SV_AddCachedEntitiesVisibleFromPoint( int from_num_entities, int from_first_entity, vec3_t origin, int clientNum, snapshotEntityNumbers_t *eNums )
-{
-	int e, i, l;
-	int clientcluster;
-	int leafnum, boxleafnums;
-	byte    *clientpvs;
-	byte    *bitvector;
-	float fogOpaqueDistSqrd;
-	int clusternums[MAX_TOTAL_ENT_LEAFS];
-	int lastLeaf;
-	archivedEntity_t *ent;
 
-	assert(SV_Loaded());
+#define PVS_CACHE_SIZE  64
 
-	leafnum = CM_PointLeafnum( origin );
-	clientcluster = CM_LeafCluster( leafnum );
+typedef struct
+{
+	int cluster;
+	int sequence;
+	int numEntities;
+	unsigned int visible[MAX_GENTITIES / 32];
+} pvsCacheEntry_t;
 
-	if ( clientcluster < 0 )
-	{
-		return;
-	}
+static pvsCacheEntry_t pvsCache[PVS_CACHE_SIZE];
+static qboolean pvsCacheFrozen;
 
-	clientpvs = CM_ClusterPVS( clientcluster );
-	fogOpaqueDistSqrd = G_GetFogOpaqueDistSqrd();
+typedef struct
+{
+	int key;            // absolute cached entity index + 1, 0 if unused
+	int numClusters;    // -1 if the box touches too many clusters to store
+	int clusters[MAX_ENT_CLUSTERS];
+} cachedEntityClusters_t;
 
-	if ( fogOpaqueDistSqrd == FLT_MAX )
+static cachedEntityClusters_t *cachedEntityClusters;
+
+/*
+===============
+SV_ClearCachedEntityClusters
+===============
+*/
+void SV_ClearCachedEntityClusters()
+{
+	if ( cachedEntityClusters )
 	{
-		fogOpaqueDistSqrd = 0;
+		Com_Memset(cachedEntityClusters, 0, sizeof(cachedEntityClusters_t) * CACHED_SNAPSHOT_ENTITY_SIZE);
 	}
+}
 
-	for ( e = 0 ; e < from_num_entities ; e++ )
+/*
+===============
+SV_FreeCachedEntityClusters
+===============
+*/
+void SV_FreeCachedEntityClusters()
+{
+	if ( cachedEntityClusters )
 	{
-		ent = &svs.cachedSnapshotEntities[(e + from_first_entity) % CACHED_SNAPSHOT_ENTITY_SIZE];
-		//assert(!entityIndex[ent->s.number]);
+		Z_Free(cachedEntityClusters);
+		cachedEntityClusters = NULL;
+	}
+}
 
-		if ( (1 << (clientNum & 31)) & ent->r.clientMask[clientNum >> 5] || ent->s.number == clientNum )
-		{
-			continue;
-		}
+/*
+===============
+SV_IsEntityInClusterPVS
 
-		if ( ent->r.svFlags & 0x18 )
-		{
-			SV_AddArchivedEntToSnapshot( e, eNums );
-			continue;
-		}
+The original per cluster test, including the way overflowed
+lastCluster ranges have always been handled
+===============
+*/
+static qboolean SV_IsEntityInClusterPVS( const svEntity_t *svEnt, const byte *bitvector )
+{
+	int i, l;
 
-		boxleafnums = CM_BoxLeafnums(ent->r.absmin, ent->r.absmax, clusternums, sizeof(clusternums) / sizeof(clusternums[0]), &lastLeaf);
+	if ( !svEnt->numClusters )
+	{
+		return qfalse;
+	}
 
-		if ( !boxleafnums )
-		{
-			continue;
-		}
+	l = 0;
 
-		bitvector = clientpvs;
+	for ( i = 0 ; i < svEnt->numClusters ; i++ )
+	{
+		l = svEnt->clusternums[i];
 
-		for ( i = 0 ; i < boxleafnums ; i++ )
+		if ( bitvector[l >> 3] & ( 1 << ( l & 7 ) ) )
 		{
-			l = CM_LeafCluster(clusternums[i]);
-
-			if ( bitvector[l >> 3] & ( 1 << ( l & 7 ) ) && l != -1 )
-			{
-				break;
-			}
+			return qtrue;
 		}
+	}
 
-		if ( i == boxleafnums )
-		{
-			continue;
-		}
+	// if we haven't found it to be visible,
+	// check overflow clusters that coudln't be stored
+	if ( !svEnt->lastCluster )
+	{
+		return qfalse;
+	}
 
-		if ( !(fogOpaqueDistSqrd == 0 || BoxDistSqrdExceeds(ent->r.absmin, ent->r.absmax, origin, fogOpaqueDistSqrd) == qfalse) )
+	for ( ; l <= svEnt->lastCluster ; l++ )
+	{
+		if ( bitvector[l >> 3] & ( 1 << ( l & 7 ) ) )
 		{
-			continue;
+			break;
 		}
-
-		// add it
-		SV_AddArchivedEntToSnapshot( e, eNums );
 	}
+
+	return l != svEnt->lastCluster;
 }
 
 /*
 ===============
-SV_AddEntitiesVisibleFromPoint
+SV_IsEntityVisibleFromCluster
 ===============
 */
-void SV_AddEntitiesVisibleFromPoint( vec3_t origin, int clientNum, snapshotEntityNumbers_t *eNums )
+static qboolean SV_IsEntityVisibleFromCluster( int e, const byte *clientpvs )
 {
-	int e, i;
-	gentity_t *ent;
-	svEntity_t  *svEnt;
-	int l;
-	int clientcluster;
-	int leafnum;
+	const svEntityClusters_t *clusters;
+	const unsigned int *row;
+	int i;
+
+	clusters = &sv_entityClusters[e];
+
+	if ( !sv_entityClustersEnabled || clusters->numWords < 0 )
+	{
+		return SV_IsEntityInClusterPVS( &sv.svEntities[e], clientpvs );
+	}
+
+	row = (const unsigned int *)clientpvs;
+
+	for ( i = 0 ; i < clusters->numWords ; i++ )
+	{
+		if ( row[clusters->words[i].word] & clusters->words[i].mask )
+		{
+			return qtrue;
+		}
+	}
+
+	return qfalse;
+}
+
+/*
+===============
+SV_GetClusterVisibleEntities
+
+Returns the bitset of entities whose clusters are in the PVS of
+clientcluster, or NULL if it is not cached and can't be built here
+===============
+*/
+static const unsigned int* SV_GetClusterVisibleEntities( int clientcluster, const byte *clientpvs )
+{
+	pvsCacheEntry_t *entry;
+	int e;
+
+	if ( !sv_entityClustersEnabled )
+	{
+		return NULL;
+	}
+
+	entry = &pvsCache[clientcluster & ( PVS_CACHE_SIZE - 1 )];
+
+	if ( entry->cluster == clientcluster && entry->sequence == sv_entityClusterSequence && entry->numEntities == sv.num_entities )
+	{
+		return entry->visible;
+	}
+
+	// entries are only rebuilt by the main thread while no cull jobs can read them
+	if ( pvsCacheFrozen || !Sys_IsMainThread() )
+	{
+		return NULL;
+	}
+
+	Com_Memset(entry->visible, 0, sizeof(entry->visible));
+
+	for ( e = 0 ; e < sv.num_entities ; e++ )
+	{
+		if ( SV_IsEntityVisibleFromCluster( e, clientpvs ) )
+		{
+			entry->visible[e >> 5] |= 1u << ( e & 31 );
+		}
+	}
+
+	entry->cluster = clientcluster;
+	entry->sequence = sv_entityClusterSequence;
+	entry->numEntities = sv.num_entities;
+
+	return entry->visible;
+}
+
+/*
+===============
+SV_GetCachedEntityClusters
+
+Returns the clusters touched by a cached entity's box,
+or NULL if there are too many to remember
+===============
+*/
+static const cachedEntityClusters_t* SV_GetCachedEntityClusters( int index, const archivedEntity_t *ent )
+{
+	cachedEntityClusters_t *entry;
+	int leafnums[MAX_TOTAL_ENT_LEAFS];
+	int boxleafnums;
+	int lastLeaf;
+	int i, j, l;
+
+	if ( !cachedEntityClusters )
+	{
+		cachedEntityClusters = (cachedEntityClusters_t *)Z_MallocInternal(sizeof(cachedEntityClusters_t) * CACHED_SNAPSHOT_ENTITY_SIZE);
+		SV_ClearCachedEntityClusters();
+	}
+
+	entry = &cachedEntityClusters[index % CACHED_SNAPSHOT_ENTITY_SIZE];
+
+	if ( entry->key != index + 1 )
+	{
+		entry->key = index + 1;
+		entry->numClusters = 0;
+
+		boxleafnums = CM_BoxLeafnums(ent->r.absmin, ent->r.absmax, leafnums, sizeof(leafnums) / sizeof(leafnums[0]), &lastLeaf);
+
+		for ( i = 0 ; i < boxleafnums ; i++ )
+		{
+			l = CM_LeafCluster(leafnums[i]);
+
+			if ( l == -1 )
+			{
+				continue;
+			}
+
+			for ( j = 0 ; j < entry->numClusters ; j++ )
+			{
+				if ( entry->clusters[j] == l )
+				{
+					break;
+				}
+			}
+
+			if ( j < entry->numClusters )
+			{
+				continue;
+			}
+
+			if ( entry->numClusters == MAX_ENT_CLUSTERS )
+			{
+				entry->numClusters = -1;
+				break;
+			}
+
+			entry->clusters[entry->numClusters++] = l;
+		}
+	}
+
+	if ( entry->numClusters < 0 )
+	{
+		return NULL;
+	}
+
+	return entry;
+}
+
+/*
+===============
+SV_AddCachedEntitiesVisibleFromPoint
+===============
+*/
+void SV_AddCachedEntitiesVisibleFromPoint( int from_num_entities, int from_first_entity, vec3_t origin, int clientNum, snapshotEntityNumbers_t *eNums )
+{
+	int e, i, l;
+	int clientcluster;
+	int leafnum, boxleafnums;
 	byte    *clientpvs;
 	byte    *bitvector;
 	float fogOpaqueDistSqrd;
+	int clusternums[MAX_TOTAL_ENT_LEAFS];
+	int lastLeaf;
+	archivedEntity_t *ent;
+	const cachedEntityClusters_t *entClusters;
+
+	assert(SV_Loaded());
+
+	leafnum = CM_PointLeafnum( origin );
+	clientcluster = CM_LeafCluster( leafnum );
+
+	if ( clientcluster < 0 )
+	{
+		return;
+	}
+
+	clientpvs = CM_ClusterPVS( clientcluster );
+	fogOpaqueDistSqrd = G_GetFogOpaqueDistSqrd();
+
+	if ( fogOpaqueDistSqrd == FLT_MAX )
+	{
+		fogOpaqueDistSqrd = 0;
+	}
+
+	for ( e = 0 ; e < from_num_entities ; e++ )
+	{
+		ent = &svs.cachedSnapshotEntities[(e + from_first_entity) % CACHED_SNAPSHOT_ENTITY_SIZE];
+		//assert(!entityIndex[ent->s.number]);
+
+		if ( (1 << (clientNum & 31)) & ent->r.clientMask[clientNum >> 5] || ent->s.number == clientNum )
+		{
+			continue;
+		}
+
+		if ( ent->r.svFlags & 0x18 )
+		{
+			SV_AddArchivedEntToSnapshot( e, eNums );
+			continue;
+		}
+
+		bitvector = clientpvs;
+		entClusters = SV_GetCachedEntityClusters( e + from_first_entity, ent );
+
+		if ( entClusters )
+		{
+			for ( i = 0 ; i < entClusters->numClusters ; i++ )
+			{
+				l = entClusters->clusters[i];
+
+				if ( bitvector[l >> 3] & ( 1 << ( l & 7 ) ) )
+				{
+					break;
+				}
+			}
+
+			if ( i == entClusters->numClusters )
+			{
+				continue;
+			}
+		}
+		else
+		{
+			boxleafnums = CM_BoxLeafnums(ent->r.absmin, ent->r.absmax, clusternums, sizeof(clusternums) / sizeof(clusternums[0]), &lastLeaf);
+
+			if ( !boxleafnums )
+			{
+				continue;
+			}
+
+			for ( i = 0 ; i < boxleafnums ; i++ )
+			{
+				l = CM_LeafCluster(clusternums[i]);
+
+				if ( l != -1 && bitvector[l >> 3] & ( 1 << ( l & 7 ) ) )
+				{
+					break;
+				}
+			}
+
+			if ( i == boxleafnums )
+			{
+				continue;
+			}
+		}
+
+		if ( !(fogOpaqueDistSqrd == 0 || BoxDistSqrdExceeds(ent->r.absmin, ent->r.absmax, origin, fogOpaqueDistSqrd) == qfalse) )
+		{
+			continue;
+		}
+
+		// add it
+		SV_AddArchivedEntToSnapshot( e, eNums );
+	}
+}
+
+/*
+===============
+SV_AddEntitiesVisibleFromPoint
+===============
+*/
+void SV_AddEntitiesVisibleFromPoint( vec3_t origin, int clientNum, snapshotEntityNumbers_t *eNums )
+{
+	int e;
+	gentity_t *ent;
+	int clientcluster;
+	int leafnum;
+	byte    *clientpvs;
+	const unsigned int *visible;
+	float fogOpaqueDistSqrd;
 
 	assert(SV_Loaded());
 
@@ -1197,6 +1621,7 @@ void SV_AddEntitiesVisibleFromPoint( vec3_t origin, int clientNum, snapshotEntit
 	}
 
 	clientpvs = CM_ClusterPVS( clientcluster );
+	visible = SV_GetClusterVisibleEntities( clientcluster, clientpvs );
 	fogOpaqueDistSqrd = G_GetFogOpaqueDistSqrd();
 
 	if ( fogOpaqueDistSqrd == FLT_MAX )
@@ -1253,60 +1678,29 @@ void SV_AddEntitiesVisibleFromPoint( vec3_t origin, int clientNum, snapshotEntit
 			continue;
 		}
 
-		svEnt = SV_SvEntityForGentity( ent );
-		bitvector = clientpvs;
-
 		// check individual leafs
-		if ( svEnt->numClusters )
+		if ( visible )
 		{
-			l = 0;
-
-			for ( i = 0 ; i < svEnt->numClusters ; i++ )
-			{
-				l = svEnt->clusternums[i];
-
-				if ( bitvector[l >> 3] & ( 1 << ( l & 7 ) ) )
-				{
-					break;
-				}
-			}
-
-			// if we haven't found it to be visible,
-			// check overflow clusters that coudln't be stored
-			if ( i == svEnt->numClusters )
+			if ( !( visible[e >> 5] & ( 1u << ( e & 31 ) ) ) )
 			{
-				if ( svEnt->lastCluster )
-				{
-					for ( ; l <= svEnt->lastCluster ; l++ )
-					{
-						if ( bitvector[l >> 3] & ( 1 << ( l & 7 ) ) )
-						{
-							break;
-						}
-					}
-
-					if ( l == svEnt->lastCluster )
-					{
-						continue;    // not visible
-					}
-				}
-				else
-				{
-					continue;
-				}
+				continue;
 			}
+		}
+		else if ( !SV_IsEntityVisibleFromCluster( e, clientpvs ) )
+		{
+			continue;
+		}
 
-			if ( fogOpaqueDistSqrd != 0)
+		if ( fogOpaqueDistSqrd != 0)
+		{
+			if ( BoxDistSqrdExceeds(ent->r.absmin, ent->r.absmax, origin, fogOpaqueDistSqrd) )
 			{
-				if ( BoxDistSqrdExceeds(ent->r.absmin, ent->r.absmax, origin, fogOpaqueDistSqrd) )
-				{
-					continue;
-				}
+				continue;
 			}
-
-			// add it
-			SV_AddEntToSnapshot( e, eNums );
 		}
+
+		// add it
+		SV_AddEntToSnapshot( e, eNums );
 	}
 }
 
@@ -1383,6 +1777,272 @@ void SV_EmitPacketClients( int clientNum, int from_num_clients, int from_first_c
 	MSG_WriteBit0( msg );
 }
 
+/*
+=============================================================================
+
+Encoded entity delta cache
+
+Clients that acked the same snapshot, and every client seeing an entity
+whose state did not change, encode the very same from -> to delta. With
+sv_deltaCache set, the first encode of a frame records the bits once and
+later clients splice them into their message. Entries are only valid for
+the frame they were written in, and the states they were made from are
+kept so a hit is an exact match, not just a matching hash.
+
+=============================================================================
+*/
+
+#define DELTA_CACHE_WAYS        8
+#define DELTA_CACHE_ARENA_SIZE  ( 2 * 1024 * 1024 )
+#define DELTA_CACHE_MAX_ENCODED 512
+
+#define DELTA_CACHE_WRITING     1
+#define DELTA_CACHE_READY       2
+
+typedef struct
+{
+	volatile int tag;   // frame << 2 | state
+	int key;            // bit phase | force << 3
+	unsigned int hash;
+	int offset;         // from, to and the encoded bytes in svDeltaCacheArena
+	int partial;
+	int length;
+	int bit;
+} deltaCacheEntry_t;
+
+static deltaCacheEntry_t svDeltaCache[MAX_GENTITIES][DELTA_CACHE_WAYS];
+static byte svDeltaCacheArena[DELTA_CACHE_ARENA_SIZE];
+static volatile int svDeltaCacheArenaUsed;
+static int svDeltaCacheFrame;
+static qboolean svDeltaCacheActive;
+
+static volatile int svDeltaCacheHits;
+static volatile int svDeltaCacheMisses;
+static volatile int svDeltaCacheBypass;
+
+/*
+=============
+SV_DeltaCacheBeginFrame
+
+Called from the main thread before any client message of the frame is
+built, drops everything cached for the previous frame.
+=============
+*/
+static void SV_DeltaCacheBeginFrame( void )
+{
+	svDeltaCacheActive = sv_deltaCache->current.boolean;
+
+	if ( !svDeltaCacheActive )
+		return;
+
+	svDeltaCacheFrame = ( svDeltaCacheFrame + 1 ) & 0x3FFFFFFF;
+
+	if ( !svDeltaCacheFrame )
+		svDeltaCacheFrame = 1; // zeroed entries must never look current
+
+	svDeltaCacheArenaUsed = 0;
+}
+
+/*
+=============
+SV_DeltaCacheHash
+=============
+*/
+static unsigned int SV_DeltaCacheHash( const entityState_t *from, const entityState_t *to )
+{
+	const unsigned int *a = (const unsigned int *)from;
+	const unsigned int *b = (const unsigned int *)to;
+	unsigned int ha = 2166136261u;
+	unsigned int hb = 2166136261u;
+	int i;
+
+	for ( i = 0; i < (int)( sizeof(entityState_t) / sizeof(int) ); i++ )
+	{
+		ha = ( ha ^ a[i] ) * 16777619u;
+		hb = ( hb ^ b[i] ) * 16777619u;
+	}
+
+	return ha ^ ( hb * 0x9E3779B1u );
+}
+
+/*
+=============
+SV_DeltaCacheFind
+=============
+*/
+static qboolean SV_DeltaCacheFind( msg_t *msg, const entityState_t *from, const entityState_t *to, int key, unsigned int hash )
+{
+	deltaCacheEntry_t *entry;
+	const byte *stored;
+	msgSplice_t splice;
+	int ready;
+	int i;
+
+	ready = ( svDeltaCacheFrame << 2 ) | DELTA_CACHE_READY;
+
+	for ( i = 0, entry = svDeltaCache[to->number]; i < DELTA_CACHE_WAYS; i++, entry++ )
+	{
+		if ( entry->tag != ready || entry->key != key || entry->hash != hash )
+			continue;
+
+		stored = svDeltaCacheArena + entry->offset;
+
+		if ( memcmp(stored, from, sizeof(entityState_t)) || memcmp(stored + sizeof(entityState_t), to, sizeof(entityState_t)) )
+			continue;
+
+		splice.phase = key & 7;
+		splice.partial = entry->partial;
+		splice.data = stored + 2 * sizeof(entityState_t);
+		splice.length = entry->length;
+		splice.bit = entry->bit;
+
+		return MSG_WriteSplice(msg, &splice);
+	}
+
+	return qfalse;
+}
+
+/*
+=============
+SV_DeltaCacheStore
+
+Claims a way that still holds an older frame, a lost race or a full
+arena just means this delta is not shared.
+=============
+*/
+static void SV_DeltaCacheStore( const entityState_t *from, const entityState_t *to, int key, unsigned int hash, const msgSplice_t *splice )
+{
+	deltaCacheEntry_t *entry;
+	byte *stored;
+	int writing;
+	int offset;
+	int size;
+	int tag;
+	int i;
+
+	writing = ( svDeltaCacheFrame << 2 ) | DELTA_CACHE_WRITING;
+	size = ( 2 * sizeof(entityState_t) + splice->length + 3 ) & ~3;
+
+	for ( i = 0, entry = svDeltaCache[to->number]; i < DELTA_CACHE_WAYS; i++, entry++ )
+	{
+		tag = entry->tag;
+
+		if ( ( tag >> 2 ) == svDeltaCacheFrame )
+			continue;
+
+		if ( __sync_bool_compare_and_swap(&entry->tag, tag, writing) )
+			break;
+	}
+
+	if ( i == DELTA_CACHE_WAYS )
+		return;
+
+	offset = __sync_fetch_and_add(&svDeltaCacheArenaUsed, size);
+
+	if ( offset + size > DELTA_CACHE_ARENA_SIZE )
+	{
+		entry->tag = 0;
+		return;
+	}
+
+	stored = svDeltaCacheArena + offset;
+
+	memcpy(stored, from, sizeof(entityState_t));
+	memcpy(stored + sizeof(entityState_t), to, sizeof(entityState_t));
+	memcpy(stored + 2 * sizeof(entityState_t), splice->data, splice->length);
+
+	entry->key = key;
+	entry->hash = hash;
+	entry->offset = offset;
+	entry->partial = splice->partial;
+	entry->length = splice->length;
+	entry->bit = splice->bit;
+
+	__sync_synchronize();
+	entry->tag = ( svDeltaCacheFrame << 2 ) | DELTA_CACHE_READY;
+}
+
+/*
+=============
+SV_WriteDeltaEntityCached
+
+MSG_WriteDeltaEntity through the delta cache, the bits that reach msg
+are identical either way. Safe to call from the snapshot encode jobs.
+=============
+*/
+static void SV_WriteDeltaEntityCached( msg_t *msg, entityState_t *from, entityState_t *to, qboolean force )
+{
+	byte data[DELTA_CACHE_MAX_ENCODED];
+	msgSplice_t splice;
+	msg_t scratch;
+	unsigned int hash;
+	int key;
+
+	if ( !svDeltaCacheActive || (unsigned)to->number >= MAX_GENTITIES )
+	{
+		MSG_WriteDeltaEntity(msg, from, to, force);
+		return;
+	}
+
+	// an unchanged entity writes nothing unless forced, not worth a lookup
+	if ( !force && !MSG_EntityStateChanged(from, to) )
+		return;
+
+	key = ( msg->bit & 7 ) | ( force << 3 );
+	hash = SV_DeltaCacheHash(from, to);
+
+	if ( SV_DeltaCacheFind(msg, from, to, key, hash) )
+	{
+		__sync_fetch_and_add(&svDeltaCacheHits, 1);
+		return;
+	}
+
+	MSG_BeginSplice(&scratch, data, sizeof(data), msg);
+	MSG_WriteDeltaEntity(&scratch, from, to, force);
+
+	if ( !MSG_EndSplice(&scratch, key & 7, &splice) || !MSG_WriteSplice(msg, &splice) )
+	{
+		// too big to record or too close to the end of msg
+		__sync_fetch_and_add(&svDeltaCacheBypass, 1);
+		MSG_WriteDeltaEntity(msg, from, to, force);
+		return;
+	}
+
+	if ( splice.bit == ( key & 7 ) )
+		return; // nothing was written, never record an empty delta
+
+	__sync_fetch_and_add(&svDeltaCacheMisses, 1);
+	SV_DeltaCacheStore(from, to, key, hash, &splice);
+}
+
+/*
+=============
+SV_DeltaCacheStats_f
+=============
+*/
+void SV_DeltaCacheStats_f( void )
+{
+	int lookups;
+
+	if ( Cmd_Argc() > 1 && !I_stricmp(Cmd_Argv(1), "reset") )
+	{
+		svDeltaCacheHits = 0;
+		svDeltaCacheMisses = 0;
+		svDeltaCacheBypass = 0;
+		Com_Printf("delta cache stats reset\n");
+		return;
+	}
+
+	lookups = svDeltaCacheHits + svDeltaCacheMisses;
+
+	Com_Printf("delta cache: %s\n", sv_deltaCache->current.boolean ? "on" : "off");
+	Com_Printf("hits       : %i\n", svDeltaCacheHits);
+	Com_Printf("misses     : %i\n", svDeltaCacheMisses);
+	Com_Printf("bypassed   : %i\n", svDeltaCacheBypass);
+	Com_Printf("hit rate   : %.1f%%\n", lookups ? 100.0 * svDeltaCacheHits / lookups : 0.0);
+	Com_Printf("arena      : %i / %i bytes\n", svDeltaCacheArenaUsed, DELTA_CACHE_ARENA_SIZE);
+}
+
 /*
 =============
 SV_EmitPacketEntities
@@ -1432,7 +2092,7 @@ void SV_EmitPacketEntities( int entNum, int from_num_entities, int from_first_en
 			// delta update from old position
 			// because the force parm is qfalse, this will not result
 			// in any bytes being emited if the entity has not changed at all
-			MSG_WriteDeltaEntity(msg, oldent, newent, qfalse);
+			SV_WriteDeltaEntityCached(msg, oldent, newent, qfalse);
 			++oldindex;
 			++newindex;
 			continue;
@@ -1441,7 +2101,7 @@ void SV_EmitPacketEntities( int entNum, int from_num_entities, int from_first_en
 		if ( newnum < oldnum )
 		{
 			// this is a new entity, send it from the baseline
-			MSG_WriteDeltaEntity(msg, &sv.svEntities[newnum].baseline.s, newent, qtrue);
+			SV_WriteDeltaEntityCached(msg, &sv.svEntities[newnum].baseline.s, newent, qtrue);
 			++newindex;
 			continue;
 		}
@@ -1790,20 +2450,13 @@ cachedSnapshot_t* SV_GetCachedSnapshotInternal( int archivedFrame )
 
 /*
 ==================
-SV_WriteSnapshotToClient
+SV_GetDeltaSnapshotForClient
 ==================
 */
-void SV_WriteSnapshotToClient( client_t *client, msg_t *msg )
+static clientSnapshot_t* SV_GetDeltaSnapshotForClient( client_t *client, int *pLastframe )
 {
-	clientSnapshot_t	*frame, *oldframe;
+	clientSnapshot_t	*oldframe;
 	int					lastframe;
-	int					snapFlags;
-	int i;
-	int from_num_clients, from_first_client;
-
-	// this is the snapshot we are creating
-	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
-	assert(frame);
 
 	// try to use a previous frame as the source for delta compressing the snapshot
 	if ( client->deltaMessage <= 0 || client->state != CS_ACTIVE )
@@ -1835,6 +2488,29 @@ void SV_WriteSnapshotToClient( client_t *client, msg_t *msg )
 		}
 	}
 
+	*pLastframe = lastframe;
+	return oldframe;
+}
+
+/*
+==================
+SV_WriteSnapshotDeltaToClient
+
+Only touches the client and the snapshot rings, so the
+parallel snapshot path may run it from a worker thread
+==================
+*/
+static void SV_WriteSnapshotDeltaToClient( client_t *client, clientSnapshot_t *oldframe, int lastframe, msg_t *msg )
+{
+	clientSnapshot_t	*frame;
+	int					snapFlags;
+	int i;
+	int from_num_clients, from_first_client;
+
+	// this is the snapshot we are creating
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+	assert(frame);
+
 	MSG_WriteByte(msg, svc_snapshot);
 
 	// send over the current server time so the client can drift
@@ -1893,6 +2569,20 @@ void SV_WriteSnapshotToClient( client_t *client, msg_t *msg )
 	}
 }
 
+/*
+==================
+SV_WriteSnapshotToClient
+==================
+*/
+void SV_WriteSnapshotToClient( client_t *client, msg_t *msg )
+{
+	clientSnapshot_t	*oldframe;
+	int					lastframe;
+
+	oldframe = SV_GetDeltaSnapshotForClient(client, &lastframe);
+	SV_WriteSnapshotDeltaToClient(client, oldframe, lastframe, msg);
+}
+
 /*
 ==================
 SV_GetCachedSnapshot
@@ -1924,24 +2614,102 @@ cachedSnapshot_t* SV_GetCachedSnapshot( int *pArchiveTime )
 		*pArchiveTime = 1000 * (svs.nextArchivedSnapshotFrames - archivedFrame) / sv_fps->current.integer;
 	}
 
-	if ( archivedFrame < 0 )
-	{
-		archivedFrame = 0;
-		*pArchiveTime = 1000 * svs.nextArchivedSnapshotFrames / sv_fps->current.integer;
+	if ( archivedFrame < 0 )
+	{
+		archivedFrame = 0;
+		*pArchiveTime = 1000 * svs.nextArchivedSnapshotFrames / sv_fps->current.integer;
+	}
+
+	for ( ; archivedFrame < svs.nextArchivedSnapshotFrames; archivedFrame++ )
+	{
+		cachedFrame = SV_GetCachedSnapshotInternal(archivedFrame);
+
+		if ( cachedFrame )
+		{
+			return cachedFrame;
+		}
+	}
+
+	*pArchiveTime = 0;
+	return NULL;
+}
+
+/*
+=============
+SV_GetClientViewOrigin
+=============
+*/
+static void SV_GetClientViewOrigin( const playerState_t *ps, vec3_t org )
+{
+	VectorCopy( ps->origin, org );
+	org[2] += ps->viewHeightCurrent;
+
+//----(SA)	added for 'lean'
+	// need to account for lean, so areaportal doors draw properly
+	AddLeanToPosition(org, ps->viewangles[1], ps->leanf, 16.0, 20.0);
+//----(SA)	end
+}
+
+/*
+=============
+SV_CopySnapshotEntitiesAndClients
+
+Copies the visible entity states and all client states
+into the snapshot rings for a live (non-archived) frame
+=============
+*/
+static void SV_CopySnapshotEntitiesAndClients( clientSnapshot_t *frame, snapshotEntityNumbers_t *entityNumbers )
+{
+	int i;
+	gentity_t *ent;
+	entityState_t *entState;
+	clientState_t *clientState;
+	client_t *snapClient;
+
+	// copy the entity states out
+	for ( i = 0 ; i < entityNumbers->numSnapshotEntities ; i++ )
+	{
+		ent = SV_GentityNum( entityNumbers->snapshotEntities[i] );
+		entState = &svs.snapshotEntities[svs.nextSnapshotEntities % svs.numSnapshotEntities];
+
+		*entState = ent->s;
+
+		svs.nextSnapshotEntities++;
+		// this should never hit, map should always be restarted first in SV_Frame
+		if ( svs.nextSnapshotEntities >= 0x7FFFFFFE )
+		{
+			Com_Error( ERR_FATAL, "svs.nextSnapshotEntities wrapped" );
+		}
+
+		frame->num_entities++;
 	}
 
-	for ( ; archivedFrame < svs.nextArchivedSnapshotFrames; archivedFrame++ )
+	// copy the client states out
+	for ( snapClient = svs.clients, i = 0 ; i < sv_maxclients->current.integer ; i++, snapClient++ )
 	{
-		cachedFrame = SV_GetCachedSnapshotInternal(archivedFrame);
+		if ( snapClient->state < CS_CONNECTED )
+		{
+			continue;
+		}
 
-		if ( cachedFrame )
+		clientState = &svs.snapshotClients[svs.nextSnapshotClients % svs.numSnapshotClients];
+
+		*clientState = *G_GetClientState(i);
+
+		if ( clientState->clientIndex != i )
 		{
-			return cachedFrame;
+			continue;
 		}
-	}
 
-	*pArchiveTime = 0;
-	return NULL;
+		svs.nextSnapshotClients++;
+		// this should never hit, map should always be restarted first in SV_Frame
+		if ( svs.nextSnapshotClients >= 0x7FFFFFFE )
+		{
+			Com_Error( ERR_FATAL, "svs.nextSnapshotClients wrapped" );
+		}
+
+		frame->num_clients++;
+	}
 }
 
 /*
@@ -1964,7 +2732,6 @@ void SV_BuildClientSnapshot( client_t *client )
 	snapshotEntityNumbers_t entityNumbers;
 	int i;
 	archivedEntity_t			*aent;
-	gentity_t              		*ent;
 	entityState_t               *entState;
 	cachedClient_t				*cachedClient;
 	clientState_t               *clientState;
@@ -1973,7 +2740,6 @@ void SV_BuildClientSnapshot( client_t *client )
 	playerState_t               *ps;
 	int							archiveTime;
 	cachedSnapshot_t			*cachedSnap;
-	client_t					*snapClient;
 	int snapTime;
 
 	// this is the frame we are creating
@@ -2024,13 +2790,7 @@ void SV_BuildClientSnapshot( client_t *client )
 	}
 
 	// find the client's viewpoint
-	VectorCopy( ps->origin, org );
-	org[2] += ps->viewHeightCurrent;
-
-//----(SA)	added for 'lean'
-	// need to account for lean, so areaportal doors draw properly
-	AddLeanToPosition(org, ps->viewangles[1], ps->leanf, 16.0, 20.0);
-//----(SA)	end
+	SV_GetClientViewOrigin( ps, org );
 
 	if ( cachedSnap )
 	{
@@ -2089,48 +2849,404 @@ void SV_BuildClientSnapshot( client_t *client )
 	// may include portal entities that merge other viewpoints
 	SV_AddEntitiesVisibleFromPoint( org, clientNum, &entityNumbers );
 
-	// copy the entity states out
-	for ( i = 0 ; i < entityNumbers.numSnapshotEntities ; i++ )
+	SV_CopySnapshotEntitiesAndClients( frame, &entityNumbers );
+}
+
+/*
+=============================================================================
+
+Parallel snapshot path
+
+With sv_snapshotThreads > 1 the per-client work of SV_SendClientMessages is
+split into stages so that entity culling and message encoding/compression
+can run on the worker pool:
+
+  1. cull     (parallel) PVS test of every entity for each client
+  2. commit   (serial)   advance the snapshot rings in client order, copy
+                         entity/client states and pick the delta frame
+  3. encode   (parallel) delta encode + huffman compress each message
+  4. transmit (serial)   netchan, rate and voice data in client order
+
+Every stage reads the same state the serial loop would, so the datagrams
+are identical. Anything that could make one client's send affect another's
+snapshot (drops, downloads, fragments, expiring broadcast entities) makes
+the frame fall back to the serial loop.
+
+=============================================================================
+*/
+
+typedef struct
+{
+	client_t *client;
+	qboolean serialBuild;
+	qboolean encoded;
+	vec3_t viewOrigin;
+	int viewClientNum;
+	int archiveTime;
+	int reliableSent;
+	int sendAsActive;
+	snapshotEntityNumbers_t entityNumbers;
+	clientSnapshot_t *oldframe;
+	int lastframe;
+	int firstNeededEntity;
+	int firstNeededClient;
+	msg_t msg;
+	byte msgBuf[MAX_SNAPSHOT_MSG_LEN];
+	byte compressBuf[MAX_MSGLEN];
+	int compressedSize;
+} snapshotJob_t;
+
+// allocated the first time the parallel path runs, each job carries two
+// full message buffers
+static snapshotJob_t *snapshotJobs;
+
+/*
+=============
+SV_CullSnapshotJob
+=============
+*/
+static void SV_CullSnapshotJob( void *data, int index )
+{
+	snapshotJob_t *job;
+
+	job = &((snapshotJob_t *)data)[index];
+	job->entityNumbers.numSnapshotEntities = 0;
+
+	if ( job->serialBuild )
 	{
-		ent = SV_GentityNum( entityNumbers.snapshotEntities[i] );
-		entState = &svs.snapshotEntities[svs.nextSnapshotEntities % svs.numSnapshotEntities];
+		return;
+	}
 
-		*entState = ent->s;
+	SV_AddEntitiesVisibleFromPoint( job->viewOrigin, job->viewClientNum, &job->entityNumbers );
+}
 
-		svs.nextSnapshotEntities++;
-		// this should never hit, map should always be restarted first in SV_Frame
-		if ( svs.nextSnapshotEntities >= 0x7FFFFFFE )
+/*
+=============
+SV_EncodeSnapshotJob
+=============
+*/
+static void SV_EncodeSnapshotJob( void *data, int index )
+{
+	snapshotJob_t *job;
+	client_t *client;
+
+	job = &((snapshotJob_t *)data)[index];
+
+	if ( job->encoded )
+	{
+		return;
+	}
+
+	client = job->client;
+
+	MSG_Init( &job->msg, job->msgBuf, sizeof( job->msgBuf ) );
+	MSG_WriteLong( &job->msg, client->lastClientCommand );
+
+	SV_UpdateServerCommandsToClient( client, &job->msg );
+	SV_WriteSnapshotDeltaToClient( client, job->oldframe, job->lastframe, &job->msg );
+
+	MSG_WriteByte( &job->msg, svc_EOF );
+
+	if ( !job->msg.overflowed )
+	{
+		job->compressedSize = SV_CompressClientMessage( &job->msg, job->compressBuf );
+	}
+
+	job->encoded = qtrue;
+}
+
+/*
+=============
+SV_FlushSnapshotJobs
+
+Encodes the already committed jobs right away if committing the next
+one could overwrite ring entries they still have to read
+=============
+*/
+static void SV_FlushSnapshotJobs( snapshotJob_t *jobs, int numCommitted, int maxEntities, int maxClients )
+{
+	int i;
+	int entityLimit;
+	int clientLimit;
+
+	entityLimit = svs.nextSnapshotEntities + maxEntities - svs.numSnapshotEntities;
+	clientLimit = svs.nextSnapshotClients + maxClients - svs.numSnapshotClients;
+
+	for ( i = 0; i < numCommitted; i++ )
+	{
+		if ( jobs[i].encoded )
 		{
-			Com_Error( ERR_FATAL, "svs.nextSnapshotEntities wrapped" );
+			continue;
 		}
 
-		frame->num_entities++;
+		if ( jobs[i].firstNeededEntity < entityLimit || jobs[i].firstNeededClient < clientLimit )
+		{
+			break;
+		}
 	}
 
-	// copy the client states out
-	for ( snapClient = svs.clients, i = 0 ; i < sv_maxclients->current.integer ; i++, snapClient++ )
+	if ( i == numCommitted )
 	{
-		if ( snapClient->state < CS_CONNECTED )
+		return;
+	}
+
+	for ( i = 0; i < numCommitted; i++ )
+	{
+		SV_EncodeSnapshotJob( jobs, i );
+	}
+}
+
+/*
+=============
+SV_CommitSnapshotJob
+=============
+*/
+static void SV_CommitSnapshotJob( snapshotJob_t *job )
+{
+	client_t *client;
+	clientSnapshot_t *frame;
+
+	client = job->client;
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+
+	if ( job->serialBuild )
+	{
+		SV_BuildClientSnapshot( client );
+	}
+	else
+	{
+		frame->num_entities = 0;
+		frame->num_clients = 0;
+
+		frame->first_entity = svs.nextSnapshotEntities;
+		frame->first_client = svs.nextSnapshotClients;
+
+		frame->ps = *SV_GameClientNum( client - svs.clients );
+
+		SV_CopySnapshotEntitiesAndClients( frame, &job->entityNumbers );
+	}
+
+	job->oldframe = SV_GetDeltaSnapshotForClient( client, &job->lastframe );
+
+	job->firstNeededEntity = frame->first_entity;
+	job->firstNeededClient = frame->first_client;
+
+	if ( job->oldframe )
+	{
+		if ( job->oldframe->first_entity < job->firstNeededEntity )
+		{
+			job->firstNeededEntity = job->oldframe->first_entity;
+		}
+
+		if ( job->oldframe->first_client < job->firstNeededClient )
+		{
+			job->firstNeededClient = job->oldframe->first_client;
+		}
+	}
+}
+
+/*
+=============
+SV_SetupSnapshotJobs
+
+Returns the number of clients due a snapshot this frame,
+or -1 if the frame has to go through the serial loop
+=============
+*/
+static int SV_SetupSnapshotJobs( snapshotJob_t *jobs )
+{
+	int i;
+	int numJobs;
+	int leafnum;
+	int cluster;
+	client_t *c;
+	gentity_t *ent;
+	playerState_t *ps;
+	snapshotJob_t *job;
+
+	// an expired broadcast entity is cleared by whichever client
+	// reaches it first, which is only defined in the serial order
+	for ( i = 0; i < sv.num_entities; i++ )
+	{
+		ent = SV_GentityNum( i );
+
+		if ( ent->r.linked && ent->r.broadcastTime > 0 && ent->r.broadcastTime - svs.time < 0 )
+		{
+			return -1;
+		}
+	}
+
+	numJobs = 0;
+
+	for ( i = 0, c = svs.clients; i < sv_maxclients->current.integer; i++, c++ )
+	{
+		if ( !c->state )
 		{
 			continue;
 		}
 
-		clientState = &svs.snapshotClients[svs.nextSnapshotClients % svs.numSnapshotClients];
+		if ( svs.time < c->nextSnapshotTime )
+		{
+			continue;
+		}
 
-		*clientState = *G_GetClientState(i);
+		if ( c->state != CS_ACTIVE || c->dropReason || c->netchan.unsentFragments || *c->downloadName )
+		{
+			return -1;
+		}
 
-		if ( clientState->clientIndex != i )
+		job = &jobs[numJobs++];
+
+		job->client = c;
+		job->encoded = qfalse;
+		job->archiveTime = G_GetClientArchiveTime( i );
+		job->reliableSent = c->reliableSent;
+		job->sendAsActive = c->sendAsActive;
+
+		ps = SV_GameClientNum( i );
+
+		// archived (killcam) snapshots, and anything SV_BuildClientSnapshot
+		// would reject, are built on the main thread during the commit
+		job->serialBuild = !c->gentity || job->archiveTime > 0 || ps->clientNum < 0 || ps->clientNum >= MAX_GENTITIES;
+
+		if ( !job->serialBuild )
+		{
+			SV_GetClientViewOrigin( ps, job->viewOrigin );
+			job->viewClientNum = ps->clientNum;
+
+			// build the shared cluster visibility before the cull jobs read it
+			leafnum = CM_PointLeafnum( job->viewOrigin );
+			cluster = CM_LeafCluster( leafnum );
+
+			if ( cluster >= 0 )
+			{
+				SV_GetClusterVisibleEntities( cluster, CM_ClusterPVS( cluster ) );
+			}
+		}
+	}
+
+	return numJobs;
+}
+
+/*
+=============
+SV_SendClientMessagesParallel
+=============
+*/
+static bool SV_SendClientMessagesParallel( int *numclients )
+{
+	int i;
+	int numJobs;
+	int numThreads;
+	client_t *c;
+	snapshotJob_t *job;
+
+	numThreads = sv_snapshotThreads->current.integer;
+
+	if ( numThreads < 2 )
+	{
+		return false;
+	}
+
+	if ( !SV_Loaded() || sv_debugReliableCmds->current.boolean )
+	{
+		return false;
+	}
+
+	if ( !Sys_InitWorkerThreads( numThreads - 1 ) )
+	{
+		return false;
+	}
+
+	if ( !snapshotJobs )
+	{
+		snapshotJobs = (snapshotJob_t *)Z_Malloc( sizeof( *snapshotJobs ) * MAX_CLIENTS );
+	}
+
+	numJobs = SV_SetupSnapshotJobs( snapshotJobs );
+
+	if ( numJobs < 2 )
+	{
+		return false;
+	}
+
+	pvsCacheFrozen = qtrue;
+	Sys_RunWorkerJobs( SV_CullSnapshotJob, snapshotJobs, numJobs, numThreads );
+	pvsCacheFrozen = qfalse;
+
+	for ( i = 0; i < numJobs; i++ )
+	{
+		job = &snapshotJobs[i];
+
+		if ( job->serialBuild )
+		{
+			SV_FlushSnapshotJobs( snapshotJobs, i, MAX_SNAPSHOT_ENTITIES, MAX_CLIENTS );
+		}
+		else
+		{
+			SV_FlushSnapshotJobs( snapshotJobs, i, job->entityNumbers.numSnapshotEntities, sv_maxclients->current.integer );
+		}
+
+		SV_CommitSnapshotJob( job );
+	}
+
+	Sys_RunWorkerJobs( SV_EncodeSnapshotJob, snapshotJobs, numJobs, numThreads );
+
+	for ( i = 0; i < numJobs; i++ )
+	{
+		job = &snapshotJobs[i];
+		c = job->client;
+
+		(*numclients)++;
+
+		if ( job->msg.overflowed )
+		{
+			SV_RecoverClientMessageOverflow( c, &job->msg, job->msgBuf, sizeof( job->msgBuf ) );
+			SV_SendMessageToClient( &job->msg, c );
+		}
+		else
+		{
+			SV_TransmitCompressedMessageToClient( c, job->compressBuf, job->compressedSize );
+		}
+
+		SV_SendClientVoiceData( c );
+
+		if ( c->state == CS_ACTIVE )
 		{
 			continue;
 		}
 
-		svs.nextSnapshotClients++;
-		// this should never hit, map should always be restarted first in SV_Frame
-		if ( svs.nextSnapshotClients >= 0x7FFFFFFE )
+		// the client got dropped, which runs script code that the serial loop
+		// would have run before building the remaining snapshots, so rewind the
+		// client state to this point and finish the frame serially. The rings
+		// are not rewound: the later jobs already wrote their entries, and old
+		// frames stored there must keep failing the out of date check
+		for ( job++; job < &snapshotJobs[numJobs]; job++ )
 		{
-			Com_Error( ERR_FATAL, "svs.nextSnapshotClients wrapped" );
+			job->client->reliableSent = job->reliableSent;
+			job->client->sendAsActive = job->sendAsActive;
+			G_SetClientArchiveTime( job->client - svs.clients, job->archiveTime );
 		}
 
-		frame->num_clients++;
+		for ( c++; c < &svs.clients[sv_maxclients->current.integer]; c++ )
+		{
+			if ( !c->state )
+			{
+				continue;
+			}
+
+			if ( svs.time < c->nextSnapshotTime )
+			{
+				continue;
+			}
+
+			(*numclients)++;
+
+			SV_SendClientMessage( c );
+		}
+
+		break;
 	}
+
+	return true;
 }
@@ -253,6 +253,83 @@ int SV_ClipSightToEntity( sightclip_t *clip, svEntity_t *check )
 	return -1;
 }
 
+svEntityClusters_t sv_entityClusters[MAX_GENTITIES];
+int sv_entityClusterSequence;
+qboolean sv_entityClustersEnabled;
+
+/*
+===============
+SV_ResetEntityClusters
+
+Called after a new map is loaded, the cluster words of the
+previous map are meaningless against the new visibility data
+===============
+*/
+void SV_ResetEntityClusters()
+{
+	Com_Memset(sv_entityClusters, 0, sizeof(sv_entityClusters));
+	sv_entityClusterSequence++;
+
+	// rows are read a word at a time, so they must be word padded
+	sv_entityClustersEnabled = ( cm.clusterBytes & 3 ) == 0;
+}
+
+/*
+===============
+SV_UpdateEntityClusters
+
+Folds the clusters stored by SV_LinkEntity into PVS row words, and
+bumps the cluster sequence if the entity changed its cluster set so
+cached per-cluster visibility gets rebuilt
+===============
+*/
+static void SV_UpdateEntityClusters( int entnum, const svEntity_t *ent )
+{
+	svEntityClusters_t clusters;
+	int i, j;
+	int word;
+
+	clusters.numWords = 0;
+
+	if ( ent->numClusters == MAX_ENT_CLUSTERS && ent->lastCluster )
+	{
+		clusters.numWords = -1;
+	}
+	else
+	{
+		for ( i = 0 ; i < ent->numClusters ; i++ )
+		{
+			word = ent->clusternums[i] >> 5;
+
+			for ( j = 0 ; j < clusters.numWords ; j++ )
+			{
+				if ( clusters.words[j].word == word )
+				{
+					break;
+				}
+			}
+
+			if ( j == clusters.numWords )
+			{
+				clusters.words[j].word = word;
+				clusters.words[j].mask = 0;
+				clusters.numWords++;
+			}
+
+			clusters.words[j].mask |= 1u << ( ent->clusternums[i] & 31 );
+		}
+	}
+
+	if ( clusters.numWords == sv_entityClusters[entnum].numWords
+	        && ( clusters.numWords <= 0 || !memcmp(clusters.words, sv_entityClusters[entnum].words, sizeof(clusters.words[0]) * clusters.numWords) ) )
+	{
+		return;
+	}
+
+	sv_entityClusters[entnum] = clusters;
+	sv_entityClusterSequence++;
+}
+
 /*
 ===============
 SV_LinkEntity
@@ -388,6 +465,7 @@ void SV_LinkEntity( gentity_t *gEnt )
 		// entity is outside the world and can be considered unlinked
 		if ( !num_leafs )
 		{
+			SV_UpdateEntityClusters(gEnt->s.number, ent);
 			CM_UnlinkEntity(ent);
 			return;
 		}
@@ -412,6 +490,7 @@ void SV_LinkEntity( gentity_t *gEnt )
 			ent->lastCluster = CM_LeafCluster( lastLeaf );
 		}
 	}
+	SV_UpdateEntityClusters(gEnt->s.number, ent);
 	gEnt->r.linked = qtrue;
 
 	if ( !gEnt->r.contents )
@@ -4,6 +4,8 @@
 #include "dvar.h"
 #include "../stringed/stringed_public.h"
 
+#include <sys/stat.h>
+
 dvar_t* fs_debug;
 dvar_t* fs_copyfiles;
 dvar_t* fs_cdpath;
@@ -14,6 +16,7 @@ dvar_t* fs_homepath;
 dvar_t* fs_gameDirVar;
 dvar_t* fs_restrict;
 dvar_t* fs_ignoreLocalized;
+dvar_t* fs_iwdIndexCache;
 
 static searchpath_t *fs_searchpaths;
 static fileHandleData_t fsh[MAX_FILE_HANDLES];
@@ -444,6 +447,522 @@ void FS_FCloseFile( fileHandle_t h )
 	Com_Memset( &fsh[h], 0, sizeof( fsh[h] ) );
 }
 
+/*
+=============================================================================
+
+IWD INDEX CACHE
+
+With fs_iwdIndexCache set, the file table of every iwd is kept in
+iwdindex.cache under fs_homepath, keyed by path, size and modification
+time. Unchanged iwds are then set up from the mapped index instead of
+walking their central directory. The index is only mapped during
+FS_Startup, and is replaced by a new file whenever an iwd had to be parsed.
+
+=============================================================================
+*/
+
+#define IWD_INDEX_NAME "iwdindex.cache"
+#define IWD_INDEX_IDENT (('X'<<24)+('D'<<16)+('W'<<8)+'I')
+#define IWD_INDEX_VERSION 1
+
+void FS_BuildOSPath(const char *base, const char *game, const char *qpath, char* ospath);
+static int FS_CreatePath(char *OSPath);
+
+struct iwdIndexHeader_t
+{
+	int ident;
+	int version;
+	int numRecords;
+};
+
+// followed by the entries, the crcs, the iwd path and the file names
+struct iwdIndexRecord_t
+{
+	int recordSize;
+	int fileSize;
+	int fileTime;
+	int numEntries;
+	int numChecksums;
+	int pathSize;
+	int namesSize;
+	int checksum;
+};
+
+struct iwdIndexEntry_t
+{
+	unsigned int pos;
+	int hash;
+	int name;
+};
+
+static char *fs_iwdIndex;
+static int fs_iwdIndexLength;
+static qboolean fs_iwdIndexLoaded;
+static const iwdIndexRecord_t **fs_iwdIndexRecords;
+static int fs_iwdIndexMask;
+static iwdIndexRecord_t **fs_iwdIndexNew;
+static int fs_numIwdIndexNew;
+static int fs_maxIwdIndexNew;
+
+static const iwdIndexEntry_t *FS_IwdIndexEntries( const iwdIndexRecord_t *record )
+{
+	return (const iwdIndexEntry_t *)( record + 1 );
+}
+
+static const int *FS_IwdIndexChecksums( const iwdIndexRecord_t *record )
+{
+	return (const int *)( FS_IwdIndexEntries( record ) + record->numEntries );
+}
+
+static const char *FS_IwdIndexPath( const iwdIndexRecord_t *record )
+{
+	return (const char *)( FS_IwdIndexChecksums( record ) + record->numChecksums );
+}
+
+static const char *FS_IwdIndexNames( const iwdIndexRecord_t *record )
+{
+	return FS_IwdIndexPath( record ) + record->pathSize;
+}
+
+static unsigned int FS_HashIwdIndexPath( const char *path )
+{
+	unsigned int hash = 2166136261u;
+
+	while ( *path )
+	{
+		hash = ( hash ^ (unsigned char)*path++ ) * 16777619u;
+	}
+
+	return hash;
+}
+
+static qboolean FS_IwdIndexRecordValid( const iwdIndexRecord_t *record, int available )
+{
+	int64_t size;
+
+	if ( available < (int)sizeof( *record ) )
+	{
+		return qfalse;
+	}
+
+	if ( record->recordSize < (int)sizeof( *record ) || record->recordSize > available || ( record->recordSize & 3 ) )
+	{
+		return qfalse;
+	}
+
+	if ( record->numEntries < 0 || record->numChecksums < 0 || record->pathSize <= 0 || record->namesSize < 0 )
+	{
+		return qfalse;
+	}
+
+	size = (int64_t)sizeof( *record ) + (int64_t)record->numEntries * sizeof( iwdIndexEntry_t ) + (int64_t)record->numChecksums * sizeof( int )
+	       + record->pathSize + record->namesSize;
+
+	if ( size > record->recordSize )
+	{
+		return qfalse;
+	}
+
+	if ( FS_IwdIndexPath( record )[record->pathSize - 1] )
+	{
+		return qfalse;
+	}
+
+	return !record->namesSize || !FS_IwdIndexNames( record )[record->namesSize - 1];
+}
+
+static void FS_FreeIwdIndex()
+{
+	Sys_UnmapFile( fs_iwdIndex, fs_iwdIndexLength );
+	fs_iwdIndex = NULL;
+	fs_iwdIndexLength = 0;
+
+	if ( fs_iwdIndexRecords )
+	{
+		Z_Free( fs_iwdIndexRecords );
+		fs_iwdIndexRecords = NULL;
+	}
+
+	fs_iwdIndexMask = 0;
+	fs_iwdIndexLoaded = qfalse;
+}
+
+static void FS_LoadIwdIndex()
+{
+	char ospath[MAX_OSPATH];
+	const iwdIndexHeader_t *header;
+	const iwdIndexRecord_t *record;
+	int offset;
+	int size;
+	int slot;
+	int i;
+
+	if ( fs_iwdIndexLoaded )
+	{
+		return;
+	}
+
+	fs_iwdIndexLoaded = qtrue;
+
+	FS_BuildOSPath( fs_homepath->current.string, BASEGAME, IWD_INDEX_NAME, ospath );
+	fs_iwdIndex = (char *)Sys_MapFile( ospath, &fs_iwdIndexLength );
+
+	if ( !fs_iwdIndex )
+	{
+		return;
+	}
+
+	header = (const iwdIndexHeader_t *)fs_iwdIndex;
+
+	if ( fs_iwdIndexLength < (int)sizeof( *header ) || header->ident != IWD_INDEX_IDENT || header->version != IWD_INDEX_VERSION
+	        || header->numRecords <= 0 || header->numRecords > fs_iwdIndexLength / (int)sizeof( iwdIndexRecord_t ) )
+	{
+		Com_Printf( "Ignoring invalid %s\n", ospath );
+		FS_FreeIwdIndex();
+		fs_iwdIndexLoaded = qtrue;
+		return;
+	}
+
+	for ( size = 2; size < header->numRecords * 2; size <<= 1 )
+		;
+
+	fs_iwdIndexMask = size - 1;
+	fs_iwdIndexRecords = (const iwdIndexRecord_t **)Z_Malloc( size * sizeof( *fs_iwdIndexRecords ) );
+
+	offset = sizeof( *header );
+
+	for ( i = 0; i < header->numRecords; i++ )
+	{
+		record = (const iwdIndexRecord_t *)( fs_iwdIndex + offset );
+
+		// keep whatever came before a damaged record
+		if ( !FS_IwdIndexRecordValid( record, fs_iwdIndexLength - offset ) )
+		{
+			break;
+		}
+
+		slot = FS_HashIwdIndexPath( FS_IwdIndexPath( record ) ) & fs_iwdIndexMask;
+
+		while ( fs_iwdIndexRecords[slot] && strcmp( FS_IwdIndexPath( fs_iwdIndexRecords[slot] ), FS_IwdIndexPath( record ) ) )
+		{
+			slot = ( slot + 1 ) & fs_iwdIndexMask;
+		}
+
+		fs_iwdIndexRecords[slot] = record;
+		offset += record->recordSize;
+	}
+}
+
+static const iwdIndexRecord_t *FS_FindIwdIndexRecord( const char *zipfile, int fileSize, int fileTime )
+{
+	const iwdIndexRecord_t *record;
+	int slot;
+
+	FS_LoadIwdIndex();
+
+	if ( !fs_iwdIndexRecords )
+	{
+		return NULL;
+	}
+
+	for ( slot = FS_HashIwdIndexPath( zipfile ) & fs_iwdIndexMask; fs_iwdIndexRecords[slot]; slot = ( slot + 1 ) & fs_iwdIndexMask )
+	{
+		record = fs_iwdIndexRecords[slot];
+
+		if ( !strcmp( FS_IwdIndexPath( record ), zipfile ) )
+		{
+			if ( record->fileSize != fileSize || record->fileTime != fileTime )
+			{
+				return NULL;
+			}
+
+			return record;
+		}
+	}
+
+	return NULL;
+}
+
+static void FS_AddIwdIndexRecord( const char *zipfile, int fileSize, int fileTime, const iwd_t *iwd, const intptr_t *headerLongs, int numHeaderLongs )
+{
+	iwdIndexRecord_t *record;
+	iwdIndexEntry_t *entries;
+	int *checksums;
+	char *path;
+	char *names;
+	const char *firstName;
+	int namesSize;
+	int recordSize;
+	int i;
+
+	namesSize = 0;
+
+	for ( i = 0; i < iwd->numFiles; i++ )
+	{
+		namesSize += strlen( iwd->buildBuffer[i].name ) + 1;
+	}
+
+	recordSize = sizeof( *record ) + iwd->numFiles * sizeof( *entries ) + numHeaderLongs * sizeof( *checksums ) + strlen( zipfile ) + 1 + namesSize;
+	recordSize = ( recordSize + 3 ) & ~3;
+
+	record = (iwdIndexRecord_t *)Z_Malloc( recordSize );
+	record->recordSize = recordSize;
+	record->fileSize = fileSize;
+	record->fileTime = fileTime;
+	record->numEntries = iwd->numFiles;
+	record->numChecksums = numHeaderLongs;
+	record->pathSize = strlen( zipfile ) + 1;
+	record->namesSize = namesSize;
+	record->checksum = iwd->checksum;
+
+	entries = (iwdIndexEntry_t *)FS_IwdIndexEntries( record );
+	checksums = (int *)FS_IwdIndexChecksums( record );
+	path = (char *)FS_IwdIndexPath( record );
+	names = (char *)FS_IwdIndexNames( record );
+
+	// names are packed right after the entries, in entry order
+	firstName = (const char *)( iwd->buildBuffer + iwd->numFiles );
+
+	for ( i = 0; i < iwd->numFiles; i++ )
+	{
+		entries[i].pos = iwd->buildBuffer[i].pos;
+		entries[i].hash = FS_HashFileName( iwd->buildBuffer[i].name, iwd->hashSize );
+		entries[i].name = iwd->buildBuffer[i].name - firstName;
+	}
+
+	for ( i = 0; i < numHeaderLongs; i++ )
+	{
+		checksums[i] = headerLongs[i];
+	}
+
+	strcpy( path, zipfile );
+	Com_Memcpy( names, firstName, namesSize );
+
+	if ( fs_numIwdIndexNew == fs_maxIwdIndexNew )
+	{
+		iwdIndexRecord_t **oldNew = fs_iwdIndexNew;
+
+		fs_maxIwdIndexNew = fs_maxIwdIndexNew ? fs_maxIwdIndexNew * 2 : 64;
+		fs_iwdIndexNew = (iwdIndexRecord_t **)Z_Malloc( fs_maxIwdIndexNew * sizeof( *fs_iwdIndexNew ) );
+
+		if ( oldNew )
+		{
+			Com_Memcpy( fs_iwdIndexNew, oldNew, fs_numIwdIndexNew * sizeof( *fs_iwdIndexNew ) );
+			Z_Free( oldNew );
+		}
+	}
+
+	fs_iwdIndexNew[fs_numIwdIndexNew++] = record;
+}
+
+static qboolean FS_IwdIndexReplaced( const iwdIndexRecord_t *record )
+{
+	struct stat info;
+	int i;
+
+	for ( i = 0; i < fs_numIwdIndexNew; i++ )
+	{
+		if ( !strcmp( FS_IwdIndexPath( fs_iwdIndexNew[i] ), FS_IwdIndexPath( record ) ) )
+		{
+			return qtrue;
+		}
+	}
+
+	// drop iwds that are gone
+	return stat( FS_IwdIndexPath( record ), &info ) != 0;
+}
+
+/*
+================
+FS_WriteIwdIndex
+
+Writes the index back out if any iwd had to be parsed this time
+================
+*/
+static void FS_WriteIwdIndex()
+{
+	char ospath[MAX_OSPATH];
+	char tmppath[MAX_OSPATH];
+	iwdIndexHeader_t *header;
+	const iwdIndexRecord_t *record;
+	char *buffer;
+	int length;
+	int offset;
+	int i;
+	FILE *f;
+	qboolean written;
+
+	if ( !fs_numIwdIndexNew )
+	{
+		// everything needed was copied out while the iwds were set up
+		FS_FreeIwdIndex();
+		return;
+	}
+
+	length = sizeof( *header );
+
+	for ( i = 0; i < fs_numIwdIndexNew; i++ )
+	{
+		length += fs_iwdIndexNew[i]->recordSize;
+	}
+
+	for ( i = 0; fs_iwdIndexRecords && i <= fs_iwdIndexMask; i++ )
+	{
+		if ( fs_iwdIndexRecords[i] && !FS_IwdIndexReplaced( fs_iwdIndexRecords[i] ) )
+		{
+			length += fs_iwdIndexRecords[i]->recordSize;
+		}
+		else
+		{
+			fs_iwdIndexRecords[i] = NULL;
+		}
+	}
+
+	buffer = (char *)Z_Malloc( length );
+	header = (iwdIndexHeader_t *)buffer;
+	header->ident = IWD_INDEX_IDENT;
+	header->version = IWD_INDEX_VERSION;
+	offset = sizeof( *header );
+
+	for ( i = 0; i < fs_numIwdIndexNew; i++ )
+	{
+		Com_Memcpy( buffer + offset, fs_iwdIndexNew[i], fs_iwdIndexNew[i]->recordSize );
+		offset += fs_iwdIndexNew[i]->recordSize;
+		header->numRecords++;
+		Z_Free( fs_iwdIndexNew[i] );
+	}
+
+	fs_numIwdIndexNew = 0;
+
+	for ( i = 0; fs_iwdIndexRecords && i <= fs_iwdIndexMask; i++ )
+	{
+		record = fs_iwdIndexRecords[i];
+
+		if ( record )
+		{
+			Com_Memcpy( buffer + offset, record, record->recordSize );
+			offset += record->recordSize;
+			header->numRecords++;
+		}
+	}
+
+	FS_FreeIwdIndex();
+
+	// another server sharing fs_homepath may have the index mapped, so
+	// it is never truncated in place but replaced by a complete new file
+	FS_BuildOSPath( fs_homepath->current.string, BASEGAME, IWD_INDEX_NAME, ospath );
+	Com_sprintf( tmppath, sizeof( tmppath ), "%s.%x.tmp", ospath, Sys_Milliseconds() );
+	FS_CreatePath( tmppath );
+
+	f = FS_FileOpenWriteBinary( tmppath );
+
+	if ( f )
+	{
+		written = FS_FileWrite( buffer, length, f ) == (size_t)length;
+		FS_FileClose( f );
+
+		if ( !written || !Sys_ReplaceFile( tmppath, ospath ) )
+		{
+			Com_Printf( "WARNING: couldn't write %s\n", ospath );
+			remove( tmppath );
+		}
+	}
+
+	Z_Free( buffer );
+}
+
+static iwd_t *FS_AllocIwd( const char *zipfile, const char *basename, unzFile uf, int numFiles )
+{
+	iwd_t *iwd;
+	int i;
+
+	// get the hash table size from the number of files in the zip
+	// because lots of custom iwd files have less than 32 or 64 files
+	for ( i = 1; i <= MAX_FILEHASH_SIZE; i <<= 1 )
+	{
+		if ( i > numFiles )
+		{
+			break;
+		}
+	}
+
+	iwd = (iwd_t *)Z_Malloc( sizeof( iwd_t ) * sizeof( intptr_t ) + i * sizeof( fileInIwd_t * ) );
+	iwd->hashSize = i;
+	iwd->hashTable = ( fileInIwd_t ** )( ( (char *) iwd ) + sizeof( iwd_t ) );
+	for ( i = 0; i < iwd->hashSize; i++ )
+	{
+		iwd->hashTable[i] = NULL;
+	}
+
+	Q_strncpyz( iwd->iwdFilename, zipfile, sizeof( iwd->iwdFilename ) );
+	Q_strncpyz( iwd->iwdBasename, basename, sizeof( iwd->iwdBasename ) );
+
+	// strip .iwd if needed
+	if ( strlen( iwd->iwdBasename ) > 4 && !Q_stricmp( iwd->iwdBasename + strlen( iwd->iwdBasename ) - 4, ".iwd" ) )
+	{
+		iwd->iwdBasename[strlen( iwd->iwdBasename ) - 4] = 0;
+	}
+
+	iwd->handle = uf;
+	iwd->numFiles = numFiles;
+
+	return iwd;
+}
+
+static iwd_t *FS_LoadZipFileFromIndex( char *zipfile, const char *basename, unzFile uf, const iwdIndexRecord_t *record )
+{
+	fileInIwd_t    *buildBuffer;
+	iwd_t          *iwd;
+	const iwdIndexEntry_t *entries;
+	const int *checksums;
+	char *namePtr;
+	int i;
+	intptr_t        *fs_headerLongs;
+
+	iwd = FS_AllocIwd( zipfile, basename, uf, record->numEntries );
+	entries = FS_IwdIndexEntries( record );
+	checksums = FS_IwdIndexChecksums( record );
+
+	for ( i = 0; i < record->numEntries; i++ )
+	{
+		if ( entries[i].hash < 0 || entries[i].hash >= iwd->hashSize || entries[i].name < 0 || entries[i].name >= record->namesSize )
+		{
+			Z_Free( iwd );
+			return NULL;
+		}
+	}
+
+	buildBuffer = (fileInIwd_t *)Z_Malloc( ( record->numEntries * sizeof( fileInIwd_t ) ) + record->namesSize );
+	namePtr = ( (char *) buildBuffer ) + record->numEntries * sizeof( fileInIwd_t );
+	Com_Memcpy( namePtr, FS_IwdIndexNames( record ), record->namesSize );
+
+	// same insertion order as the zip walk, so the hash chains come out identical
+	for ( i = 0; i < record->numEntries; i++ )
+	{
+		buildBuffer[i].name = namePtr + entries[i].name;
+		buildBuffer[i].pos = entries[i].pos;
+		buildBuffer[i].next = iwd->hashTable[entries[i].hash];
+		iwd->hashTable[entries[i].hash] = &buildBuffer[i];
+	}
+
+	// the pure checksum depends on the feed, so it can't be stored
+	fs_headerLongs = (intptr_t *)Z_Malloc( ( record->numChecksums + 1 ) * sizeof( intptr_t ) );
+
+	for ( i = 0; i < record->numChecksums; i++ )
+	{
+		fs_headerLongs[i] = checksums[i];
+	}
+
+	iwd->checksum = record->checksum;
+	iwd->pure_checksum = Com_BlockChecksumKey( fs_headerLongs, sizeof( intptr_t ) * record->numChecksums, LittleLong( fs_checksumFeed ) );
+	iwd->pure_checksum = LittleLong( iwd->pure_checksum );
+
+	Z_Free( fs_headerLongs );
+
+	iwd->buildBuffer = buildBuffer;
+	return iwd;
+}
+
 static iwd_t *FS_LoadZipFile( char *zipfile, const char *basename )
 {
 	fileInIwd_t    *buildBuffer;
@@ -458,6 +977,9 @@ static iwd_t *FS_LoadZipFile( char *zipfile, const char *basename )
 	int fs_numHeaderLongs;
 	intptr_t        *fs_headerLongs;
 	char            *namePtr;
+	struct stat info;
+	qboolean useIndex;
+	const iwdIndexRecord_t *record;
 
 	fs_numHeaderLongs = 0;
 
@@ -471,6 +993,23 @@ static iwd_t *FS_LoadZipFile( char *zipfile, const char *basename )
 
 	fs_packFiles += gi.number_entry;
 
+	useIndex = fs_iwdIndexCache->current.boolean && stat( zipfile, &info ) == 0;
+
+	if ( useIndex )
+	{
+		record = FS_FindIwdIndexRecord( zipfile, (int)info.st_size, (int)info.st_mtime );
+
+		if ( record && record->numEntries == (int)gi.number_entry )
+		{
+			iwd = FS_LoadZipFileFromIndex( zipfile, basename, uf, record );
+
+			if ( iwd )
+			{
+				return iwd;
+			}
+		}
+	}
+
 	len = 0;
 	unzGoToFirstFile( uf );
 	for ( i = 0; i < gi.number_entry; i++ )
@@ -488,35 +1027,7 @@ static iwd_t *FS_LoadZipFile( char *zipfile, const char *basename )
 	namePtr = ( (char *) buildBuffer ) + gi.number_entry * sizeof( fileInIwd_t );
 	fs_headerLongs = (intptr_t *)Z_Malloc( gi.number_entry * sizeof( intptr_t ) );
 
-	// get the hash table size from the number of files in the zip
-	// because lots of custom iwd files have less than 32 or 64 files
-	for ( i = 1; i <= MAX_FILEHASH_SIZE; i <<= 1 )
-	{
-		if ( i > gi.number_entry )
-		{
-			break;
-		}
-	}
-
-	iwd = (iwd_t *)Z_Malloc( sizeof( iwd_t ) * sizeof( intptr_t ) + i * sizeof( fileInIwd_t * ) );
-	iwd->hashSize = i;
-	iwd->hashTable = ( fileInIwd_t ** )( ( (char *) iwd ) + sizeof( iwd_t ) );
-	for ( i = 0; i < iwd->hashSize; i++ )
-	{
-		iwd->hashTable[i] = NULL;
-	}
-
-	Q_strncpyz( iwd->iwdFilename, zipfile, sizeof( iwd->iwdFilename ) );
-	Q_strncpyz( iwd->iwdBasename, basename, sizeof( iwd->iwdBasename ) );
-
-	// strip .iwd if needed
-	if ( strlen( iwd->iwdBasename ) > 4 && !Q_stricmp( iwd->iwdBasename + strlen( iwd->iwdBasename ) - 4, ".iwd" ) )
-	{
-		iwd->iwdBasename[strlen( iwd->iwdBasename ) - 4] = 0;
-	}
-
-	iwd->handle = uf;
-	iwd->numFiles = gi.number_entry;
+	iwd = FS_AllocIwd( zipfile, basename, uf, gi.number_entry );
 	unzGoToFirstFile( uf );
 
 	for ( i = 0; i < gi.number_entry; i++ )
@@ -548,9 +1059,16 @@ static iwd_t *FS_LoadZipFile( char *zipfile, const char *basename )
 	iwd->checksum = LittleLong( iwd->checksum );
 	iwd->pure_checksum = LittleLong( iwd->pure_checksum );
 
+	iwd->buildBuffer = buildBuffer;
+
+	// a zip that couldn't be walked to the end is parsed again next time
+	if ( useIndex && i == gi.number_entry )
+	{
+		FS_AddIwdIndexRecord( zipfile, (int)info.st_size, (int)info.st_mtime, iwd, fs_headerLongs, fs_numHeaderLongs );
+	}
+
 	Z_Free( fs_headerLongs );
 
-	iwd->buildBuffer = buildBuffer;
 	return iwd;
 }
 
@@ -1249,6 +1767,207 @@ int FS_FOpenFileReadStream(const char *filename, fileHandle_t *file, qboolean un
 	return FS_FOpenFileRead_Internal(filename, file, uniqueFILE, FS_THREAD_STREAM);
 }
 
+/*
+===========
+FS_GetFileStamp
+
+Returns a value that changes whenever the copy FS_ReadFile would pick for
+filename changes: a different search path wins, or the file on disk gets a
+new size or modification time. Returns 0 if the file can't be found.
+Much cheaper than reading the file, so callers can poll it to keep
+a parsed copy up to date.
+===========
+*/
+unsigned int FS_GetFileStamp(const char *filename)
+{
+	fileInIwd_t* iwdFile;
+	int hash;
+	iwd_t* iwd;
+	char sanitizedName[MAX_OSPATH];
+	const char *extension;
+	directory_t* dir;
+	char netpath[MAX_OSPATH];
+	searchpath_t* search;
+	struct stat info;
+	unsigned int stamp;
+
+	FS_CheckFileSystemStarted();
+
+	if (!FS_SanitizeFilename(filename, sanitizedName))
+	{
+		return 0;
+	}
+
+	stamp = 2166136261u;
+
+	for (search = fs_searchpaths; search; search = search->next)
+	{
+		stamp = (stamp ^ (unsigned int)(size_t)search) * 16777619u;
+
+		if (!FS_UseSearchPath(search))
+		{
+			continue;
+		}
+
+		iwd = search->iwd;
+		if (iwd && iwd->numFiles)
+		{
+			if (!search->localized && !FS_IwdIsPure(iwd))
+			{
+				continue;
+			}
+
+			hash = FS_HashFileName(sanitizedName, iwd->hashSize);
+			for (iwdFile = iwd->hashTable[hash]; iwdFile; iwdFile = iwdFile->next)
+			{
+				if (!FS_FilenameCompare(iwdFile->name, sanitizedName))
+				{
+					// iwds don't change while they are loaded, but a restart can
+					// hand a replaced iwd the same search path address
+					stamp = (stamp ^ (unsigned int)iwd->checksum) * 16777619u;
+					stamp = (stamp ^ (unsigned int)iwdFile->pos) * 16777619u;
+					return stamp ? stamp : 1;
+				}
+			}
+		}
+		else if (search->dir)
+		{
+			extension = Com_GetExtensionSubString(sanitizedName);
+			if (fs_restrict->current.boolean || (fs_numServerIwds && !search->localized && !FS_PureIgnoreFiles(extension)))
+			{
+				continue;
+			}
+
+			dir = search->dir;
+
+			FS_BuildOSPath(dir->path, dir->gamedir, sanitizedName, netpath);
+			if (stat(netpath, &info) != 0)
+			{
+				continue;
+			}
+
+			stamp = (stamp ^ (unsigned int)info.st_mtime) * 16777619u;
+			stamp = (stamp ^ (unsigned int)info.st_size) * 16777619u;
+			return stamp ? stamp : 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+===========
+FS_FindIwdForFile
+
+Finds the iwd FS_FOpenFileRead would read filename from, and the position of
+its entry in the central directory. Returns qfalse if the file isn't there
+or a loose copy takes precedence.
+===========
+*/
+qboolean FS_FindIwdForFile(const char *filename, char *iwdPath, int iwdPathSize, unsigned long *pos)
+{
+	fileInIwd_t* iwdFile;
+	int hash;
+	iwd_t* iwd;
+	char sanitizedName[MAX_OSPATH];
+	const char *extension;
+	directory_t* dir;
+	char netpath[MAX_OSPATH];
+	searchpath_t* search;
+	struct stat info;
+
+	FS_CheckFileSystemStarted();
+
+	if (!FS_SanitizeFilename(filename, sanitizedName))
+	{
+		return qfalse;
+	}
+
+	for (search = fs_searchpaths; search; search = search->next)
+	{
+		if (!FS_UseSearchPath(search))
+		{
+			continue;
+		}
+
+		iwd = search->iwd;
+		if (iwd && iwd->numFiles)
+		{
+			if (!search->localized && !FS_IwdIsPure(iwd))
+			{
+				continue;
+			}
+
+			hash = FS_HashFileName(sanitizedName, iwd->hashSize);
+			for (iwdFile = iwd->hashTable[hash]; iwdFile; iwdFile = iwdFile->next)
+			{
+				if (!FS_FilenameCompare(iwdFile->name, sanitizedName))
+				{
+					I_strncpyz(iwdPath, iwd->iwdFilename, iwdPathSize);
+					*pos = iwdFile->pos;
+					return qtrue;
+				}
+			}
+		}
+		else if (search->dir)
+		{
+			extension = Com_GetExtensionSubString(sanitizedName);
+			if (fs_restrict->current.boolean || (fs_numServerIwds && !search->localized && !FS_PureIgnoreFiles(extension)))
+			{
+				continue;
+			}
+
+			dir = search->dir;
+
+			FS_BuildOSPath(dir->path, dir->gamedir, sanitizedName, netpath);
+			if (stat(netpath, &info) == 0)
+			{
+				return qfalse;
+			}
+		}
+	}
+
+	return qfalse;
+}
+
+/*
+===========
+FS_MapFile
+
+Maps a file opened outside of an iwd into memory, copy on write.
+Returns NULL for iwd files or if mapping fails; free with Sys_UnmapFile.
+===========
+*/
+void *FS_MapFile(fileHandle_t f, int *length)
+{
+	*length = 0;
+
+	if (fsh[f].zipFile || !FS_FileForHandle(f))
+	{
+		return NULL;
+	}
+
+	return Sys_MapFileStream(FS_FileForHandle(f), length);
+}
+
+/*
+===========
+FS_GetIwdFileCrc
+
+Gives the crc the zip directory stores for a file opened from an iwd
+===========
+*/
+qboolean FS_GetIwdFileCrc(fileHandle_t f, unsigned int *crc)
+{
+	if (!fsh[f].zipFile)
+	{
+		return qfalse;
+	}
+
+	*crc = ((unz_s *)fsh[f].handleFiles.file.z)->cur_file_info.crc;
+	return qtrue;
+}
+
 int FS_Seek(int f, int offset, int origin)
 {
 	int iZipPos;
@@ -2815,6 +3534,7 @@ static void FS_RegisterDvars()
 	fs_gameDirVar = Dvar_RegisterString("fs_game", "", DVAR_SERVERINFO | DVAR_SYSTEMINFO | DVAR_INIT | DVAR_CHANGEABLE_RESET);
 	fs_restrict = Dvar_RegisterBool("fs_restrict", false, DVAR_INIT | DVAR_CHANGEABLE_RESET);
 	fs_ignoreLocalized = Dvar_RegisterBool("fs_ignoreLocalized", false, DVAR_INIT | DVAR_CHANGEABLE_RESET);
+	fs_iwdIndexCache = Dvar_RegisterBool("fs_iwdIndexCache", false, DVAR_ARCHIVE | DVAR_CHANGEABLE_RESET);
 }
 
 static void FS_Startup(const char *gameName)
@@ -2881,6 +3601,8 @@ static void FS_Startup(const char *gameName)
 			FS_AddGameDirectory(fs_homepath->current.string, fs_gameDirVar->current.string);
 	}
 
+	FS_WriteIwdIndex();
+
 	FS_AddCommands();
 	FS_Path_f();
 	Dvar_ClearModified(fs_gameDirVar);
@@ -185,6 +185,10 @@ void FS_ShutdownServerIwdNames();
 void FS_ShutdownServerReferencedIwds();
 void FS_PureServerSetLoadedIwds(const char *paksums, const char *paknames);
 int FS_FOpenFileRead(const char *filename, fileHandle_t *file, qboolean uniqueFILE);
+unsigned int FS_GetFileStamp(const char *filename);
+qboolean FS_FindIwdForFile(const char *filename, char *iwdPath, int iwdPathSize, unsigned long *pos);
+qboolean FS_GetIwdFileCrc(fileHandle_t f, unsigned int *crc);
+void *FS_MapFile(fileHandle_t f, int *length);
 int FS_SV_FOpenFileRead( const char *filename, fileHandle_t *fp );
 int FS_SV_FOpenFileWrite( const char *filename );
 void FS_AddIwdFilesForGameDirectory(const char *path, const char *dir);
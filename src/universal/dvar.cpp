@@ -9,6 +9,7 @@ dvar_t *dvar_cheats;
 static bool isDvarSystemActive;
 static bool isLoadingAutoExecGlobalFlag;
 int dvar_modifiedFlags;
+int dvar_modifiedCount;
 
 static long generateHashValue( const char *fname )
 {
@@ -552,6 +553,7 @@ static void Dvar_MakeExplicitType(dvar_t *dvar, const char *dvarName, DvarType t
 	Dvar_UpdateValue(dvar, castValue);
 
 	dvar_modifiedFlags |= flags;
+	dvar_modifiedCount++;
 
 	if (wasString)
 	{
@@ -688,6 +690,7 @@ static dvar_t *Dvar_RegisterNew(const char *dvarName, DvarType type, unsigned sh
 	dvar->next = *sorted;
 	*sorted = dvar;
 	dvar->flags = flags;
+	dvar_modifiedCount++;
 	hash = generateHashValue(dvarName);
 	dvar->hashNext = dvarHashTable[hash];
 	dvarHashTable[hash] = dvar;
@@ -974,6 +977,7 @@ static void Dvar_SetVariant(dvar_t *dvar, DvarValue value, DvarSetSource source)
 	else
 	{
 		dvar_modifiedFlags |= dvar->flags;
+		dvar_modifiedCount++;
 
 		switch (dvar->type)
 		{
@@ -1056,6 +1060,7 @@ static void Dvar_Reregister(dvar_t *dvar, const char *dvarName, DvarType type, u
 	}
 
 	dvar->flags |= flags;
+	dvar_modifiedCount++;
 	if (dvar->flags & DVAR_CHEAT && dvar_cheats && !dvar_cheats->current.boolean)
 	{
 		Dvar_SetVariant(dvar, dvar->reset, DVAR_SOURCE_INTERNAL);
@@ -1876,11 +1881,13 @@ void Dvar_Reset(dvar_t *dvar, DvarSetSource setSource)
 void Dvar_AddFlags(dvar_t *dvar, int flags)
 {
 	dvar->flags |= flags;
+	dvar_modifiedCount++;
 }
 
 void Dvar_ClearFlags(dvar_t *dvar, int flags)
 {
 	dvar->flags &= ~flags;
+	dvar_modifiedCount++;
 }
 
 void Dvar_ClearModified(dvar_t *dvar)
@@ -1938,6 +1945,8 @@ void Dvar_ResetScriptInfo()
 
 	for ( dvarIter = 0; dvarIter < dvarCount; ++dvarIter )
 		dvarPool[dvarIter].flags &= ~DVAR_SERVERINFO_NOUPDATE;
+
+	dvar_modifiedCount++;
 }
 
 void Dvar_Init()
@@ -97,6 +97,7 @@ typedef struct dvar_s
 extern dvar_t *sortedDvars;
 extern int dvarCount;
 extern int dvar_modifiedFlags;
+extern int dvar_modifiedCount;  // bumped whenever any dvar value or flags change
 
 dvar_t *Dvar_RegisterBool(const char *dvarName, bool value, unsigned short flags);
 dvar_t *Dvar_RegisterInt(const char *dvarName, int value, int min, int max, unsigned short flags);
@@ -23,6 +23,8 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 void Sys_QueEvent( int time, sysEventType_t type, int value, int value2, int ptrLength, void *ptr );
 qboolean Sys_GetPacket ( netadr_t *net_from, msg_t *net_message );
+qboolean Sys_GetQueuedPacket( sysEvent_t *ev );
+qboolean Sys_IsRecvThreadActive( void );
 void Sys_SendKeyEvents (void);
 
 // Input subsystem
@@ -1132,9 +1132,15 @@ sysEvent_t Sys_GetEvent( void ) {
   IN_Frame();
 #endif
 
+  // packets from the receive thread are handed out in place
+  if ( Sys_GetQueuedPacket( &ev ) )
+  {
+    return ev;
+  }
+
   // check for network packets
   MSG_Init( &netmsg, sys_packetReceived, sizeof( sys_packetReceived ) );
-  if ( Sys_GetPacket ( &adr, &netmsg ) )
+  if ( !Sys_IsRecvThreadActive() && Sys_GetPacket ( &adr, &netmsg ) )
   {
     netadr_t    *buf;
     int       len;
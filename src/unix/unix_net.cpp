@@ -23,6 +23,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include "../qcommon/qcommon.h"
 #include "../qcommon/netchan.h"
+#include "../qcommon/sys_thread.h"
 
 #include <stdint.h>
 #include <unistd.h>
@@ -36,6 +37,8 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <sys/ioctl.h>
 #include <sys/uio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 
 #ifdef MACOS_X
 #import <sys/sockio.h>
@@ -207,6 +210,498 @@ qboolean	Sys_GetPacket (netadr_t *net_from, msg_t *net_message)
 	return qfalse;
 }
 
+/*
+=============================================================================
+
+RECEIVE THREAD
+
+With net_recvThread set, a thread drains ip_socket with recvmmsg into a
+ring of datagram sized packet slots. The main thread hands the slots out
+from Sys_GetEvent and Com_EventLoop processes them in place, so no packet
+is allocated or copied on the way to SV_PacketEvent. A slot handed out is
+owned by the main thread until the next Sys_GetQueuedPacket call.
+
+=============================================================================
+*/
+
+#ifdef __linux__
+
+#define NET_RECV_SLOTS      256     // must be a power of two
+#define NET_RECV_MASK       ( NET_RECV_SLOTS - 1 )
+#define NET_RECV_BATCH      32
+
+// clients fragment anything above MAX_PACKETLEN, and connectionless
+// requests stay well below this, bigger datagrams are dropped as oversize
+#define NET_RECV_PACKET_SIZE    0x1000
+
+typedef struct
+{
+	int time;           // arrival time, becomes the event time
+	int cursize;        // -1 if the datagram didn't fit
+	netadr_t from;      // data has to follow, the event hands out &from
+	byte data[NET_RECV_PACKET_SIZE];
+} netRecvSlot_t;
+
+static dvar_t *net_recvThread;
+
+static netRecvSlot_t *netRecvSlots;
+static volatile int netRecvHead;        // written by the receive thread
+static volatile int netRecvTail;        // slots before this can be reused
+static int netRecvNext;                 // next slot to hand out
+static volatile qboolean netRecvThreadRunning;
+static volatile qboolean netRecvThreadStop;
+static volatile int netWakePending;
+static int netWakePipe[2] = { -1, -1 };
+
+/*
+==================
+NET_WakeMainThread
+==================
+*/
+static void NET_WakeMainThread( void )
+{
+	byte b = 0;
+
+	if ( __sync_lock_test_and_set( &netWakePending, 1 ) )
+	{
+		return;
+	}
+
+	if ( write( netWakePipe[1], &b, 1 ) == -1 )
+	{
+		netWakePending = 0;
+	}
+}
+
+/*
+==================
+NET_RecvThread
+==================
+*/
+static void *NET_RecvThread( void *arg )
+{
+	struct mmsghdr msgs[NET_RECV_BATCH];
+	struct iovec iovecs[NET_RECV_BATCH];
+	struct sockaddr_in from[NET_RECV_BATCH];
+	struct pollfd pfd;
+	netRecvSlot_t *slot;
+	int head;
+	int count;
+	int time;
+	int ret;
+	int i;
+
+	pfd.fd = ip_socket;
+	pfd.events = POLLIN;
+
+	while ( !netRecvThreadStop )
+	{
+		head = netRecvHead;
+		count = NET_RECV_SLOTS - ( head - netRecvTail );
+
+		// the main thread is behind, let the socket buffer hold the rest
+		if ( !count )
+		{
+			Sys_SleepMSec( 1 );
+			continue;
+		}
+
+		if ( poll( &pfd, 1, 100 ) <= 0 )
+		{
+			continue;
+		}
+
+		if ( count > NET_RECV_BATCH )
+		{
+			count = NET_RECV_BATCH;
+		}
+
+		memset( msgs, 0, sizeof( msgs[0] ) * count );
+
+		for ( i = 0; i < count; i++ )
+		{
+			slot = &netRecvSlots[( head + i ) & NET_RECV_MASK];
+
+			iovecs[i].iov_base = slot->data;
+			iovecs[i].iov_len = sizeof( slot->data );
+
+			msgs[i].msg_hdr.msg_name = &from[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof( from[i] );
+			msgs[i].msg_hdr.msg_iov = &iovecs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		ret = recvmmsg( ip_socket, msgs, count, MSG_DONTWAIT, NULL );
+
+		if ( ret <= 0 )
+		{
+			continue;
+		}
+
+		time = Sys_Milliseconds();
+
+		for ( i = 0; i < ret; i++ )
+		{
+			slot = &netRecvSlots[( head + i ) & NET_RECV_MASK];
+
+			slot->time = time;
+			SockadrToNetadr( &from[i], &slot->from );
+
+			if ( msgs[i].msg_len >= sizeof( slot->data ) || ( msgs[i].msg_hdr.msg_flags & MSG_TRUNC ) )
+			{
+				slot->cursize = -1;
+			}
+			else
+			{
+				slot->cursize = msgs[i].msg_len;
+			}
+		}
+
+		// publish the slots before the main thread can see the new head
+		__sync_synchronize();
+		netRecvHead = head + ret;
+		__sync_synchronize();
+
+		NET_WakeMainThread();
+	}
+
+	netRecvThreadRunning = qfalse;
+	return NULL;
+}
+
+/*
+==================
+NET_StartRecvThread
+==================
+*/
+static void NET_StartRecvThread( void )
+{
+	threadid_t tid;
+
+	if ( !ip_socket || netRecvThreadRunning )
+	{
+		return;
+	}
+
+	if ( pipe( netWakePipe ) == -1 )
+	{
+		Com_Printf( "NET_StartRecvThread: pipe: %s\n", NET_ErrorString() );
+		return;
+	}
+
+	fcntl( netWakePipe[0], F_SETFL, O_NONBLOCK );
+	fcntl( netWakePipe[1], F_SETFL, O_NONBLOCK );
+
+	if ( !netRecvSlots )
+	{
+		netRecvSlots = (netRecvSlot_t *)Z_Malloc( sizeof( netRecvSlot_t ) * NET_RECV_SLOTS );
+	}
+
+	netRecvHead = 0;
+	netRecvTail = 0;
+	netRecvNext = 0;
+	netWakePending = 0;
+	netRecvThreadStop = qfalse;
+	netRecvThreadRunning = qtrue;
+
+	if ( !Sys_CreateNewThread( NET_RecvThread, &tid, NULL ) )
+	{
+		netRecvThreadRunning = qfalse;
+		close( netWakePipe[0] );
+		close( netWakePipe[1] );
+		netWakePipe[0] = netWakePipe[1] = -1;
+		return;
+	}
+
+	Com_Printf( "Network receive thread started\n" );
+}
+
+/*
+==================
+NET_StopRecvThread
+==================
+*/
+static void NET_StopRecvThread( void )
+{
+	if ( !netRecvThreadRunning )
+	{
+		return;
+	}
+
+	netRecvThreadStop = qtrue;
+
+	while ( netRecvThreadRunning )
+	{
+		Sys_SleepMSec( 1 );
+	}
+
+	close( netWakePipe[0] );
+	close( netWakePipe[1] );
+	netWakePipe[0] = netWakePipe[1] = -1;
+}
+
+/*
+==================
+Sys_IsRecvThreadActive
+==================
+*/
+qboolean Sys_IsRecvThreadActive( void )
+{
+	return netRecvThreadRunning;
+}
+
+/*
+==================
+Sys_GetQueuedPacket
+
+Hands out the next received packet as an SE_PACKET event whose
+evPtr points into the receive ring, flagged by evValue holding the
+size of the slot's data buffer
+==================
+*/
+qboolean Sys_GetQueuedPacket( sysEvent_t *ev )
+{
+	netRecvSlot_t *slot;
+
+	if ( !netRecvThreadRunning )
+	{
+		return qfalse;
+	}
+
+	// whatever was handed out before has been processed or copied by now
+	if ( netRecvTail != netRecvNext )
+	{
+		__sync_synchronize();
+		netRecvTail = netRecvNext;
+	}
+
+	while ( netRecvNext != netRecvHead )
+	{
+		__sync_synchronize();
+
+		slot = &netRecvSlots[netRecvNext & NET_RECV_MASK];
+		netRecvNext++;
+
+		if ( slot->cursize < 0 )
+		{
+			Com_Printf( "Oversize packet from %s\n", NET_AdrToString( slot->from ) );
+			continue;
+		}
+
+		ev->evTime = slot->time;
+		ev->evType = SE_PACKET;
+		ev->evValue = sizeof( slot->data );
+		ev->evValue2 = 0;
+		ev->evPtrLength = sizeof( netadr_t ) + slot->cursize;
+		ev->evPtr = &slot->from;
+
+		return qtrue;
+	}
+
+	return qfalse;
+}
+
+#else
+
+qboolean Sys_IsRecvThreadActive( void )
+{
+	return qfalse;
+}
+
+qboolean Sys_GetQueuedPacket( sysEvent_t *ev )
+{
+	return qfalse;
+}
+
+#endif
+
+/*
+=============================================================================
+
+SEND BATCHING
+
+With net_sendBatch set, the datagrams a server frame sends are queued
+between NET_BeginSendBatch and NET_FlushSendBatch and handed to the
+kernel with sendmmsg, instead of one sendto per packet. Loopback and bot
+addresses never reach Sys_SendPacket, so they are still delivered at once
+by NET_SendPacket.
+
+=============================================================================
+*/
+
+#ifdef __linux__
+
+#define NET_SEND_QUEUE_PACKETS  512
+#define NET_SEND_QUEUE_BYTES    ( 512 * 1024 )
+#define NET_SEND_BATCH          64
+
+typedef struct
+{
+	int socket;
+	int offset;
+	int length;
+	netadr_t to;
+	struct sockaddr_in addr;
+} netSendEntry_t;
+
+static dvar_t *net_sendBatch;
+
+static netSendEntry_t netSendQueue[NET_SEND_QUEUE_PACKETS];
+static byte netSendBuffer[NET_SEND_QUEUE_BYTES];
+static int netSendCount;
+static int netSendBytes;
+static qboolean netSendBatching;
+
+/*
+==================
+NET_SendQueuedPackets
+
+Sends count queued packets for the same socket, starting at first
+==================
+*/
+static void NET_SendQueuedPackets( int first, int count )
+{
+	struct mmsghdr msgs[NET_SEND_BATCH];
+	struct iovec iovecs[NET_SEND_BATCH];
+	netSendEntry_t *entry;
+	int num;
+	int ret;
+	int i;
+
+	while ( count > 0 )
+	{
+		num = count;
+
+		if ( num > NET_SEND_BATCH )
+		{
+			num = NET_SEND_BATCH;
+		}
+
+		memset( msgs, 0, sizeof( msgs[0] ) * num );
+
+		for ( i = 0; i < num; i++ )
+		{
+			entry = &netSendQueue[first + i];
+
+			iovecs[i].iov_base = &netSendBuffer[entry->offset];
+			iovecs[i].iov_len = entry->length;
+
+			msgs[i].msg_hdr.msg_name = &entry->addr;
+			msgs[i].msg_hdr.msg_namelen = sizeof( entry->addr );
+			msgs[i].msg_hdr.msg_iov = &iovecs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		// sendmmsg stops short of a packet that fails, and only the next
+		// call returns its error, which is reported before skipping it
+		ret = sendmmsg( netSendQueue[first].socket, msgs, num, 0 );
+
+		if ( ret <= 0 )
+		{
+			Com_Printf( "NET_SendPacket ERROR: %s to %s\n", NET_ErrorString(),
+					NET_AdrToString( netSendQueue[first].to ) );
+			ret = 1;
+		}
+
+		first += ret;
+		count -= ret;
+	}
+}
+
+/*
+==================
+NET_BeginSendBatch
+==================
+*/
+void NET_BeginSendBatch( void )
+{
+	// a frame that errored out never got to flush its packets
+	if ( netSendBatching )
+	{
+		NET_FlushSendBatch();
+	}
+
+	if ( !net_sendBatch || !net_sendBatch->current.boolean )
+	{
+		return;
+	}
+
+	netSendBatching = qtrue;
+}
+
+/*
+==================
+NET_FlushSendBatch
+==================
+*/
+void NET_FlushSendBatch( void )
+{
+	int first;
+	int i;
+
+	netSendBatching = qfalse;
+
+	for ( first = 0, i = 1; i <= netSendCount; i++ )
+	{
+		if ( i < netSendCount && netSendQueue[i].socket == netSendQueue[first].socket )
+		{
+			continue;
+		}
+
+		NET_SendQueuedPackets( first, i - first );
+		first = i;
+	}
+
+	netSendCount = 0;
+	netSendBytes = 0;
+}
+
+/*
+==================
+NET_QueuePacket
+==================
+*/
+static qboolean NET_QueuePacket( int net_socket, int length, const void *data, netadr_t to, const struct sockaddr_in *addr )
+{
+	netSendEntry_t *entry;
+
+	if ( length > NET_SEND_QUEUE_BYTES )
+	{
+		return qfalse;
+	}
+
+	if ( netSendCount == NET_SEND_QUEUE_PACKETS || netSendBytes + length > NET_SEND_QUEUE_BYTES )
+	{
+		NET_FlushSendBatch();
+		netSendBatching = qtrue;
+	}
+
+	entry = &netSendQueue[netSendCount++];
+
+	entry->socket = net_socket;
+	entry->offset = netSendBytes;
+	entry->length = length;
+	entry->to = to;
+	entry->addr = *addr;
+
+	memcpy( &netSendBuffer[netSendBytes], data, length );
+	netSendBytes += length;
+
+	return qtrue;
+}
+
+#else
+
+void NET_BeginSendBatch( void )
+{
+}
+
+void NET_FlushSendBatch( void )
+{
+}
+
+#endif
+
 //=============================================================================
 
 qboolean	Sys_SendPacket( int length, const void *data, netadr_t to )
@@ -241,6 +736,18 @@ qboolean	Sys_SendPacket( int length, const void *data, netadr_t to )
 
 	NetadrToSockadr (&to, &addr);
 
+#ifdef __linux__
+	if ( netSendBatching )
+	{
+		if ( NET_QueuePacket( net_socket, length, data, to, &addr ) )
+			return qtrue;
+
+		// too large to queue, keep the order by sending what's queued first
+		NET_FlushSendBatch();
+		netSendBatching = qtrue;
+	}
+#endif
+
 	ret = sendto (net_socket, data, length, 0, (struct sockaddr *)&addr, sizeof(addr) );
 	if (ret == -1)
 	{
@@ -537,10 +1044,19 @@ NET_Init
 void NET_Init (void)
 {
 	noudp = Dvar_RegisterBool("net_noudp", 0, 0);
+#ifdef __linux__
+	net_recvThread = Dvar_RegisterBool("net_recvThread", 0, DVAR_LATCH);
+	net_sendBatch = Dvar_RegisterBool("net_sendBatch", 0, 0);
+#endif
 	// open sockets
 	if (! noudp->current.boolean) {
 		NET_OpenIP ();
 	}
+#ifdef __linux__
+	if ( net_recvThread->current.boolean ) {
+		NET_StartRecvThread ();
+	}
+#endif
 }
 
 /*
@@ -550,6 +1066,9 @@ NET_Shutdown
 */
 void	NET_Shutdown (void)
 {
+#ifdef __linux__
+	NET_StopRecvThread ();
+#endif
 	if (ip_socket) {
 		close(ip_socket);
 		ip_socket = 0;
@@ -577,9 +1096,39 @@ void NET_Sleep(int msec)
 	fd_set	fdset;
 	extern qboolean stdin_active;
 
+#ifdef __linux__
+	// anything still queued would otherwise wait out the sleep
+	if ( netSendBatching )
+		NET_FlushSendBatch ();
+#endif
+
 	if (!ip_socket || !com_dedicated->current.integer)
 		return; // we're not a server, just run full speed
 
+#ifdef __linux__
+	if ( netRecvThreadRunning ) {
+		byte	b[64];
+
+		// the receive thread owns the socket, wait on its wakeup pipe
+		while ( read( netWakePipe[0], b, sizeof( b ) ) > 0 )
+			;
+		netWakePending = 0;
+		__sync_synchronize();
+
+		if ( netRecvNext != netRecvHead )
+			return;
+
+		FD_ZERO(&fdset);
+		if (stdin_active)
+			FD_SET(0, &fdset); // stdin is processed too
+		FD_SET(netWakePipe[0], &fdset);
+		timeout.tv_sec = msec/1000;
+		timeout.tv_usec = (msec%1000)*1000;
+		select(netWakePipe[0]+1, &fdset, NULL, NULL, &timeout);
+		return;
+	}
+#endif
+
 	FD_ZERO(&fdset);
 	if (stdin_active)
 		FD_SET(0, &fdset); // stdin is processed too
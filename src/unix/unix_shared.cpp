@@ -26,6 +26,7 @@ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 #include <dirent.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <fcntl.h>
 #include <sys/time.h>
 #include <pwd.h>
 
@@ -337,6 +338,86 @@ void	Sys_FreeFileList( char **list ) {
 	Z_Free( list );
 }
 
+/*
+==================
+Sys_MapFile
+
+Maps a whole file read only. Returns NULL if it can't be opened or is empty.
+==================
+*/
+void *Sys_MapFile( const char *path, int *length )
+{
+	int fd;
+	struct stat st;
+	void *base;
+
+	*length = 0;
+
+	fd = open( path, O_RDONLY );
+	if ( fd == -1 )
+		return NULL;
+
+	if ( fstat( fd, &st ) == -1 || st.st_size <= 0 || st.st_size > 0x7FFFFFFF )
+	{
+		close( fd );
+		return NULL;
+	}
+
+	base = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+
+	if ( base == MAP_FAILED )
+		return NULL;
+
+	*length = st.st_size;
+	return base;
+}
+
+/*
+==================
+Sys_MapFileStream
+
+Maps an open file copy on write: pages stay shared with the page cache
+until they are written to. Returns NULL if the file can't be mapped.
+==================
+*/
+void *Sys_MapFileStream( FILE *f, int *length )
+{
+	struct stat st;
+	void *base;
+
+	*length = 0;
+
+	if ( fstat( fileno( f ), &st ) == -1 || st.st_size <= 0 || st.st_size > 0x7FFFFFFF )
+		return NULL;
+
+	base = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno( f ), 0 );
+
+	if ( base == MAP_FAILED )
+		return NULL;
+
+	*length = st.st_size;
+	return base;
+}
+
+void Sys_UnmapFile( void *base, int length )
+{
+	if ( base )
+		munmap( base, length );
+}
+
+/*
+==================
+Sys_ReplaceFile
+
+Atomically moves from over to, existing mappings of to keep the old data
+==================
+*/
+qboolean Sys_ReplaceFile( const char *from, const char *to )
+{
+	return rename( from, to ) == 0;
+}
+
 char *Sys_Cwd( void ) 
 {
 	static char cwd[MAX_OSPATH];
@@ -994,6 +994,24 @@ sleeps msec or until net socket is ready
 void NET_Sleep( int msec ) {
 }
 
+/*
+====================
+NET_BeginSendBatch
+
+Packets are always sent right away on windows
+====================
+*/
+void NET_BeginSendBatch( void ) {
+}
+
+/*
+====================
+NET_FlushSendBatch
+====================
+*/
+void NET_FlushSendBatch( void ) {
+}
+
 
 /*
 ====================
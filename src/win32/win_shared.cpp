@@ -74,6 +74,107 @@ const char *Sys_GetCurrentUser( void )
 	return s_userName;
 }
 
+/*
+==================
+Sys_MapFile
+
+Maps a whole file read only. Returns NULL if it can't be opened or is empty.
+==================
+*/
+void *Sys_MapFile( const char *path, int *length )
+{
+	HANDLE file;
+	HANDLE mapping;
+	DWORD size;
+	void *base;
+
+	*length = 0;
+
+	file = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( file == INVALID_HANDLE_VALUE )
+		return NULL;
+
+	size = GetFileSize( file, NULL );
+	if ( size == INVALID_FILE_SIZE || size == 0 || size > 0x7FFFFFFF )
+	{
+		CloseHandle( file );
+		return NULL;
+	}
+
+	mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	CloseHandle( file );
+
+	if ( !mapping )
+		return NULL;
+
+	// the view keeps the mapping alive
+	base = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	CloseHandle( mapping );
+
+	if ( !base )
+		return NULL;
+
+	*length = size;
+	return base;
+}
+
+/*
+==================
+Sys_MapFileStream
+
+Maps an open file copy on write: pages stay shared with the page cache
+until they are written to. Returns NULL if the file can't be mapped.
+==================
+*/
+void *Sys_MapFileStream( FILE *f, int *length )
+{
+	HANDLE file;
+	HANDLE mapping;
+	DWORD size;
+	void *base;
+
+	*length = 0;
+
+	file = (HANDLE)_get_osfhandle( _fileno( f ) );
+	if ( file == INVALID_HANDLE_VALUE )
+		return NULL;
+
+	size = GetFileSize( file, NULL );
+	if ( size == INVALID_FILE_SIZE || size == 0 || size > 0x7FFFFFFF )
+		return NULL;
+
+	mapping = CreateFileMappingA( file, NULL, PAGE_WRITECOPY, 0, 0, NULL );
+	if ( !mapping )
+		return NULL;
+
+	base = MapViewOfFile( mapping, FILE_MAP_COPY, 0, 0, 0 );
+	CloseHandle( mapping );
+
+	if ( !base )
+		return NULL;
+
+	*length = size;
+	return base;
+}
+
+void Sys_UnmapFile( void *base, int length )
+{
+	if ( base )
+		UnmapViewOfFile( base );
+}
+
+/*
+==================
+Sys_ReplaceFile
+
+Moves from over to, replacing it if it exists
+==================
+*/
+qboolean Sys_ReplaceFile( const char *from, const char *to )
+{
+	return MoveFileExA( from, to, MOVEFILE_REPLACE_EXISTING ) ? qtrue : qfalse;
+}
+
 const char	*Sys_DefaultHomePath(void) {
 	return NULL;
 }